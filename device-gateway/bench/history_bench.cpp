@@ -0,0 +1,96 @@
+// Host benchmark for the attribute history compression (src/modules/manager/time_series.h)
+//
+//   g++ -O2 -std=gnu++11 -Isrc bench/history_bench.cpp -o history_bench && ./history_bench
+//
+// Feeds a day of simulated sensor readings (30s interval with jitter, values rounded like the transforms do)
+// through the encoder, checks that every sample decodes back exactly and reports the size per sample.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "modules/manager/time_series.h"
+
+#define SAMPLES 2880 // a day at 30s
+#define INTERVAL 30
+
+struct Sample
+{
+    uint32_t time;
+    float value;
+};
+
+static std::vector<Sample> simulate(float start, float walk, float decimals, int jitter, unsigned seed)
+{
+    std::mt19937 random(seed);
+    std::normal_distribution<float> noise(0, walk);
+    std::uniform_int_distribution<int> delay(-jitter, jitter);
+    std::vector<Sample> samples;
+    float value = start;
+    for (int i = 0; i < SAMPLES; i++)
+    {
+        value += noise(random);
+        samples.push_back({(uint32_t)(1000 + i * INTERVAL + delay(random)), roundf(value * decimals) / decimals});
+    }
+    return samples;
+}
+
+static bool run(const char *name, const std::vector<Sample> &samples)
+{
+    std::vector<TimeSeriesBlock> blocks(1);
+    TimeSeriesEncoder encoder;
+    encoder.begin(&blocks[0], samples[0].time, samples[0].value);
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 1; i < samples.size(); i++)
+    {
+        if (!encoder.append(samples[i].time, samples[i].value))
+        {
+            blocks.emplace_back();
+            encoder = TimeSeriesEncoder(); // blocks may have moved
+            encoder.begin(&blocks.back(), samples[i].time, samples[i].value);
+        }
+    }
+    double encodeNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / samples.size();
+
+    size_t index = 0, bits = 0;
+    for (const TimeSeriesBlock &block : blocks)
+    {
+        TimeSeriesDecoder decoder(block);
+        uint32_t time;
+        float value;
+        while (decoder.next(time, value))
+        {
+            if (index >= samples.size() || time != samples[index].time || value != samples[index].value)
+            {
+                printf("! %s: sample %d does not match\n", name, (int)index);
+                return false;
+            }
+            index++;
+        }
+        bits += block.bits + 64; // + start / end timestamp
+    }
+    if (index != samples.size())
+    {
+        printf("! %s: %d of %d samples decoded\n", name, (int)index, (int)samples.size());
+        return false;
+    }
+
+    printf("+ %-22s %5.2f bytes/sample, %d blocks (%d B) per day, %.0f ns/sample\n", name, bits / 8.0 / samples.size(),
+           (int)blocks.size(), (int)(blocks.size() * sizeof(TimeSeriesBlock)), encodeNs);
+    return true;
+}
+
+int main()
+{
+    bool ok = true;
+    ok &= run("temperature (0.1)", simulate(21.4f, 0.03f, 10, 0, 1));
+    ok &= run("temperature, jitter", simulate(21.4f, 0.03f, 10, 2, 2));
+    ok &= run("humidity (0.1)", simulate(48.0f, 0.2f, 10, 1, 3));
+    ok &= run("pressure (0.1)", simulate(1012.6f, 0.05f, 10, 1, 4));
+    ok &= run("gas (0.01)", simulate(87.1f, 0.5f, 100, 1, 5));
+    ok &= run("altitude (1)", simulate(12.0f, 0.3f, 1, 1, 6));
+    printf("+ %d byte raw sample (uint32 time, float value)\n", (int)sizeof(Sample));
+    return ok ? 0 : 1;
+}
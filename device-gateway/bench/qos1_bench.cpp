@@ -0,0 +1,188 @@
+// Host benchmark for QoS 1 publishing (src/external/OpenRemotePubSubClient/mqtt_qos1.h)
+//
+//   g++ -O2 -std=gnu++11 -Isrc bench/qos1_bench.cpp -o qos1_bench && ./qos1_bench
+//
+// Simulates a broker behind a link with injected latency (1 ms steps): the gateway publishes a backlog of
+// attribute updates through the in-flight window, the broker decodes every PUBLISH and answers with a PUBACK,
+// the gateway reads the PUBACKs every loop() (100 ms) through the packet scanner. Reports the throughput per
+// window size and round trip time, then drops the connection mid-stream and checks that every message
+// arrives (at least once) after the reconnect and the retransmission.
+
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <set>
+#include <vector>
+#include "external/OpenRemotePubSubClient/mqtt_qos1.h"
+
+#define MESSAGES 2000
+#define POLL_INTERVAL 100 // ms, loop() reads the socket
+#define SEND_PER_MS 4     // publishes the gateway gets out per ms (TLS, UDP task)
+#define RECONNECT_TIME 500
+
+struct Frame
+{
+    unsigned long arrival;
+    std::vector<uint8_t> bytes;
+};
+
+struct Link
+{
+    unsigned long latency; // one way
+    std::deque<Frame> up;   // gateway -> broker
+    std::deque<Frame> down; // broker -> gateway
+    std::vector<uint8_t> received; // gateway socket buffer
+
+    void drop()
+    {
+        up.clear();
+        down.clear();
+        received.clear();
+    }
+};
+
+struct Broker
+{
+    std::set<int> delivered;
+    int duplicates = 0;
+
+    // decode a QoS 1 PUBLISH, answer with a PUBACK
+    bool receive(const std::vector<uint8_t> &packet, std::vector<uint8_t> &puback)
+    {
+        size_t i = 1, remaining = 0, multiplier = 1;
+        do
+        {
+            remaining += (packet[i] & 0x7F) * multiplier;
+            multiplier *= 128;
+        } while (packet[i++] & 0x80);
+        if ((packet[0] >> 4) != MQTT_PACKET_PUBLISH || (packet[0] & 0x06) != 0x02 || i + remaining != packet.size())
+        {
+            return false;
+        }
+        size_t topicLength = (packet[i] << 8) | packet[i + 1];
+        size_t idAt = i + 2 + topicLength;
+        uint16_t packetId = (packet[idAt] << 8) | packet[idAt + 1];
+        int message = atoi(std::string(packet.begin() + idAt + 2, packet.end()).c_str());
+        if (!delivered.insert(message).second)
+        {
+            duplicates++;
+        }
+        puback = {MQTT_PACKET_PUBACK << 4, 2, (uint8_t)(packetId >> 8), (uint8_t)(packetId & 0xFF)};
+        return true;
+    }
+};
+
+struct Result
+{
+    unsigned long time;
+    int delivered;
+    int duplicates;
+    Qos1Stats stats;
+};
+
+static Result run(uint8_t windowSize, unsigned long rtt, unsigned long dropAt)
+{
+    Link link;
+    link.latency = rtt / 2;
+    Broker broker;
+    Qos1Window window(windowSize);
+    MqttPacketScanner scanner;
+    std::vector<uint8_t> packet;
+    const std::string topic = "master/gateway/operations/assets/5mYkGhMlWbQyYSdpn3RbHM/attributes/temperature/update";
+
+    int next = 0;
+    bool connected = true;
+    unsigned long reconnectAt = 0;
+    unsigned long now = 0;
+    for (; now < 3600000; now++)
+    {
+        if (!connected && now >= reconnectAt)
+        {
+            connected = true;
+            scanner.reset();
+            window.retransmit(now, [&](const Qos1Message &message)
+                              {
+                mqttEncodePublish(packet, message.topic, message.payload, message.packetId, true);
+                link.up.push_back({now + link.latency, packet}); });
+        }
+        if (connected && dropAt > 0 && now == dropAt)
+        {
+            connected = false; // TLS drop: everything on the wire and in the socket buffer is gone
+            link.drop();
+            reconnectAt = now + RECONNECT_TIME;
+        }
+
+        // gateway publishes the backlog, as far as the window allows
+        for (int i = 0; connected && i < SEND_PER_MS && next < MESSAGES; i++)
+        {
+            Qos1Message *message = window.add(topic, std::to_string(next), now);
+            if (message == nullptr)
+            {
+                break;
+            }
+            mqttEncodePublish(packet, message->topic, message->payload, message->packetId, false);
+            link.up.push_back({now + link.latency, packet});
+            next++;
+        }
+
+        // broker
+        while (!link.up.empty() && link.up.front().arrival <= now)
+        {
+            std::vector<uint8_t> puback;
+            if (broker.receive(link.up.front().bytes, puback))
+            {
+                link.down.push_back({now + link.latency, puback});
+            }
+            link.up.pop_front();
+        }
+        while (!link.down.empty() && link.down.front().arrival <= now)
+        {
+            link.received.insert(link.received.end(), link.down.front().bytes.begin(), link.down.front().bytes.end());
+            link.down.pop_front();
+        }
+
+        // loop(): read the socket
+        if (connected && now % POLL_INTERVAL == 0)
+        {
+            for (uint8_t byte : link.received)
+            {
+                uint16_t packetId;
+                if (scanner.feed(byte, packetId))
+                {
+                    window.ack(packetId, now);
+                }
+            }
+            link.received.clear();
+        }
+
+        if (next == MESSAGES && window.inFlight() == 0)
+        {
+            break;
+        }
+    }
+    return {now, (int)broker.delivered.size(), broker.duplicates, window.stats};
+}
+
+int main()
+{
+    bool ok = true;
+    const unsigned long rtts[] = {20, 100, 300};
+    const uint8_t windows[] = {1, 4, 16, 32};
+    for (unsigned long rtt : rtts)
+    {
+        for (uint8_t windowSize : windows)
+        {
+            Result result = run(windowSize, rtt, 0);
+            ok &= result.delivered == MESSAGES;
+            printf("+ rtt %3lu ms, window %2d: %7.1f msg/s, avg publish->ack %5.0f ms\n", rtt, windowSize,
+                   MESSAGES * 1000.0 / result.time, (double)result.stats.rttTotal / result.stats.acked);
+        }
+    }
+
+    Result result = run(16, 100, 1234);
+    ok &= result.delivered == MESSAGES;
+    printf("%s connection drop, window 16: %d of %d delivered, %d retransmitted, %d duplicates, %d dropped\n",
+           result.delivered == MESSAGES ? "+" : "!", result.delivered, MESSAGES, result.stats.retransmitted,
+           result.duplicates, result.stats.dropped);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+// Allocation counter test for the static allocation mode (src/modules/system/block_pool.h)
+//
+//   g++ -O2 -std=gnu++11 -Isrc bench/static_pool_bench.cpp -o static_pool_bench && ./static_pool_bench
+//
+// Replaces operator new with the block pool, as GATEWAY_STATIC_ALLOCATION does on the device, and counts every
+// allocation the pool can't serve (a heap allocation). Then checks the counter itself catches an allocation larger
+// than the largest block.
+//
+// This is a MODEL of the datapath, not the datapath: DeviceMessage, SequenceTracker and AttributeShadow need
+// Arduino, FreeRTOS and ArduinoJson, which the host benches don't have. Only BlockPool, Qos1Window and
+// mqttEncodePublish are the real code. Message and DeviceState below are hand-written stand-ins of the same shape
+// (a message of four std::string fields passed by value, a per device map keyed by serial, a topic built per
+// reading), the JSON mapping and the shadow are not modelled. A full fleet is replayed through it: after a warm-up
+// the counter is armed and steady state must not allocate from the heap. A pass here says the pool layout fits
+// allocations of this shape; the real datapath is checked on the device by the steady state counter of
+// StaticMemory (checkStaticMemory, main.cpp). Pointers, std::string and map nodes are larger on a 64 bit host than
+// on the ESP32: the class peaks printed are an upper bound.
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <functional>
+#include "modules/system/block_pool.h"
+#include "external/OpenRemotePubSubClient/mqtt_qos1.h"
+
+#define DEVICES 64 // GATEWAY_MAX_DEVICES
+#define WARMUP 2000
+#define MESSAGES 200000
+
+static BlockPool pool;
+static bool armed = false;
+static unsigned long heapAllocations = 0; // after arming
+
+void *operator new(size_t size)
+{
+    void *block = pool.allocate(size);
+    if (block == nullptr)
+    {
+        heapAllocations += armed ? 1 : 0;
+        block = malloc(size);
+    }
+    if (block == nullptr)
+    {
+        abort();
+    }
+    return block;
+}
+
+void operator delete(void *block) noexcept
+{
+    if (block != nullptr && !pool.release(block))
+    {
+        free(block);
+    }
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete[](void *block) noexcept { operator delete(block); }
+
+// stand-in for DeviceMessage: four strings, handlers take it by value
+struct Message
+{
+    std::string name, sn, type, data;
+    unsigned seq;
+};
+
+// stand-in for the per device tables (SequenceTracker window, asset lookup)
+struct DeviceState
+{
+    std::string assetId;
+    unsigned lastSeq = 0;
+    unsigned long lastSeen = 0;
+};
+
+static void handle(Message message, std::unordered_map<std::string, DeviceState> &devices, Qos1Window &window,
+                   std::vector<uint8_t> &packet, const std::function<void(const std::string &)> &onPublish, unsigned long now)
+{
+    auto it = devices.find(message.sn);
+    if (it == devices.end() || message.seq <= it->second.lastSeq)
+    {
+        return;
+    }
+    it->second.lastSeq = message.seq;
+    it->second.lastSeen = now;
+    std::string topic = "master/gateway/operations/assets/" + it->second.assetId + "/attributes/temperature/update";
+    Qos1Message *slot = window.add(topic, message.data, now);
+    if (slot != nullptr)
+    {
+        mqttEncodePublish(packet, slot->topic, slot->payload, slot->packetId, false);
+        onPublish(topic);
+        window.ack(slot->packetId, now); // PUBACK
+    }
+}
+
+int main()
+{
+    std::unordered_map<std::string, DeviceState> devices;
+    devices.reserve(DEVICES);
+    for (int i = 0; i < DEVICES; i++)
+    {
+        devices["AQ-" + std::to_string(100000 + i)].assetId = "5mYkGhMlWbQyYSdpn3R" + std::to_string(100 + i);
+    }
+    Qos1Window window(16);
+    std::vector<uint8_t> packet;
+    unsigned long published = 0;
+    std::function<void(const std::string &)> onPublish = [&published](const std::string &topic)
+    { published += topic.empty() ? 0 : 1; };
+    const std::string data = "{\"temperature\":21.5,\"humidity\":48.2,\"pressure\":1013.2,\"gas\":120334,\"altitude\":38.1}";
+
+    for (unsigned long i = 0; i < WARMUP + MESSAGES; i++)
+    {
+        armed = i >= WARMUP;
+        int device = i % DEVICES;
+        Message message{"Sensor " + std::to_string(device), "AQ-" + std::to_string(100000 + device), "AirQualitySensor",
+                        data.substr(0, 20 + i % (data.length() - 20)), (unsigned)(i / DEVICES + 1)};
+        handle(message, devices, window, packet, onPublish, i);
+    }
+    bool ok = heapAllocations == 0 && published == WARMUP + MESSAGES;
+    printf("%s steady state (model), %lu messages from %d devices: %lu heap allocations, %lu published\n", ok ? "+" : "!",
+           (unsigned long)MESSAGES, DEVICES, heapAllocations, published);
+    for (int c = 0; c < BLOCK_POOL_CLASSES; c++)
+    {
+        printf("  class %4u: %3u blocks, peak %3u, spilled %lu, exhausted %lu\n", BLOCK_POOL_LAYOUT[c].size,
+               BLOCK_POOL_LAYOUT[c].blocks, pool.stats[c].peak, (unsigned long)pool.stats[c].spilled,
+               (unsigned long)pool.stats[c].exhausted);
+    }
+
+    // the counter must see what the pool can't serve
+    std::string large(4096, 'x');
+    bool counted = heapAllocations == 1;
+    printf("%s oversize allocation counted: %lu\n", counted ? "+" : "!", heapAllocations);
+    return ok && counted ? 0 : 1;
+}
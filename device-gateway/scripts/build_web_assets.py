@@ -0,0 +1,117 @@
+# Builds the SPIFFS image contents (data/) from the web interface sources (web/)
+# - every asset is stored gzipped, the gateway serves it as is with a gzip content encoding header
+# - assets referenced from the html pages get a content hash in their name, so they can be cached as immutable
+# - a manifest (assets.json) lists the served url, stored file, content type and etag of every asset
+# - gateway configuration files (config/) are copied as is, they are read by the firmware and not served
+#
+# Runs automatically as a PlatformIO pre script, can also be run standalone: python scripts/build_web_assets.py
+
+import gzip
+import hashlib
+import json
+import os
+import re
+import shutil
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO
+    PROJECT_DIR = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+SOURCE_DIR = os.path.join(PROJECT_DIR, "web")
+CONFIG_DIR = os.path.join(PROJECT_DIR, "config")
+OUTPUT_DIR = os.path.join(PROJECT_DIR, "data")
+MANIFEST = "assets.json"
+
+CONTENT_TYPES = {
+    ".html": "text/html",
+    ".css": "text/css",
+    ".js": "application/javascript",
+    ".ico": "image/x-icon",
+    ".png": "image/png",
+    ".svg": "image/svg+xml",
+    ".json": "application/json",
+}
+
+# pages are requested by a fixed url, everything else can be fingerprinted
+PAGE_EXTENSIONS = (".html",)
+# fetched by the browser on its own, the name can't change
+FIXED_NAMES = ("favicon.ico",)
+
+
+def content_hash(data):
+    return hashlib.sha256(data).hexdigest()
+
+
+def fingerprinted_name(name, data):
+    base, ext = os.path.splitext(name)
+    return "%s.%s%s" % (base, content_hash(data)[:8], ext)
+
+
+def rewrite_references(html, renames):
+    for original, renamed in renames.items():
+        pattern = r'((?:href|src)=")/?%s(")' % re.escape(original)
+        html = re.sub(pattern, r"\g<1>/%s\g<2>" % renamed, html)
+    return html
+
+
+def build():
+    if not os.path.isdir(SOURCE_DIR):
+        print("! Web asset sources not found: %s" % SOURCE_DIR)
+        return
+
+    sources = {}
+    for name in sorted(os.listdir(SOURCE_DIR)):
+        path = os.path.join(SOURCE_DIR, name)
+        if os.path.isfile(path):
+            with open(path, "rb") as f:
+                sources[name] = f.read()
+
+    # fingerprint the referenced assets first, pages are rewritten to point at the new names
+    renames = {}
+    for name, data in sources.items():
+        if not name.endswith(PAGE_EXTENSIONS) and name not in FIXED_NAMES:
+            renames[name] = fingerprinted_name(name, data)
+
+    for name in sources:
+        if name.endswith(PAGE_EXTENSIONS):
+            sources[name] = rewrite_references(sources[name].decode("utf-8"), renames).encode("utf-8")
+
+    if os.path.isdir(OUTPUT_DIR):
+        shutil.rmtree(OUTPUT_DIR)
+    os.makedirs(OUTPUT_DIR)
+
+    manifest = []
+    for name, data in sources.items():
+        served = renames.get(name, name)
+        stored = served + ".gz"
+        # mtime=0 keeps the output reproducible, unchanged sources produce an identical image
+        with open(os.path.join(OUTPUT_DIR, stored), "wb") as f:
+            f.write(gzip.compress(data, compresslevel=9, mtime=0))
+
+        manifest.append({
+            "url": "/" + served,
+            "file": "/" + stored,
+            "type": CONTENT_TYPES.get(os.path.splitext(name)[1], "application/octet-stream"),
+            "etag": '"%s"' % content_hash(data)[:16],
+            "immutable": name in renames,
+        })
+
+    with open(os.path.join(OUTPUT_DIR, MANIFEST), "w") as f:
+        json.dump({"assets": manifest}, f, separators=(",", ":"))
+
+    configs = 0
+    if os.path.isdir(CONFIG_DIR):
+        for name in sorted(os.listdir(CONFIG_DIR)):
+            path = os.path.join(CONFIG_DIR, name)
+            if os.path.isfile(path):
+                shutil.copyfile(path, os.path.join(OUTPUT_DIR, name))
+                configs += 1
+
+    raw = sum(len(d) for d in sources.values())
+    packed = sum(os.path.getsize(os.path.join(OUTPUT_DIR, a["file"][1:])) for a in manifest)
+    print("+ Web assets built: %d files, %d bytes -> %d bytes gzipped, %d config files" % (len(manifest), raw, packed, configs))
+
+
+build()
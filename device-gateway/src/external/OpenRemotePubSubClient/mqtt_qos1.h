@@ -0,0 +1,285 @@
+#ifndef MQTT_QOS1_H
+#define MQTT_QOS1_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// MQTT 3.1.1 QoS 1 publishing, without Arduino dependencies (see MqttTransport, bench/qos1_bench.cpp)
+
+#define MQTT_QOS1_MAX_WINDOW 32   // upper bound of the in-flight window
+#define MQTT_QOS1_MAX_ATTEMPTS 5  // sends of a message (first + retransmissions) before it is dropped
+#define MQTT_QOS1_FIRST_ID 0x8000 // packet ids 0x8000 - 0xFFFF, PubSubClient counts its (un)subscribe ids up from 1
+
+#define MQTT_PACKET_PUBLISH 3
+#define MQTT_PACKET_PUBACK 4
+
+/// @brief Unacknowledged QoS 1 message, kept until its PUBACK
+struct Qos1Message
+{
+    uint16_t packetId = 0;
+    bool acked = false;
+    uint8_t attempts = 0;
+    unsigned long sent = 0; // ms, last send
+    uint32_t tag = 0;       // caller's reference, handed back with the ack (e.g. a trace id)
+    std::string topic;
+    std::string payload;
+};
+
+/// @brief Counters of the QoS 1 window
+struct Qos1Stats
+{
+    uint32_t published = 0;
+    uint32_t acked = 0;
+    uint32_t retransmitted = 0;
+    uint32_t dropped = 0;    // unacknowledged after MQTT_QOS1_MAX_ATTEMPTS sends
+    uint32_t windowFull = 0; // publishes refused, every slot in flight
+    uint32_t rttMax = 0;     // ms, publish to PUBACK
+    uint64_t rttTotal = 0;   // ms, of the acked messages
+};
+
+/// @brief Encode a QoS 1 PUBLISH packet
+/// @param out Replaced with the packet
+/// @param topic
+/// @param payload
+/// @param packetId
+/// @param dup Retransmission
+inline void mqttEncodePublish(std::vector<uint8_t> &out, const std::string &topic, const std::string &payload, uint16_t packetId, bool dup)
+{
+    size_t remaining = 2 + topic.length() + 2 + payload.length();
+    out.clear();
+    out.reserve(remaining + 5);
+    out.push_back((MQTT_PACKET_PUBLISH << 4) | (dup ? 0x08 : 0) | 0x02); // QoS 1
+    do
+    {
+        uint8_t digit = remaining % 128;
+        remaining /= 128;
+        out.push_back(remaining > 0 ? digit | 0x80 : digit);
+    } while (remaining > 0);
+    out.push_back(topic.length() >> 8);
+    out.push_back(topic.length() & 0xFF);
+    out.insert(out.end(), topic.begin(), topic.end());
+    out.push_back(packetId >> 8);
+    out.push_back(packetId & 0xFF);
+    out.insert(out.end(), payload.begin(), payload.end());
+}
+
+/// @brief Follows the packet framing of the inbound byte stream, reports PUBACKs
+/// Fed with every byte the MQTT client reads, so PUBACKs are seen without a second reader on the socket.
+class MqttPacketScanner
+{
+public:
+    /// @brief Start of a new connection
+    void reset()
+    {
+        state = SCAN_HEADER;
+    }
+
+    /// @brief Feed the next inbound byte
+    /// @param byte
+    /// @param pubackId Set when a PUBACK is complete
+    /// @return bool (true if a PUBACK is complete)
+    bool feed(uint8_t byte, uint16_t &pubackId)
+    {
+        switch (state)
+        {
+        case SCAN_HEADER:
+            type = byte >> 4;
+            remaining = 0;
+            multiplier = 1;
+            position = 0;
+            state = SCAN_LENGTH;
+            return false;
+        case SCAN_LENGTH:
+            remaining += (byte & 0x7F) * multiplier;
+            multiplier *= 128;
+            if ((byte & 0x80) == 0)
+            {
+                state = remaining > 0 ? SCAN_BODY : SCAN_HEADER;
+            }
+            return false;
+        default: // SCAN_BODY
+            if (type == MQTT_PACKET_PUBACK && position < 2)
+            {
+                packetId = position == 0 ? byte << 8 : packetId | byte;
+            }
+            position++;
+            if (position < remaining)
+            {
+                return false;
+            }
+            state = SCAN_HEADER;
+            if (type == MQTT_PACKET_PUBACK && remaining >= 2)
+            {
+                pubackId = packetId;
+                return true;
+            }
+            return false;
+        }
+    }
+
+private:
+    enum ScanState : uint8_t
+    {
+        SCAN_HEADER,
+        SCAN_LENGTH,
+        SCAN_BODY
+    };
+
+    ScanState state = SCAN_HEADER;
+    uint8_t type = 0;
+    uint32_t remaining = 0;
+    uint32_t multiplier = 1;
+    uint32_t position = 0;
+    uint16_t packetId = 0;
+};
+
+/// @brief In-flight window of QoS 1 messages
+/// Up to `size` messages are sent without waiting for their PUBACKs, so throughput is not one message per
+/// round trip. Messages are kept in send order (a ring) until acknowledged. After a reconnect the
+/// unacknowledged ones are sent again (DUP), oldest first. At least once: a message whose PUBACK was lost
+/// with the connection arrives twice.
+class Qos1Window
+{
+public:
+    /// @brief Constructor
+    /// @param size Messages in flight at once, at most MQTT_QOS1_MAX_WINDOW
+    Qos1Window(uint8_t size) : size(size < 1 ? 1 : (size > MQTT_QOS1_MAX_WINDOW ? MQTT_QOS1_MAX_WINDOW : size)) {}
+
+    /// @brief Take a slot for a new message, send it with the returned packet id
+    /// @param topic
+    /// @param payload
+    /// @param now ms
+    /// @return Qos1Message* (nullptr if every slot is in flight)
+    Qos1Message *add(const std::string &topic, const std::string &payload, unsigned long now)
+    {
+        if (count >= size)
+        {
+            stats.windowFull++;
+            return nullptr;
+        }
+        Qos1Message &message = slots[(head + count) % size];
+        message.packetId = nextPacketId();
+        message.acked = false;
+        message.attempts = 1;
+        message.sent = now;
+        message.tag = 0;
+        message.topic = topic;
+        message.payload = payload;
+        count++;
+        stats.published++;
+        return &message;
+    }
+
+    /// @brief Acknowledge a message (PUBACK), frees its slot and every acknowledged one before it
+    /// @param packetId
+    /// @param now ms
+    /// @param tag Set to the tag of the message (optional)
+    /// @return bool (false if the packet id is not in flight, e.g. a duplicate PUBACK)
+    bool ack(uint16_t packetId, unsigned long now, uint32_t *tag = nullptr)
+    {
+        for (uint8_t i = 0; i < count; i++)
+        {
+            Qos1Message &message = slots[(head + i) % size];
+            if (message.packetId == packetId && !message.acked)
+            {
+                message.acked = true;
+                if (tag != nullptr)
+                {
+                    *tag = message.tag;
+                }
+                uint32_t rtt = now - message.sent;
+                stats.acked++;
+                stats.rttTotal += rtt;
+                stats.rttMax = rtt > stats.rttMax ? rtt : stats.rttMax;
+                advance();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// @brief Send the unacknowledged messages again, oldest first, after a reconnect
+    /// Messages that were sent MQTT_QOS1_MAX_ATTEMPTS times are dropped instead.
+    /// @param now ms
+    /// @param send Called with every message to send again (as DUP)
+    /// @return int number of messages sent again
+    template <typename Send>
+    int retransmit(unsigned long now, Send send)
+    {
+        return retransmit(now, send, [](const Qos1Message &) {});
+    }
+
+    /// @brief Send the unacknowledged messages again, see above
+    /// @param now ms
+    /// @param send Called with every message to send again (as DUP)
+    /// @param drop Called with every message that is given up, before its slot is freed
+    /// @return int number of messages sent again
+    template <typename Send, typename Drop>
+    int retransmit(unsigned long now, Send send, Drop drop)
+    {
+        int resent = 0;
+        for (uint8_t i = 0; i < count; i++)
+        {
+            Qos1Message &message = slots[(head + i) % size];
+            if (message.acked)
+            {
+                continue;
+            }
+            if (message.attempts >= MQTT_QOS1_MAX_ATTEMPTS)
+            {
+                message.acked = true; // gives up the slot
+                stats.dropped++;
+                drop(message);
+                continue;
+            }
+            message.attempts++;
+            message.sent = now;
+            send(message);
+            stats.retransmitted++;
+            resent++;
+        }
+        advance();
+        return resent;
+    }
+
+    /// @brief Messages waiting for their PUBACK (or for slots before them to be acknowledged)
+    uint8_t inFlight() const
+    {
+        return count;
+    }
+
+    uint8_t getSize() const
+    {
+        return size;
+    }
+
+    Qos1Stats stats;
+
+private:
+    uint8_t size;
+    Qos1Message slots[MQTT_QOS1_MAX_WINDOW];
+    uint8_t head = 0;
+    uint8_t count = 0;
+    uint16_t lastPacketId = 0xFFFF;
+
+    void advance()
+    {
+        while (count > 0 && slots[head].acked)
+        {
+            slots[head].topic.clear();
+            slots[head].payload.clear();
+            head = (head + 1) % size;
+            count--;
+        }
+    }
+
+    uint16_t nextPacketId()
+    {
+        // the range holds 32768 ids, the window at most MQTT_QOS1_MAX_WINDOW: an id is never reused while in flight
+        lastPacketId = lastPacketId == 0xFFFF ? MQTT_QOS1_FIRST_ID : lastPacketId + 1;
+        return lastPacketId;
+    }
+};
+
+#endif // MQTT_QOS1_H
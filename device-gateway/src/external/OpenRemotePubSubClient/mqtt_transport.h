@@ -0,0 +1,185 @@
+#ifndef MQTT_TRANSPORT_H
+#define MQTT_TRANSPORT_H
+
+#include <Arduino.h>
+#include <Client.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include "mqtt_qos1.h"
+#include "../../modules/system/scoped_lock.h"
+
+#define MQTT_QOS1_WINDOW 16 // default in-flight window
+
+/// @brief Network client between PubSubClient and the socket (e.g. WiFiClientSecure), adds QoS 1 publishing
+/// PubSubClient only publishes QoS 0 and drops PUBACKs: the transport writes QoS 1 PUBLISH packets itself and
+/// follows the bytes PubSubClient reads to pick up their PUBACKs. Everything else is passed through.
+/// Unacknowledged messages are kept in a Qos1Window, retransmit() sends them again after a reconnect.
+/// publish() / retransmit() write to the socket: like every other publish they need the mqtt client (OutboundScheduler).
+class MqttTransport : public Client
+{
+public:
+    typedef std::function<void(uint32_t tag)> AckHandler;
+    typedef std::function<void(const std::string &topic, const std::string &payload)> DropHandler;
+
+    /// @brief Constructor
+    /// @param inner The socket, e.g. WiFiClientSecure
+    /// @param window Messages in flight at once
+    MqttTransport(Client &inner, uint8_t window = MQTT_QOS1_WINDOW) : inner(inner), window(window) {}
+
+    /// @brief Initialize the transport, must be called before use
+    void init()
+    {
+        semaphore = xSemaphoreCreateMutex();
+    }
+
+    /// @brief Publish with QoS 1
+    /// @param topic
+    /// @param payload
+    /// @return bool (false if the window is full, the message is not sent)
+    bool publish(const char *topic, const std::string &payload)
+    {
+        ScopedLock lock(semaphore);
+        Qos1Message *message = window.add(topic, payload, millis());
+        if (message == nullptr)
+        {
+            return false;
+        }
+        message->tag = tag;
+        send(*message, false); // a failed write is retransmitted after the reconnect
+        return true;
+    }
+
+    /// @brief Tag the next publishes, handed to the ack handler with their PUBACK (0: untagged)
+    /// Set and cleared by the holder of the mqtt client, around its publishes.
+    /// @param value
+    void setTag(uint32_t value)
+    {
+        tag = value;
+    }
+
+    /// @brief Called for every acknowledged message with a tag, on the task that reads the socket
+    /// @param handler
+    void onAck(AckHandler handler)
+    {
+        ackHandler = handler;
+    }
+
+    /// @brief Called for every message given up after MQTT_QOS1_MAX_ATTEMPTS sends, from retransmit()
+    /// @param handler
+    void onDrop(DropHandler handler)
+    {
+        dropHandler = handler;
+    }
+
+    /// @brief Send the unacknowledged messages again, after a reconnect
+    /// @return int number of messages sent again
+    int retransmit()
+    {
+        std::vector<std::pair<std::string, std::string>> dropped; // handed over once the window is unlocked
+        int resent;
+        {
+            ScopedLock lock(semaphore);
+            resent = window.retransmit(millis(), [this](const Qos1Message &message)
+                                       { send(message, true); },
+                                       [this, &dropped](const Qos1Message &message)
+                                       {
+                                           if (dropHandler)
+                                           {
+                                               dropped.push_back(std::make_pair(message.topic, message.payload));
+                                           }
+                                       });
+        }
+        for (const auto &message : dropped)
+        {
+            dropHandler(message.first, message.second);
+        }
+        return resent;
+    }
+
+    /// @brief Counters of the window
+    /// @param inFlight Messages waiting for their PUBACK
+    /// @param size Window size
+    /// @return Qos1Stats
+    Qos1Stats getStats(uint8_t &inFlight, uint8_t &size)
+    {
+        ScopedLock lock(semaphore);
+        inFlight = window.inFlight();
+        size = window.getSize();
+        return window.stats;
+    }
+
+    // Client, passed through to the socket
+    int connect(IPAddress ip, uint16_t port) override
+    {
+        scanner.reset();
+        return inner.connect(ip, port);
+    }
+    int connect(const char *host, uint16_t port) override
+    {
+        scanner.reset();
+        return inner.connect(host, port);
+    }
+    size_t write(uint8_t byte) override { return inner.write(byte); }
+    size_t write(const uint8_t *buffer, size_t size) override { return inner.write(buffer, size); }
+    int available() override { return inner.available(); }
+    int read() override
+    {
+        int byte = inner.read();
+        if (byte >= 0)
+        {
+            scan((uint8_t)byte);
+        }
+        return byte;
+    }
+    int read(uint8_t *buffer, size_t size) override
+    {
+        int length = inner.read(buffer, size);
+        for (int i = 0; i < length; i++)
+        {
+            scan(buffer[i]);
+        }
+        return length;
+    }
+    int peek() override { return inner.peek(); }
+    void flush() override { inner.flush(); }
+    void stop() override { inner.stop(); }
+    uint8_t connected() override { return inner.connected(); }
+    operator bool() override { return (bool)inner; }
+
+private:
+    Client &inner;
+    Qos1Window window;
+    MqttPacketScanner scanner; // only fed by the task reading the socket (PubSubClient::loop)
+    std::vector<uint8_t> packet;
+    SemaphoreHandle_t semaphore = NULL;
+    uint32_t tag = 0;
+    AckHandler ackHandler;
+    DropHandler dropHandler;
+
+    void send(const Qos1Message &message, bool dup)
+    {
+        mqttEncodePublish(packet, message.topic, message.payload, message.packetId, dup);
+        inner.write(packet.data(), packet.size()); // one write, one TLS record
+    }
+
+    void scan(uint8_t byte)
+    {
+        uint16_t packetId;
+        if (!scanner.feed(byte, packetId))
+        {
+            return;
+        }
+        uint32_t acked = 0;
+        {
+            ScopedLock lock(semaphore);
+            window.ack(packetId, millis(), &acked);
+        }
+        if (acked != 0 && ackHandler)
+        {
+            ackHandler(acked);
+        }
+    }
+};
+
+#endif // MQTT_TRANSPORT_H
@@ -2,6 +2,9 @@
 #define OPENREMOTE_PUBSUB_H
 
 #include <PubSubClient.h>
+#include "openremote_responses.h"
+#include "topic_router.h"
+#include "mqtt_transport.h"
 
 // This class simplifies the interaction with the OpenRemote MQTT API
 // functions:
@@ -14,18 +17,25 @@
 // - getAttributeValue (missing)
 // - acknowledgeGatewayEvent
 // - subscribeToPendingGatewayEvents
-// NOTE: Missing methods for subscribing to the various filter posibilities e.g. specific attribute events of an asset
+// - subscribeToResponses, handleResponse (request / response correlation)
+// - subscribeToAttributeEvents, unsubscribe
+// - route, dispatch (inbound messages are routed to handlers by topic filter)
+// Attribute updates are published with QoS 1 when a MqttTransport is given, everything else with QoS 0
 
 class OpenRemotePubSub
 {
 public:
     PubSubClient &client;
     std::string clientId;
+    PendingResponses responses; // requests waiting for their response, see request()
+    TopicRouter router;         // handlers of inbound messages by topic filter
+    MqttTransport *transport;   // QoS 1 publishing, nullptr: QoS 0 only
 
     /// @brief Constructor for OpenRemotePubSub, a class that simplifies the interaction with the OpenRemote MQTT API
     /// @param clientId Client ID for MQTT (must be unique per client, in case of gateway it must use the clientId from the gateway asset)
     /// @param _client Reference to a PubSubClient object
-    OpenRemotePubSub(std::string clientId, PubSubClient &_client) : clientId(clientId), client(_client)
+    /// @param transport The network client of _client, for QoS 1 attribute updates (optional)
+    OpenRemotePubSub(std::string clientId, PubSubClient &_client, MqttTransport *transport = nullptr) : clientId(clientId), client(_client), transport(transport)
     {
         if (client.getBufferSize() < 16384)
         {
@@ -33,14 +43,22 @@ public:
         }
     }
 
+    /// @brief Initialize the response table and the router, must be called before use
+    void init()
+    {
+        responses.init();
+        router.init();
+    }
+
     /// @brief Publish an event
     /// @param realm (realm of the asset)
     /// @param assetId (ID of the asset, 22 character string)
     /// @param eventName (name of the event)
     /// @param eventValue (value of the event)
-    /// @param subscribeToResponse (default is false)
+    /// @param onResponse Called with the response or on timeout (default: no response expected)
+    /// @param timeout ms
     /// @return bool (true if the message was published)
-    bool updateAttribute(std::string realm, std::string assetId, std::string attributeName, std::string attributeValue, bool subscribeToResponse = false)
+    bool updateAttribute(std::string realm, std::string assetId, std::string attributeName, std::string attributeValue, ResponseCallback onResponse = nullptr, unsigned long timeout = OPENREMOTE_RESPONSE_TIMEOUT)
     {
         if (!client.connected())
         {
@@ -49,27 +67,18 @@ public:
         char topic[256];
         snprintf(topic, sizeof(topic), "%s/%s/operations/assets/%s/attributes/%s/update", realm.c_str(), clientId.c_str(), assetId.c_str(), attributeName.c_str());
 
-        if (subscribeToResponse)
-        {
-            char responseTopic[256];
-            snprintf(responseTopic, sizeof(responseTopic), "%s/response", topic);
-            if (!client.subscribe(responseTopic))
-            {
-                return false;
-            }
-        }
-
         const char *payload = attributeValue.c_str();
-        return client.publish(topic, payload);
+        return request(topic, payload, onResponse, timeout, false, true);
     }
 
     /// @brief Update multiple attributes
     /// @param realm (realm of the asset)
     /// @param assetId (ID of the asset, 22 character string)
     /// @param attributeTemplate (JSON representation of the list of attributes)
-    /// @param subscribeToResponse (default is false)
+    /// @param onResponse Called with the response or on timeout (default: no response expected)
+    /// @param timeout ms
     /// @return bool (true if the message was published)
-    bool updateMultipleAttributes(std::string realm, std::string assetId, std::string attributeTemplate, bool subscribeToResponse = false)
+    bool updateMultipleAttributes(std::string realm, std::string assetId, std::string attributeTemplate, ResponseCallback onResponse = nullptr, unsigned long timeout = OPENREMOTE_RESPONSE_TIMEOUT)
     {
         if (!client.connected())
         {
@@ -78,27 +87,18 @@ public:
         char topic[256];
         snprintf(topic, sizeof(topic), "%s/%s/operations/assets/%s/attributes/update", realm.c_str(), clientId.c_str(), assetId.c_str());
 
-        if (subscribeToResponse)
-        {
-            char responseTopic[256];
-            snprintf(responseTopic, sizeof(responseTopic), "%s/response", topic);
-            if (!client.subscribe(responseTopic))
-            {
-                return false;
-            }
-        }
-
         const char *payload = attributeTemplate.c_str();
-        return client.publish(topic, payload);
+        return request(topic, payload, onResponse, timeout, false, true);
     }
 
     /// @brief Get an attribute
     /// @param realm (realm of the asset)
     /// @param assetId (ID of the asset, 22 character string)
     /// @param attributeName (name of the attribute)
-    /// @param subscribeToResponse (default is false)
+    /// @param onResponse Called with the response or on timeout (default: no response expected)
+    /// @param timeout ms
     /// @return bool (true if the message was published)
-    bool getAttribute(std::string realm, std::string assetId, std::string attributeName, bool subscribeToResponse = false)
+    bool getAttribute(std::string realm, std::string assetId, std::string attributeName, ResponseCallback onResponse = nullptr, unsigned long timeout = OPENREMOTE_RESPONSE_TIMEOUT)
     {
         if (!client.connected())
         {
@@ -107,25 +107,17 @@ public:
         char topic[256];
         snprintf(topic, sizeof(topic), "%s/%s/operations/assets/%s/attributes/%s/get", realm.c_str(), clientId.c_str(), assetId.c_str(), attributeName.c_str());
 
-        if (subscribeToResponse)
-        {
-            char responseTopic[256];
-            snprintf(responseTopic, sizeof(responseTopic), "%s/response", topic);
-            if (!client.subscribe(responseTopic))
-            {
-                return false;
-            }
-        }
-        return client.publish(topic, ""); // Requests don't require a payload
+        return request(topic, "", onResponse, timeout, false); // Requests don't require a payload
     }
 
     /// @brief Create an asset
     /// @param realm (realm of the asset)
     /// @param assetTemplate (JSON representation of the asset)
     /// @param responseIdentifier (can be any string, used to correlate the response with the request)
-    /// @param subscribeToResponse (default is false)
+    /// @param onResponse Called with the response or on timeout (default: no response expected)
+    /// @param timeout ms
     /// @return bool (true if the message was published)
-    bool createAsset(std::string realm, std::string assetTemplate, std::string responseIdentifier, bool subscribeToResponse = false)
+    bool createAsset(std::string realm, std::string assetTemplate, std::string responseIdentifier, ResponseCallback onResponse = nullptr, unsigned long timeout = OPENREMOTE_RESPONSE_TIMEOUT)
     {
         if (!client.connected())
         {
@@ -134,26 +126,17 @@ public:
         char topic[256];
         snprintf(topic, sizeof(topic), "%s/%s/operations/assets/%s/create", realm.c_str(), clientId.c_str(), responseIdentifier.c_str());
 
-        if (subscribeToResponse)
-        {
-            char responseTopic[256];
-            snprintf(responseTopic, sizeof(responseTopic), "%s/response", topic);
-            if (!client.subscribe(responseTopic))
-            {
-                return false;
-            }
-        }
-
         const char *payload = assetTemplate.c_str();
-        return client.publish(topic, payload);
+        return request(topic, payload, onResponse, timeout, true);
     }
 
     /// @brief delete an asset
     /// @param realm (realm of the asset)
     /// @param assetId (ID of the asset, 22 character string)
-    /// @param subscribeToResponse (default is false)
+    /// @param onResponse Called with the response or on timeout (default: no response expected)
+    /// @param timeout ms
     /// @return bool (true if the message was published)
-    bool deleteAsset(std::string realm, std::string assetId, bool subscribeToResponse = false)
+    bool deleteAsset(std::string realm, std::string assetId, ResponseCallback onResponse = nullptr, unsigned long timeout = OPENREMOTE_RESPONSE_TIMEOUT)
     {
         if (!client.connected())
         {
@@ -162,25 +145,16 @@ public:
         char topic[256];
         snprintf(topic, sizeof(topic), "%s/%s/operations/assets/%s/delete", realm.c_str(), clientId.c_str(), assetId.c_str());
 
-        if (subscribeToResponse)
-        {
-            char responseTopic[256];
-            snprintf(responseTopic, sizeof(responseTopic), "%s/response", topic);
-            if (!client.subscribe(responseTopic))
-            {
-                return false;
-            }
-        }
-
-        return client.publish(topic, "");
+        return request(topic, "", onResponse, timeout, true);
     }
 
     /// @brief Update an asset
     /// @param realm
     /// @param assetId (ID of the asset, 22 character string)
     /// @param assetTemplate (JSON representation of the asset)
-    /// @param subscribeToResponse (default is false)
-    bool updateAsset(std::string realm, std::string assetId, std::string assetTemplate, bool subscribeToResponse = false)
+    /// @param onResponse Called with the response or on timeout (default: no response expected)
+    /// @param timeout ms
+    bool updateAsset(std::string realm, std::string assetId, std::string assetTemplate, ResponseCallback onResponse = nullptr, unsigned long timeout = OPENREMOTE_RESPONSE_TIMEOUT)
     {
         if (!client.connected())
         {
@@ -189,18 +163,8 @@ public:
         char topic[256];
         snprintf(topic, sizeof(topic), "%s/%s/operations/assets/%s/update", realm.c_str(), clientId.c_str(), assetId.c_str());
 
-        if (subscribeToResponse)
-        {
-            char responseTopic[256];
-            snprintf(responseTopic, sizeof(responseTopic), "%s/response", topic);
-            if (!client.subscribe(responseTopic))
-            {
-                return false;
-            }
-        }
-
         const char *payload = assetTemplate.c_str();
-        return client.publish(topic, payload);
+        return request(topic, payload, onResponse, timeout, true);
     }
 
     /// @brief Acknowledge a gateway event (e.g. attribute change)
@@ -231,6 +195,138 @@ public:
         snprintf(topic, sizeof(topic), "%s/%s/gateway/events/pending", realm.c_str(), clientId.c_str());
         return client.subscribe(topic);
     }
+
+    /// @brief Subscribe to the responses of all asset operations (create, update, delete), once per connection
+    /// Requests then go out without a subscribe round trip each. Attribute operations are not covered, every
+    /// telemetry update would get a response: those subscribe per request when a response is expected.
+    /// @param realm (realm of the gateway)
+    /// @return bool (true if the subscription was successful)
+    bool subscribeToResponses(std::string realm)
+    {
+        if (!client.connected())
+        {
+            return false;
+        }
+        char topic[256];
+        snprintf(topic, sizeof(topic), "%s/%s/operations/assets/+/+/response", realm.c_str(), clientId.c_str());
+        return client.subscribe(topic);
+    }
+
+    /// @brief Subscribe to the attribute events of an asset, has to be repeated after a reconnect
+    /// @param realm (realm of the asset)
+    /// @param assetId (ID of the asset, 22 character string)
+    /// @param attributeName ("+" for every attribute)
+    /// @param handler Called with every event
+    /// @return bool (true if the subscription was successful)
+    bool subscribeToAttributeEvents(std::string realm, std::string assetId, std::string attributeName, TopicHandler handler)
+    {
+        std::string filter = topicOf(realm, "events/assets/" + assetId + "/attributes/" + attributeName);
+        if (!client.connected() || !router.add(filter, handler))
+        {
+            return false;
+        }
+        if (!client.subscribe(filter.c_str()))
+        {
+            router.remove(filter);
+            return false;
+        }
+        return true;
+    }
+
+    /// @brief Unsubscribe from a topic filter and drop its handler
+    /// @param filter
+    /// @return bool (true if the unsubscribe was sent)
+    bool unsubscribe(const std::string &filter)
+    {
+        router.remove(filter);
+        return client.connected() && client.unsubscribe(filter.c_str());
+    }
+
+    /// @brief Handle the messages of a topic filter, for subscriptions made elsewhere (they outlive reconnects)
+    /// @param filter
+    /// @param handler
+    /// @return bool (false if the filter is invalid)
+    bool route(const std::string &filter, TopicHandler handler)
+    {
+        return router.add(filter, handler);
+    }
+
+    /// @brief Pass an inbound message to the handlers of the matching topic filters, from the PubSubClient callback
+    /// @param topic
+    /// @param payload
+    /// @param length
+    /// @return bool (false if no handler took it)
+    bool dispatch(const char *topic, const byte *payload, unsigned int length)
+    {
+        return router.dispatch(topic, payload, length) > 0;
+    }
+
+    /// @brief Topic of this client: "<realm>/<clientId>/<path>"
+    /// @param realm
+    /// @param path
+    /// @return std::string
+    std::string topicOf(const std::string &realm, const std::string &path)
+    {
+        return realm + "/" + clientId + "/" + path;
+    }
+
+    /// @brief Pass an incoming message to the request waiting for it
+    /// @param topic
+    /// @param payload
+    /// @param length
+    /// @return bool (false if it is not a response, or no request is waiting for it)
+    bool handleResponse(const char *topic, const byte *payload, unsigned int length)
+    {
+        return responses.complete(topic, payload, length);
+    }
+
+private:
+    /// @brief Publish a request, tracked until its response or timeout when a callback is given
+    /// @param topic
+    /// @param payload
+    /// @param onResponse
+    /// @param timeout ms
+    /// @param subscribed Response topic covered by subscribeToResponses
+    /// @param reliable QoS 1, if there is a transport for it
+    /// @return bool (true if the message was published)
+    bool request(const char *topic, const char *payload, ResponseCallback onResponse, unsigned long timeout, bool subscribed, bool reliable = false)
+    {
+        if (!onResponse)
+        {
+            return publish(topic, payload, reliable);
+        }
+
+        int handle = responses.add(topic, onResponse, timeout); // before publishing, the response can be quick
+        if (handle < 0)
+        {
+            return false;
+        }
+        if (!subscribed)
+        {
+            char responseTopic[256];
+            snprintf(responseTopic, sizeof(responseTopic), "%s/response", topic);
+            if (!client.subscribe(responseTopic))
+            {
+                responses.cancel(handle);
+                return false;
+            }
+        }
+        if (!publish(topic, payload, reliable))
+        {
+            responses.cancel(handle);
+            return false;
+        }
+        return true;
+    }
+
+    bool publish(const char *topic, const char *payload, bool reliable)
+    {
+        if (reliable && transport != nullptr)
+        {
+            return transport->publish(topic, payload); // false if the in-flight window is full
+        }
+        return client.publish(topic, payload);
+    }
 };
 
 #endif // OPENREMOTE_PUBSUB_H
@@ -0,0 +1,171 @@
+#ifndef OPENREMOTE_RESPONSES_H
+#define OPENREMOTE_RESPONSES_H
+
+#include <Arduino.h>
+#include <string>
+#include <string.h>
+#include <functional>
+#include "../../modules/system/scoped_lock.h"
+
+#define OPENREMOTE_MAX_PENDING 16          // requests waiting for a response at once
+#define OPENREMOTE_RESPONSE_TIMEOUT 15000  // ms, default time to wait for a response
+
+enum ResponseStatus
+{
+    RESPONSE_RECEIVED,
+    RESPONSE_TIMEOUT // no response in time (lost, or the request never reached the broker)
+};
+
+/// @brief Completion of a request: status, response payload (nullptr on timeout) and its length
+typedef std::function<void(ResponseStatus status, const byte *payload, unsigned int length)> ResponseCallback;
+
+/// @brief Request / response correlation for the OpenRemote MQTT API
+/// A response is published on "<request topic>/response", the request topic (which holds the response
+/// identifier or asset id) is the correlation key. Requests to the same topic are completed oldest first.
+/// Fixed table of OPENREMOTE_MAX_PENDING entries, expired by expire(). Callbacks run outside the lock, on the
+/// task that handles incoming messages (responses) or calls expire() (timeouts).
+class PendingResponses
+{
+public:
+    uint32_t completed = 0;
+    uint32_t timedOut = 0;
+    uint32_t unmatched = 0; // responses without a pending request (late, or requests without a callback)
+    uint32_t rejected = 0;  // requests not tracked, table full
+
+    /// @brief Initialize the table, must be called before use
+    void init()
+    {
+        semaphore = xSemaphoreCreateMutex();
+    }
+
+    /// @brief Track a request, before it is published (the response may arrive before publish returns)
+    /// @param requestTopic
+    /// @param callback
+    /// @param timeout ms
+    /// @return int entry handle for cancel() (-1 if the table is full)
+    int add(const char *requestTopic, ResponseCallback callback, unsigned long timeout)
+    {
+        ScopedLock lock(semaphore);
+        for (int i = 0; i < OPENREMOTE_MAX_PENDING; i++)
+        {
+            Pending &entry = entries[i];
+            if (!entry.callback)
+            {
+                entry.topic = requestTopic;
+                entry.callback = callback;
+                entry.sent = millis();
+                entry.deadline = entry.sent + timeout;
+                return i;
+            }
+        }
+        rejected++;
+        return -1;
+    }
+
+    /// @brief Stop tracking a request, e.g. its publish failed (the callback is not called)
+    /// @param handle From add()
+    void cancel(int handle)
+    {
+        ScopedLock lock(semaphore);
+        if (handle >= 0 && handle < OPENREMOTE_MAX_PENDING)
+        {
+            entries[handle].callback = nullptr;
+        }
+    }
+
+    /// @brief Complete the oldest request of a response topic
+    /// @param responseTopic "<request topic>/response"
+    /// @param payload
+    /// @param length
+    /// @return bool (false if no request is waiting for it)
+    bool complete(const char *responseTopic, const byte *payload, unsigned int length)
+    {
+        size_t topicLength = strlen(responseTopic);
+        if (topicLength < 9 || strcmp(responseTopic + topicLength - 9, "/response") != 0)
+        {
+            return false;
+        }
+        topicLength -= 9;
+
+        ResponseCallback callback;
+        {
+            ScopedLock lock(semaphore);
+            Pending *oldest = nullptr;
+            for (int i = 0; i < OPENREMOTE_MAX_PENDING; i++)
+            {
+                Pending &entry = entries[i];
+                if (entry.callback && entry.topic.length() == topicLength && strncmp(entry.topic.c_str(), responseTopic, topicLength) == 0 &&
+                    (oldest == nullptr || (long)(entry.sent - oldest->sent) < 0))
+                {
+                    oldest = &entry;
+                }
+            }
+            if (oldest == nullptr)
+            {
+                unmatched++;
+                return false;
+            }
+            callback = oldest->callback;
+            oldest->callback = nullptr;
+            latencyMax = max(latencyMax, millis() - oldest->sent);
+            completed++;
+        }
+        callback(RESPONSE_RECEIVED, payload, length);
+        return true;
+    }
+
+    /// @brief Time out requests past their deadline, call regularly
+    /// @param now millis()
+    void expire(unsigned long now)
+    {
+        for (int i = 0; i < OPENREMOTE_MAX_PENDING; i++)
+        {
+            ResponseCallback callback;
+            {
+                ScopedLock lock(semaphore);
+                Pending &entry = entries[i];
+                if (!entry.callback || (long)(now - entry.deadline) < 0)
+                {
+                    continue;
+                }
+                callback = entry.callback;
+                entry.callback = nullptr;
+                timedOut++;
+            }
+            callback(RESPONSE_TIMEOUT, nullptr, 0);
+        }
+    }
+
+    /// @brief Number of requests waiting for a response
+    int pending()
+    {
+        ScopedLock lock(semaphore);
+        int count = 0;
+        for (int i = 0; i < OPENREMOTE_MAX_PENDING; i++)
+        {
+            count += entries[i].callback ? 1 : 0;
+        }
+        return count;
+    }
+
+    /// @brief Slowest response so far, ms
+    unsigned long getLatencyMax()
+    {
+        return latencyMax;
+    }
+
+private:
+    struct Pending
+    {
+        std::string topic;
+        ResponseCallback callback; // empty if the entry is free
+        unsigned long sent = 0;    // millis()
+        unsigned long deadline = 0;
+    };
+
+    SemaphoreHandle_t semaphore = NULL;
+    Pending entries[OPENREMOTE_MAX_PENDING];
+    unsigned long latencyMax = 0;
+};
+
+#endif // OPENREMOTE_RESPONSES_H
@@ -0,0 +1,261 @@
+#ifndef TOPIC_ROUTER_H
+#define TOPIC_ROUTER_H
+
+#include <Arduino.h>
+#include <string>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include "../../modules/system/scoped_lock.h"
+
+/// @brief Handler of the messages of a topic filter
+typedef std::function<void(const char *topic, const byte *payload, unsigned int length)> TopicHandler;
+
+/// @brief Routes inbound MQTT messages to the handlers of matching topic filters ("+" one level, "#" the rest)
+/// The filters are kept in a trie, one node per level: a message is matched level by level, a lookup per
+/// level (binary search among the literal children, plus the "+" and "#" branches) instead of a compare
+/// per registered filter. Adding per asset filters doesn't slow down the other messages.
+/// Handlers run on the task that calls dispatch(), under the router lock: they must not add or remove routes.
+class TopicRouter
+{
+public:
+    /// @brief Initialize the router, must be called before use
+    void init()
+    {
+        semaphore = xSemaphoreCreateMutex();
+        nodes.resize(1); // root
+    }
+
+    /// @brief Register the handler of a topic filter, replaces the handler of an identical filter
+    /// @param filter e.g. "master/client/events/assets/+/attributes/#"
+    /// @param handler
+    /// @return bool (false if the filter is invalid)
+    bool add(const std::string &filter, TopicHandler handler)
+    {
+        ScopedLock lock(semaphore);
+        int node = 0;
+        size_t start = 0;
+        while (true)
+        {
+            size_t end = filter.find('/', start);
+            std::string level = filter.substr(start, end == std::string::npos ? std::string::npos : end - start);
+            bool last = end == std::string::npos;
+
+            if (level == "#")
+            {
+                if (!last)
+                {
+                    return false; // "#" must be the last level
+                }
+                setHandler(nodes[node].hash, handler);
+                return true;
+            }
+            if (level.find_first_of("+#") != std::string::npos && level != "+")
+            {
+                return false; // wildcards take a whole level
+            }
+            node = level == "+" ? plusChild(node) : literalChild(node, level);
+            if (last)
+            {
+                setHandler(nodes[node].exact, handler);
+                return true;
+            }
+            start = end + 1;
+        }
+    }
+
+    /// @brief Remove the handler of a topic filter
+    /// @param filter Same as passed to add()
+    /// @return bool (false if there is no such route)
+    bool remove(const std::string &filter)
+    {
+        ScopedLock lock(semaphore);
+        int node = 0;
+        size_t start = 0;
+        while (node >= 0)
+        {
+            size_t end = filter.find('/', start);
+            std::string level = filter.substr(start, end == std::string::npos ? std::string::npos : end - start);
+            bool last = end == std::string::npos;
+            if (level == "#" && last)
+            {
+                return clearHandler(nodes[node].hash);
+            }
+            node = level == "+" ? nodes[node].plus : findLiteral(node, level.c_str(), level.length());
+            if (node >= 0 && last)
+            {
+                return clearHandler(nodes[node].exact);
+            }
+            start = end + 1;
+        }
+        return false;
+    }
+
+    /// @brief Call the handlers of every filter matching a topic
+    /// @param topic
+    /// @param payload
+    /// @param length
+    /// @return int number of handlers called (0: nothing subscribed to it)
+    int dispatch(const char *topic, const byte *payload, unsigned int length)
+    {
+        ScopedLock lock(semaphore);
+        int called = match(0, topic, topic, payload, length);
+        if (called == 0)
+        {
+            unrouted++;
+        }
+        return called;
+    }
+
+    /// @brief Number of registered filters
+    int size()
+    {
+        ScopedLock lock(semaphore);
+        int count = 0;
+        for (const TopicHandler &handler : handlers)
+        {
+            count += handler ? 1 : 0;
+        }
+        return count;
+    }
+
+    uint32_t unrouted = 0; // messages no filter matched
+
+private:
+    struct Child
+    {
+        std::string level;
+        int node;
+    };
+
+    struct Node
+    {
+        std::vector<Child> children; // literal levels, sorted
+        int plus = -1;               // child node of "+"
+        int exact = -1;              // handler of a filter ending at this level
+        int hash = -1;               // handler of "<this level>/#"
+    };
+
+    SemaphoreHandle_t semaphore = NULL;
+    std::vector<Node> nodes;
+    std::vector<TopicHandler> handlers; // indexed by Node::exact / Node::hash, cleared slots are reused
+
+    /// @brief Match the rest of a topic below a node
+    /// @param node
+    /// @param level Start of the current level, nullptr once every level is matched
+    int match(int node, const char *level, const char *topic, const byte *payload, unsigned int length)
+    {
+        const Node &current = nodes[node];
+        int called = 0;
+        if (current.hash >= 0)
+        {
+            handlers[current.hash](topic, payload, length); // "a/#" also matches "a"
+            called++;
+        }
+        if (level == nullptr)
+        {
+            if (current.exact >= 0)
+            {
+                handlers[current.exact](topic, payload, length);
+                called++;
+            }
+            return called;
+        }
+
+        const char *end = strchr(level, '/');
+        size_t levelLength = end != nullptr ? end - level : strlen(level);
+        const char *next = end != nullptr ? end + 1 : nullptr;
+
+        int literal = findLiteral(node, level, levelLength);
+        if (literal >= 0)
+        {
+            called += match(literal, next, topic, payload, length);
+        }
+        if (nodes[node].plus >= 0)
+        {
+            called += match(nodes[node].plus, next, topic, payload, length);
+        }
+        return called;
+    }
+
+    int findLiteral(int node, const char *level, size_t levelLength)
+    {
+        const std::vector<Child> &children = nodes[node].children;
+        auto it = std::lower_bound(children.begin(), children.end(), std::make_pair(level, levelLength),
+                                   [](const Child &child, const std::pair<const char *, size_t> &key)
+                                   { return compare(child.level, key.first, key.second) < 0; });
+        if (it != children.end() && compare(it->level, level, levelLength) == 0)
+        {
+            return it->node;
+        }
+        return -1;
+    }
+
+    static int compare(const std::string &a, const char *b, size_t bLength)
+    {
+        int result = strncmp(a.c_str(), b, min(a.length(), bLength));
+        if (result != 0)
+        {
+            return result;
+        }
+        return a.length() < bLength ? -1 : (a.length() > bLength ? 1 : 0);
+    }
+
+    int literalChild(int node, const std::string &level)
+    {
+        int child = findLiteral(node, level.c_str(), level.length());
+        if (child >= 0)
+        {
+            return child;
+        }
+        child = nodes.size();
+        nodes.emplace_back(); // may move nodes, no references are held across
+        std::vector<Child> &children = nodes[node].children;
+        auto it = std::lower_bound(children.begin(), children.end(), level, [](const Child &a, const std::string &b)
+                                   { return a.level < b; });
+        children.insert(it, Child{level, child});
+        return child;
+    }
+
+    int plusChild(int node)
+    {
+        if (nodes[node].plus < 0)
+        {
+            int child = nodes.size();
+            nodes.emplace_back();
+            nodes[node].plus = child;
+        }
+        return nodes[node].plus;
+    }
+
+    void setHandler(int &slot, TopicHandler handler)
+    {
+        if (slot < 0)
+        {
+            auto it = std::find_if(handlers.begin(), handlers.end(), [](const TopicHandler &h)
+                                   { return !h; });
+            if (it == handlers.end())
+            {
+                slot = handlers.size();
+                handlers.push_back(handler);
+                return;
+            }
+            slot = it - handlers.begin();
+        }
+        handlers[slot] = handler;
+    }
+
+    bool clearHandler(int &slot)
+    {
+        if (slot < 0)
+        {
+            return false;
+        }
+        handlers[slot] = nullptr;
+        slot = -1;
+        return true;
+    }
+};
+
+#endif // TOPIC_ROUTER_H
@@ -12,96 +12,270 @@
 #include "config/secrets.h"
 #include "external/OpenRemotePubSubClient/openremote_pubsub.h"
 #include "modules/messaging/device_message.h"
+#include "modules/messaging/sequence_tracker.h"
+#include "modules/messaging/downlink_mailbox.h"
+#include "modules/messaging/outbound_scheduler.h"
+#include "modules/messaging/ingress_limiter.h"
+#include "modules/messaging/message_trace.h"
 #include "modules/manager/asset_manager.h"
 #include "modules/manager/asset_templates.h"
-#include <map>
+#include "modules/manager/device_types.h"
+#include "modules/manager/attribute_transforms.h"
+#include "modules/manager/attribute_history.h"
+#include "modules/manager/attribute_shadow.h"
+#include "modules/manager/device_liveness.h"
+#include "modules/manager/onboarding_manager.h"
+#include "modules/web/static_assets.h"
+#include "modules/web/event_stream.h"
+#include "modules/web/request_body_pool.h"
+#include "modules/web/boot_profile.h"
+#include "modules/system/static_memory.h"
+#include <new>
 
 using namespace std;
 
 // Simple versioning - used for resetting preferences
 #define REVISION 5
 
+// Memory report (/system/memory)
+#define MEMORY_HEAP_RESERVE 49152 // heap kept free for TLS, MQTT and the web server, not available for devices
+#define MEMORY_MAP_NODE 44        // unordered_map node without the value: next, cached hash, std::string key (SSO), malloc header, bucket
+
+// Tasks and fleet
+#define MQTT_TASK_STACK 34816       // 34KB stack size, recommended with SSL
+#define UDP_TASK_STACK 12480        // 12KB stack size
+#define GATEWAY_MAX_DEVICES 64      // fleet limit of the static allocation mode, the per device state is reserved at boot
+#ifdef GATEWAY_STATIC_ALLOCATION
+#define GATEWAY_FLEET_SIZE GATEWAY_MAX_DEVICES
+#else
+#define GATEWAY_FLEET_SIZE 512 // devices the per device tables hold at once (sequence windows, ingress buckets, mailboxes), beyond it the least recent is evicted
+#endif
+#define STATIC_MEMORY_WARMUP 120000 // ms after power on (and a first mqtt connection) before steady state is assumed
+
 // Global Variables
-WiFiClientSecure wifiClient;                                 // WiFi client for secure connections
-PubSubClient mqttClient(wifiClient);                         // passed to openRemoteMqtt - which wraps PubSubClient
-OpenRemotePubSub openRemoteMqtt(mqtt_client_id, mqttClient); // OpenRemote PubSub client
+WiFiClientSecure wifiClient;                                                // WiFi client for secure connections
+MqttTransport mqttTransport(wifiClient);                                    // QoS 1 publishing on top of the WiFi client
+PubSubClient mqttClient(mqttTransport);                                     // passed to openRemoteMqtt - which wraps PubSubClient
+OpenRemotePubSub openRemoteMqtt(mqtt_client_id, mqttClient, &mqttTransport); // OpenRemote PubSub client, attribute updates with QoS 1
 Preferences preferences;                                     // Preferences for storing asset data (non-volatile memory)
 WiFiUDP udp;                                                 // UDP for local device communication
 AsyncWebServer server(80);                                   // Management interface
 AssetManager assetManager(preferences);                      // Asset manager
-
-// Semaphore
-SemaphoreHandle_t pubSubSemaphore; // Semaphore for accessing the mqtt client
+OnboardingManager onboardingManager;                         // Onboarding admission control (rate limits, retries, blocking)
+AttributeTransforms attributeTransforms;                     // Compiled per device type payload transforms
+AttributeHistory attributeHistory;                           // Compressed recent values per attribute, for the local UI
+AttributeShadow attributeShadow;                             // Last reported / published / desired value per attribute, diff-only publishing
+SequenceTracker sequenceTracker;                             // Duplicate suppression + loss / reorder stats per device
+DownlinkMailbox downlinkMailbox;                             // Commands + config for sleeping devices, sent after their next uplink
+StaticAssets staticAssets(SPIFFS);                           // Precompressed web interface files
+EventStream eventStream("/events");                          // Live updates for the management interface (SSE)
+
+// Access to the mqtt client, by traffic class (control before telemetry)
+OutboundScheduler outbound;
+
+// Memory of the datapath: a fixed block pool in the static allocation mode (build flag GATEWAY_STATIC_ALLOCATION),
+// task stacks are static there too. Datapath JSON documents take their memory from jsonAllocator.
+#ifdef GATEWAY_STATIC_ALLOCATION
+StaticMemory staticMemory;
+PoolJsonAllocator jsonAllocator(&staticMemory);
+StackType_t mqttTaskStack[MQTT_TASK_STACK];
+StaticTask_t mqttTaskBuffer;
+StackType_t udpTaskStack[UDP_TASK_STACK];
+StaticTask_t udpTaskBuffer;
+uint32_t lastSteadyHeapAllocations = 0;
+
+// every C++ allocation goes through the pool, the heap only when no block fits (counted, see StaticMemory)
+void *operator new(size_t size)
+{
+  void *block = staticMemory.allocate(size);
+  if (block == nullptr)
+  {
+    abort(); // heap exhausted as well
+  }
+  return block;
+}
+void *operator new[](size_t size) { return operator new(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return staticMemory.allocate(size); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return staticMemory.allocate(size); }
+void operator delete(void *block) noexcept { staticMemory.release(block); }
+void operator delete[](void *block) noexcept { staticMemory.release(block); }
+void operator delete(void *block, const std::nothrow_t &) noexcept { staticMemory.release(block); }
+void operator delete[](void *block, const std::nothrow_t &) noexcept { staticMemory.release(block); }
+#else
+PoolJsonAllocator jsonAllocator(nullptr); // heap
+#endif
+TaskHandle_t mqttTask = NULL;
+TaskHandle_t udpTask = NULL;
+
+// Per stage timestamps of the recent datagrams and pending events (/system/traces)
+MessageTracer messageTracer;
+uint32_t udpTrace = 0; // trace of the datagram the UDP task is handling
 
 // Function Prototypes
 void mqttConnectionHandler(void *pvParameters);
 void mqttCallbackHandler(char *topic, byte *payload, unsigned int length);
+void mqttHandleResponse(const char *topic, const byte *payload, unsigned int length);
+void mqttHandlePendingEvent(const char *topic, const byte *payload, unsigned int length);
+void mqttHandleAssetResponse(const byte *payload, unsigned int length);
+ResponseCallback mqttExpectResponse(const char *operation, std::string assetId);
 void udpHandler(void *pvParameters);
+void udpHandlePacket(const char *packet);
 void udpHandleDataMessage(DeviceMessage deviceMessage);
+void udpHandleBatchMessage(DeviceMessage deviceMessage);
+void udpRequestOnboarding(const std::string &deviceSerial);
+void udpMapAttributes(const DeviceType *deviceType, JsonDocument &payload, JsonDocument &attributes);
+void udpPublishAttributes(const std::string &assetId, JsonDocument &attributes);
+bool mqttPublishAttributes(const std::string &assetId, JsonDocument &attributes);
+void mqttPushShadowDiffs();
+void mqttHandleDroppedPublish(const std::string &topic, const std::string &payload);
 void udpHandleOnboardMessage(DeviceMessage deviceMessage);
 void udpHandleAliveMessage(DeviceMessage deviceMessage);
+void udpHandleConnectivityChange(const std::string &deviceSerial, bool online);
+void udpForgetDeletedDevices();
+void forgetDevice(const std::string &deviceSerial);
+void udpProcessOnboardingQueue();
 void startWebServer();
-
-// Global Variables
-unsigned int wifiConnectionAttempts = 0;
-unsigned int wifiConnectionAttemptsMax = 10;
+std::string systemStatusJson();
+bool fleetFull(int creating = 0);
+void checkStaticMemory();
+void publishAttributeEvent(std::string assetId, std::string deviceSerial, JsonDocument &attributes);
+void publishOnboardingEvent(std::string deviceSerial, const char *state);
+
+// Device liveness (last seen + offline timeouts), only used from the UDP task
+DeviceLiveness deviceLiveness(udpHandleConnectivityChange);
+
+// Serials of deleted assets, handed to the UDP task which drops their liveness entries
+#define DELETED_DEVICES_QUEUE 8
+QueueHandle_t deletedDevices = NULL;
+
+// Per device packet budgets, checked before a packet is parsed (the type is taken from the asset, batch messages carry none)
+IngressLimiter ingressLimiter([](const std::string &deviceSerial, uint8_t &typeId)
+                              {
+                                AssetSnapshot snapshot = assetManager.snapshot();
+                                const DeviceAsset *asset = snapshot.findBySerial(deviceSerial);
+                                typeId = asset != nullptr ? asset->typeId : DEVICE_TYPE_UNKNOWN;
+                                return asset != nullptr; });
+
+// Boot
+#define WIFI_CONNECT_TIMEOUT 10000 // ms, restart if the WiFi is not up by then
+BootProfile bootProfile;         // Boot phase timing and milestones (/system/boot)
 
 void setup()
 {
   Serial.begin(115200);
+  bootProfile.init();
+
+  // WiFi connection, associates in the background while the rest is initialized
+  bootProfile.step("wifi start");
+  int wifiSpan = bootProfile.begin("wifi association");
+  WiFi.begin(ssid, password);
 
   // Initialize SPIFFS (file system for web server)
+  bootProfile.step("file system");
   if (!SPIFFS.begin(true))
   {
     Serial.println("An Error has occurred while mounting SPIFFS");
     return;
   }
 
-  // WiFi connection
-  WiFi.begin(ssid, password);
-  while (WiFi.status() != WL_CONNECTED)
-  {
-    delay(1000);
-    Serial.print("Connecting to WiFi, ssid: ");
-    Serial.println(ssid);
-    wifiConnectionAttempts++;
+  // Compile the attribute transforms, types without a spec use the plain field mapping
+  bootProfile.step("config");
+  Serial.print("+ Attribute transforms loaded for device types: ");
+  Serial.println(attributeTransforms.load(SPIFFS));
 
-    if (wifiConnectionAttempts > wifiConnectionAttemptsMax)
-    {
-      Serial.println("! WiFi connection failed");
-      ESP.restart();
-    }
-  }
-  wifiConnectionAttempts = 0;
-  Serial.println("+ WiFi");
-
-  // local address
-  Serial.print("IP Address: ");
-  Serial.println(WiFi.localIP());
+  // Ingress budgets per device type, types without one use the default budget
+  ingressLimiter.init(GATEWAY_FLEET_SIZE);
+  Serial.print("+ Ingress budgets loaded for device types: ");
+  Serial.println(ingressLimiter.load(SPIFFS));
   wifiClient.setCACert(root_ca);
 
   // Preferences, used for storing asset data
+  bootProfile.step("assets");
   preferences.begin("asset-manager" + REVISION, false);
 
   // MQTT client
   openRemoteMqtt.client.setServer(mqtt_host, mqtt_port);
   openRemoteMqtt.client.setCallback(mqttCallbackHandler);
 
-  // semaphore for accessing the mqtt client
-  pubSubSemaphore = xSemaphoreCreateMutex();
-
-  // Asset manager, load assets from preferences
-  assetManager.init();
+  // scheduled access to the mqtt client, requests waiting for a response
+  outbound.init();
+  mqttTransport.init();
+  messageTracer.init();
+  mqttTransport.onAck([](uint32_t trace)
+                      { messageTracer.mark(trace, TRACE_ACKED); });
+  mqttTransport.onDrop(mqttHandleDroppedPublish);
+  openRemoteMqtt.init();
+
+  // Inbound messages by topic filter, the subscriptions are made on every connect
+  openRemoteMqtt.route(openRemoteMqtt.topicOf("master", "gateway/events/pending"), mqttHandlePendingEvent);
+  openRemoteMqtt.route(openRemoteMqtt.topicOf("master", "operations/assets/#"), mqttHandleResponse);
+
+  // Asset manager, loads the compact asset index (managerJson stays in flash until needed)
+  if (!assetManager.init())
+  {
+    Serial.println("! Asset index missing or outdated, rebuilt from the asset JSON");
+  }
+  onboardingManager.init();
+  sequenceTracker.init(GATEWAY_FLEET_SIZE);
+  downlinkMailbox.init(GATEWAY_FLEET_SIZE);
+  deletedDevices = xQueueCreate(DELETED_DEVICES_QUEUE, sizeof(InlineString<ASSET_SN_MAX_LENGTH>));
+  attributeHistory.init();
+  attributeShadow.init();
+#ifdef GATEWAY_STATIC_ALLOCATION
+  // fleet limit: the registry and the liveness entries of every device are allocated now, not as devices arrive
+  assetManager.reserve(GATEWAY_MAX_DEVICES);
+  deviceLiveness.reserve(GATEWAY_MAX_DEVICES);
+#endif
   Serial.println("+ Device manager initialized");
   Serial.print("Asset count: ");
-  Serial.println(assetManager.assets.size());
+  Serial.println(assetManager.size());
 
   // Web server, simple management interface
+  bootProfile.step("web server");
+  eventStream.init();
   startWebServer();
 
-  // FreeRTOS tasks
-  xTaskCreate(mqttConnectionHandler, "MQTT Connection Task", 34816, NULL, 1, NULL); // 34KB stack size, recommended with SSL
-  xTaskCreate(udpHandler, "UDP Handler Task", 12480, NULL, 1, NULL);                // 12KB stack size
+  // FreeRTOS tasks, both wait for the WiFi themselves (the mqtt task connects as soon as it is up)
+  bootProfile.step("tasks");
+#ifdef GATEWAY_STATIC_ALLOCATION
+  mqttTask = xTaskCreateStatic(mqttConnectionHandler, "MQTT Connection Task", MQTT_TASK_STACK, NULL, 1, mqttTaskStack, &mqttTaskBuffer);
+  udpTask = xTaskCreateStatic(udpHandler, "UDP Handler Task", UDP_TASK_STACK, NULL, 1, udpTaskStack, &udpTaskBuffer);
+  staticMemory.watch("udp", udpTask);
+  staticMemory.watch("mqtt", mqttTask);
+  staticMemory.watch("loop", xTaskGetCurrentTaskHandle()); // setup() runs on the loop task: mqtt callbacks, status
+  Serial.print("+ Static memory: pool ");
+  Serial.print(BLOCK_POOL_BYTES);
+  Serial.print(" bytes, task stacks ");
+  Serial.print(MQTT_TASK_STACK + UDP_TASK_STACK);
+  Serial.print(" bytes, max devices ");
+  Serial.println(GATEWAY_MAX_DEVICES);
+#else
+  xTaskCreate(mqttConnectionHandler, "MQTT Connection Task", MQTT_TASK_STACK, NULL, 1, &mqttTask);
+  xTaskCreate(udpHandler, "UDP Handler Task", UDP_TASK_STACK, NULL, 1, &udpTask);
+#endif
+
+  // Whatever is left of the WiFi association
+  bootProfile.step("wifi wait");
+  while (WiFi.status() != WL_CONNECTED)
+  {
+    if (millis() > WIFI_CONNECT_TIMEOUT)
+    {
+      Serial.println("! WiFi connection failed");
+      ESP.restart();
+    }
+    delay(100);
+  }
+  bootProfile.end(wifiSpan);
+  bootProfile.milestone("wifi");
+  bootProfile.step(nullptr);
+  Serial.println("+ WiFi");
+
+  // local address
+  Serial.print("IP Address: ");
+  Serial.println(WiFi.localIP());
+  Serial.print("+ Boot done in ");
+  Serial.print(millis());
+  Serial.println(" ms");
 }
 
 unsigned long lastReconnectAttempt = 0;
@@ -119,19 +293,67 @@ void loop()
     lastReconnectAttempt = millis();
   }
 
+  // Push system metrics to the management interface
+  if ((millis() - lastSystemStatusUpdate) > lastSystemStatusUpdateInterval)
+  {
+    lastSystemStatusUpdate = millis();
+    if (eventStream.hasSubscribers())
+    {
+      eventStream.publish(STREAM_EVENT_STATUS, systemStatusJson());
+    }
+  }
+
   openRemoteMqtt.client.loop();
+  openRemoteMqtt.responses.expire(millis()); // requests without a response in time
+  checkStaticMemory();
   delay(100);
 }
 
+// Static allocation mode: steady state starts once booted, connected and warmed up, from then on the datapath
+// tasks must not allocate from the heap. Every allocation that does is reported (a pool class too small).
+void checkStaticMemory()
+{
+#ifdef GATEWAY_STATIC_ALLOCATION
+  if (!staticMemory.isArmed())
+  {
+    if (bootProfile.reached("mqtt") && millis() > STATIC_MEMORY_WARMUP)
+    {
+      staticMemory.arm();
+      Serial.println("+ Static memory: steady state, heap allocations of the datapath are counted");
+    }
+    return;
+  }
+  uint32_t steadyHeapAllocations = staticMemory.getSteadyHeapAllocations();
+  if (steadyHeapAllocations == lastSteadyHeapAllocations)
+  {
+    return;
+  }
+  lastSteadyHeapAllocations = steadyHeapAllocations;
+  WatchedTask task;
+  for (int i = 0; staticMemory.getWatched(i, task); i++)
+  {
+    if (task.heapAllocations > 0)
+    {
+      Serial.print("! Heap allocation in steady state - task: ");
+      Serial.print(task.name);
+      Serial.print(", count: ");
+      Serial.print(task.heapAllocations);
+      Serial.print(", last size: ");
+      Serial.println(task.lastSize);
+    }
+  }
+#endif
+}
+
 // MQTT Task
 void mqttConnectionHandler(void *pvParameters)
 {
   while (true)
   {
-    // Ensure we have the semaphore
-    if (xSemaphoreTake(pubSubSemaphore, portMAX_DELAY) == pdTRUE)
+    bool connected = false;
+    // Reconnect to MQTT if disconnected
+    if (outbound.acquire(TRAFFIC_RESYNC))
     {
-      // Reconnect to MQTT if disconnected
       if (!openRemoteMqtt.client.connected() && WiFi.status() == WL_CONNECTED)
       {
         Serial.print("Connecting to MQTT, host: ");
@@ -142,19 +364,23 @@ void mqttConnectionHandler(void *pvParameters)
         if (openRemoteMqtt.client.connect(mqtt_client_id, mqtt_user, mqtt_pas))
         {
           Serial.println("+ MQTT connected");
+          bootProfile.milestone("mqtt");
+          connected = true;
           if (openRemoteMqtt.subscribeToPendingGatewayEvents("master"))
           {
             Serial.println("+ Subscribed to pending gateway events");
           }
+          if (openRemoteMqtt.subscribeToResponses("master"))
+          {
+            Serial.println("+ Subscribed to asset operation responses");
+          }
 
-          for (int i = 0; i < assetManager.assets.size(); i++)
+          // attribute updates that were in flight when the connection dropped
+          int resent = mqttTransport.retransmit();
+          if (resent > 0)
           {
-            DeviceAsset asset = assetManager.assets[i];
-            if (openRemoteMqtt.createAsset("master", asset.managerJson, asset.sn.c_str(), false))
-            {
-              Serial.print("+ Sent asset data to OpenRemote, sn: ");
-              Serial.println(asset.sn.c_str());
-            }
+            Serial.print("+ Unacknowledged attribute updates sent again: ");
+            Serial.println(resent);
           }
         }
         else
@@ -162,12 +388,38 @@ void mqttConnectionHandler(void *pvParameters)
           Serial.println("! MQTT connection failed");
         }
       }
+      outbound.release();
+    }
 
-      if (openRemoteMqtt.client.connected() && WiFi.status() == WL_CONNECTED && (millis() - lastSystemStatusUpdate) > lastSystemStatusUpdateInterval)
+    // Resync the assets one by one, control traffic gets the client in between
+    // (a copy per asset, the snapshot is not held across flash reads and publishes)
+    for (int i = 0; connected; i++)
+    {
+      DeviceAsset asset;
       {
-        lastSystemStatusUpdate = millis();
+        AssetSnapshot snapshot = assetManager.snapshot();
+        if (i >= snapshot.assets().size())
+        {
+          break;
+        }
+        asset = snapshot.assets()[i];
+      }
+      std::string managerJson = assetManager.loadManagerJson(asset); // cold, read from flash
+      if (outbound.acquire(TRAFFIC_RESYNC))
+      {
+        if (openRemoteMqtt.createAsset("master", managerJson, asset.sn.c_str()))
+        {
+          Serial.print("+ Sent asset data to OpenRemote, sn: ");
+          Serial.println(asset.sn.c_str());
+        }
+        outbound.release();
       }
-      xSemaphoreGive(pubSubSemaphore);
+    }
+
+    // Values reported while the connection was down, only the ones OpenRemote hasn't seen
+    if (connected)
+    {
+      mqttPushShadowDiffs();
     }
     vTaskDelay(2000 / portTICK_PERIOD_MS);
   }
@@ -178,128 +430,276 @@ void mqttCallbackHandler(char *topic, byte *payload, unsigned int length)
   Serial.print("Received, topic: ");
   Serial.println(topic);
 
-  // Handle response topics
-  if (strstr(topic, "response") != NULL)
+  // routed by topic filter, see the routes in setup()
+  if (!openRemoteMqtt.dispatch(topic, payload, length))
   {
-    Serial.println("Request response received");
-    // Grab the semaphore, we are going to access the mqtt client
-    if (xSemaphoreTake(pubSubSemaphore, portMAX_DELAY) == pdTRUE)
-    {
-      // unsubscribe from response topics, part of the request-response pattern
-      openRemoteMqtt.client.unsubscribe(topic);
-      xSemaphoreGive(pubSubSemaphore);
-    }
-
-    JsonDocument doc;
-    deserializeJson(doc, payload, length);
+    Serial.println("! No handler for topic");
+  }
+}
 
-    // Handle asset events
-    bool isAssetEvent = doc["eventType"].as<std::string>() == "asset";
-    bool isCreationEvent = doc["cause"].as<std::string>() == "CREATE";
-    std::string asset = doc["asset"].as<std::string>();
+// Response topics, completes the request waiting for it (see OpenRemotePubSub::request)
+void mqttHandleResponse(const char *topic, const byte *payload, unsigned int length)
+{
+  bool matched = openRemoteMqtt.handleResponse(topic, payload, length);
 
-    if (isAssetEvent && isCreationEvent)
-    {
-      DeviceAsset deviceAsset = DeviceAsset::fromJson(asset);
-      Serial.print("+ Device onboarded, data: ");
-      Serial.println(deviceAsset.managerJson.c_str());
-      assetManager.addDeviceAsset(deviceAsset);
-    }
+  // attribute operations subscribe per request, the asset operations share one subscription
+  if (strstr(topic, "/attributes/") != NULL && outbound.acquire(TRAFFIC_ACK))
+  {
+    openRemoteMqtt.client.unsubscribe(topic);
+    outbound.release();
   }
 
-  // Handle pending events
-  if (strstr(topic, "gateway/events/pending") != NULL)
+  // a create response after its request timed out, the device may still be onboarding
+  if (!matched)
   {
-    JsonDocument doc;
-    deserializeJson(doc, payload, length);
-    std::string event = doc.as<std::string>();
-
-    Serial.println("Pending gateway event received:");
-
-    std::string ackId = doc["ackId"].as<std::string>();
-    bool isAttributeEvent = doc["event"]["eventType"].as<std::string>() == "attribute";
-    std::string assetId = doc["event"]["ref"]["id"].as<std::string>();
-    std::string eventValue = doc["event"]["value"].as<std::string>();
-    std::string eventAttribute = doc["event"]["ref"]["name"].as<std::string>();
+    mqttHandleAssetResponse(payload, length);
+  }
+}
 
-    Serial.print("Asset ID: ");
-    Serial.println(assetId.c_str());
-    Serial.print("Event attribute: ");
-    Serial.println(eventAttribute.c_str());
-    Serial.print("Event value: ");
-    Serial.println(eventValue.c_str());
+// Pending gateway events, control attributes are forwarded to the device
+void mqttHandlePendingEvent(const char *topic, const byte *payload, unsigned int length)
+{
+  uint32_t trace = messageTracer.begin(TRACE_DOWNLINK, micros());
+  JsonDocument doc(&jsonAllocator);
+  deserializeJson(doc, payload, length);
+  messageTracer.mark(trace, TRACE_DECODE);
+  std::string event = doc.as<std::string>();
+
+  Serial.println("Pending gateway event received:");
+
+  std::string ackId = doc["ackId"].as<std::string>();
+  bool isAttributeEvent = doc["event"]["eventType"].as<std::string>() == "attribute";
+  std::string assetId = doc["event"]["ref"]["id"].as<std::string>();
+  std::string eventValue = doc["event"]["value"].as<std::string>();
+  std::string eventAttribute = doc["event"]["ref"]["name"].as<std::string>();
+  messageTracer.setLabel(trace, eventAttribute.c_str());
+
+  Serial.print("Asset ID: ");
+  Serial.println(assetId.c_str());
+  Serial.print("Event attribute: ");
+  Serial.println(eventAttribute.c_str());
+  Serial.print("Event value: ");
+  Serial.println(eventValue.c_str());
+
+  // Handle the event
+  if (isAttributeEvent)
+  {
+    DeviceAsset deviceAsset = assetManager.getDeviceAssetById(assetId.c_str());
 
-    // Handle the event
-    if (isAttributeEvent)
+    // Cant handle the event if the asset is not found
+    if (deviceAsset.id == "")
     {
-      DeviceAsset deviceAsset = assetManager.getDeviceAssetById(assetId.c_str());
+      return;
+    }
 
-      // Cant handle the event if the asset is not found
-      if (deviceAsset.id == "")
+    // Control attributes (e.g. PlugAsset "onOff") are forwarded to the device as actions
+    const ControlMapping *control = DeviceTypes::findControl(DeviceTypes::get(deviceAsset.typeId), eventAttribute);
+    std::string desired;
+    serializeJson(doc["event"]["value"], desired);
+    attributeShadow.desire(assetId, eventAttribute, desired, millis());
+    if (control != nullptr && attributeShadow.isReported(assetId, eventAttribute, desired))
+    {
+      Serial.println("+ Device already reported the desired state, no command sent");
+    }
+    else if (control != nullptr)
+    {
+      const char *action = eventValue == "true" ? control->onAction : control->offAction;
+      // a sleeping device would miss it, it gets the command after its next uplink
+      if (downlinkMailbox.isListening(deviceAsset.sn))
       {
-        return;
+        downlinkMailbox.postCommand(deviceAsset.sn, action, millis());
+        Serial.println("+ Command held for sleeping device");
       }
-
-      // PlugAsset has a control attribute "onOff"
-      if (deviceAsset.type == PLUG_ASSET)
+      else
       {
-        if (eventAttribute == "onOff")
-        {
-          std::string action = eventValue == "true" ? ACTION_ON : ACTION_OFF;
-          udp.beginPacket(deviceAsset.address, deviceAsset.port);
-          udp.write((const uint8_t *)action.c_str(), action.length());
-          udp.endPacket();
-        }
+        udp.beginPacket(IPAddress(deviceAsset.address), deviceAsset.port);
+        udp.write((const uint8_t *)action, strlen(action));
+        udp.endPacket();
       }
+    }
+    messageTracer.mark(trace, TRACE_DISPATCH);
 
-      // Acknowledge the event
-      // Grab the semaphore, we are going to access the mqtt client
-      if (xSemaphoreTake(pubSubSemaphore, portMAX_DELAY) == pdTRUE)
+    // Acknowledge the event
+    // Grab the mqtt client, a user waits for the ack of a control event
+    if (outbound.acquire(control != nullptr ? TRAFFIC_CONTROL : TRAFFIC_ACK))
+    {
+      messageTracer.mark(trace, TRACE_LOCK);
+      if (openRemoteMqtt.acknowledgeGatewayEvent("master", ackId))
       {
-        if (openRemoteMqtt.acknowledgeGatewayEvent("master", ackId))
-        {
-          Serial.println("+ Pending event acknowledged");
-        }
-        // Give the semaphore back
-        xSemaphoreGive(pubSubSemaphore);
+        messageTracer.mark(trace, TRACE_PUBLISHED);
+        Serial.println("+ Pending event acknowledged");
       }
+      outbound.release();
     }
   }
 }
 
+// Asset create response: the asset exists in OpenRemote, the device is onboarded
+// Responses of devices that are not onboarding (e.g. the resync after a reconnect) are ignored.
+void mqttHandleAssetResponse(const byte *payload, unsigned int length)
+{
+  JsonDocument doc;
+  deserializeJson(doc, payload, length);
+
+  // Handle asset events
+  bool isAssetEvent = doc["eventType"].as<std::string>() == "asset";
+  bool isCreationEvent = doc["cause"].as<std::string>() == "CREATE";
+  if (!isAssetEvent || !isCreationEvent)
+  {
+    return;
+  }
+
+  std::string asset = doc["asset"].as<std::string>();
+  DeviceAsset deviceAsset = DeviceAsset::fromJson(asset);
+  if (onboardingManager.getState(deviceAsset.sn) == ONBOARDING_NONE)
+  {
+    return;
+  }
+  Serial.print("+ Device onboarded, data: ");
+  Serial.println(asset.c_str());
+  assetManager.addDeviceAsset(deviceAsset, asset);
+  onboardingManager.complete(deviceAsset.sn); // frees the in-flight slot
+  publishOnboardingEvent(deviceAsset.sn, "created");
+}
+
+// Response of an asset edit / delete from the web interface, logged either way (a lost one is out of sync)
+ResponseCallback mqttExpectResponse(const char *operation, std::string assetId)
+{
+  return [operation, assetId](ResponseStatus status, const byte *payload, unsigned int length)
+  {
+    Serial.print(status == RESPONSE_RECEIVED ? "+ Asset " : "! No response to asset ");
+    Serial.print(operation);
+    Serial.print(", id: ");
+    Serial.println(assetId.c_str());
+  };
+}
+
+unsigned long lastOnboardingTick = 0;
+
 void udpHandler(void *pvParameters)
 {
+  // setup() starts the task before the WiFi is up
+  while (WiFi.status() != WL_CONNECTED)
+  {
+    vTaskDelay(50 / portTICK_PERIOD_MS);
+  }
   udp.begin(udp_port);
   while (true)
   {
+    bool dropped = false;
     if (WiFi.status() == WL_CONNECTED)
     {
       int packetSize = udp.parsePacket();
-      if (packetSize)
+      if (packetSize > UDP_MAX_PACKET_SIZE)
+      {
+        udp.flush(); // larger than any valid message, drop it
+        Serial.println("! UDP packet too large, dropped");
+      }
+      else if (packetSize)
       {
-        char incomingPacket[255];
-        udp.read(incomingPacket, 255);
+        char incomingPacket[UDP_MAX_PACKET_SIZE + 1];
+        udp.read(incomingPacket, packetSize);
         incomingPacket[packetSize] = 0;
-        DeviceMessage deviceMessage = DeviceMessage::fromJson(incomingPacket);
-
-        // DATA - used for sending data from devices to the gateway
-        if (deviceMessage.message_type == DATA_MESSAGE)
-        {
-          udpHandleDataMessage(deviceMessage);
-        }
-        // ALIVE - used for device check, and updating connection details
-        if (deviceMessage.message_type == ALIVE_MESSAGE)
+        uint32_t received = micros();
+
+        // Packet budget of the device, checked before the packet costs a parse and a publish
+        std::string peekSerial, peekType;
+        int peekMessageType;
+        DeviceMessage::peek(incomingPacket, peekSerial, peekType, peekMessageType);
+        IngressVerdict verdict = ingressLimiter.admit(peekSerial, DeviceTypes::intern(peekType), peekMessageType, outbound.congested(), millis());
+        dropped = verdict != INGRESS_ADMITTED; // counted, not logged per packet (a flooding device would flood the log too)
+        if (verdict == INGRESS_ADMITTED)
         {
-          udpHandleAliveMessage(deviceMessage);
+          udpTrace = messageTracer.begin(TRACE_UPLINK, received); // dropped packets would flush the ring during a flood
+          messageTracer.setLabel(udpTrace, peekSerial.c_str());
+          udpHandlePacket(incomingPacket);
+          udpTrace = 0;
         }
-        // ONBOARDING - used for onboarding devices locally and on OpenRemote
-        if (deviceMessage.message_type == ONBOARD_MESSAGE)
+        else if (verdict == INGRESS_SHED && assetManager.isDeviceOnboarded(peekSerial))
         {
-          udpHandleOnboardMessage(deviceMessage);
+          deviceLiveness.touch(peekSerial, millis()); // shed for upstream, the device itself is fine
         }
       }
     }
-    vTaskDelay(100 / portTICK_PERIOD_MS);
+    // Fire the timeouts of devices that went silent (deleted ones are dropped first, their timeout must not fire)
+    udpForgetDeletedDevices();
+    deviceLiveness.advance(millis());
+
+    // Onboarding timers (response timeouts, retries, blocks), then admit queued devices
+    if ((millis() - lastOnboardingTick) > 1000)
+    {
+      lastOnboardingTick = millis();
+      onboardingManager.tick(millis(), [](const OnboardingEntry &entry)
+                             { publishOnboardingEvent(entry.sn, OnboardingManager::stateName(entry.state)); });
+      udpProcessOnboardingQueue();
+    }
+    // a dropped packet cost next to nothing, drain the socket instead of letting the flood fill it
+    vTaskDelay(dropped ? 1 : 100 / portTICK_PERIOD_MS);
+  }
+}
+
+// Parse and dispatch an admitted packet
+void udpHandlePacket(const char *packet)
+{
+  DeviceMessage deviceMessage = DeviceMessage::fromJson(packet, &jsonAllocator);
+  deviceMessage.device_type_id = DeviceTypes::intern(deviceMessage.device_type); // dispatch by id from here on
+  messageTracer.mark(udpTrace, TRACE_DECODE);
+
+  // Duplicates and stale packets are dropped, they would be forwarded to OpenRemote again
+  // (onboarded devices only, any serial could be made up)
+  SequenceResult sequence = SEQUENCE_ACCEPTED;
+  if (assetManager.isDeviceOnboarded(deviceMessage.device_sn))
+  {
+    sequence = sequenceTracker.accept(deviceMessage.device_sn, deviceMessage.boot, deviceMessage.seq, millis());
+  }
+  if (sequence == SEQUENCE_DUPLICATE || sequence == SEQUENCE_STALE)
+  {
+    Serial.print(sequence == SEQUENCE_DUPLICATE ? "! Duplicate packet dropped - sn: " : "! Stale packet dropped - sn: ");
+    Serial.println(deviceMessage.device_sn.c_str());
+  }
+  else
+  {
+    messageTracer.mark(udpTrace, TRACE_DISPATCH);
+
+    // DATA - used for sending data from devices to the gateway
+    if (deviceMessage.message_type == DATA_MESSAGE)
+    {
+      udpHandleDataMessage(deviceMessage);
+    }
+    // BATCH - several readings of a device in one datagram
+    if (deviceMessage.message_type == BATCH_MESSAGE)
+    {
+      udpHandleBatchMessage(deviceMessage);
+    }
+    // ALIVE - used for device check, and updating connection details
+    if (deviceMessage.message_type == ALIVE_MESSAGE)
+    {
+      udpHandleAliveMessage(deviceMessage);
+    }
+    // ONBOARDING - used for onboarding devices locally and on OpenRemote
+    if (deviceMessage.message_type == ONBOARD_MESSAGE)
+    {
+      udpHandleOnboardMessage(deviceMessage);
+    }
+
+    // Sleeping devices only listen right after an uplink, deliver their pending downlink now
+    // (onboarded devices only, any serial could be made up)
+    std::string downlink;
+    if (assetManager.isDeviceOnboarded(deviceMessage.device_sn) &&
+        downlinkMailbox.uplink(deviceMessage.device_sn, deviceMessage.rx, deviceMessage.ack, downlink, millis()))
+    {
+      udp.beginPacket(udp.remoteIP(), udp.remotePort());
+      udp.write((const uint8_t *)downlink.c_str(), downlink.length());
+      udp.endPacket();
+      Serial.print("+ Downlink delivered - sn: ");
+      Serial.println(deviceMessage.device_sn.c_str());
+    }
+  }
+
+  // Any packet from an onboarded device counts as a sign of life
+  if (assetManager.isDeviceOnboarded(deviceMessage.device_sn.c_str()))
+  {
+    deviceLiveness.touch(deviceMessage.device_sn, millis());
   }
 }
 
@@ -308,9 +708,14 @@ void udpHandleAliveMessage(DeviceMessage deviceMessage)
 {
   if (!assetManager.isDeviceOnboarded(deviceMessage.device_sn.c_str()))
   {
-    udp.beginPacket(udp.remoteIP(), udp.remotePort());
-    udp.write((const uint8_t *)ONBOARD_REQ, 11);
-    udp.endPacket();
+    // rate limited per device, a request is already outstanding most of the time
+    if (onboardingManager.requestDue(deviceMessage.device_sn, millis()))
+    {
+      udp.beginPacket(udp.remoteIP(), udp.remotePort());
+      udp.write((const uint8_t *)ONBOARD_REQ, 11);
+      udp.endPacket();
+      publishOnboardingEvent(deviceMessage.device_sn, OnboardingManager::stateName(ONBOARDING_REQUESTED));
+    }
   }
   else
   {
@@ -318,67 +723,284 @@ void udpHandleAliveMessage(DeviceMessage deviceMessage)
   }
 }
 
+// Drop the liveness entries of deleted assets, queued by forgetDevice()
+void udpForgetDeletedDevices()
+{
+  InlineString<ASSET_SN_MAX_LENGTH> deviceSerial;
+  while (xQueueReceive(deletedDevices, &deviceSerial, 0) == pdTRUE)
+  {
+    deviceLiveness.remove(deviceSerial);
+  }
+}
+
+// Drop the per device state of a deleted asset: sequence window, ingress bucket, mailbox and liveness entry
+// (the liveness wheel belongs to the UDP task, the serial is queued for it)
+void forgetDevice(const std::string &deviceSerial)
+{
+  sequenceTracker.remove(deviceSerial);
+  ingressLimiter.remove(deviceSerial);
+  downlinkMailbox.remove(deviceSerial);
+  InlineString<ASSET_SN_MAX_LENGTH> queued(deviceSerial);
+  if (xQueueSend(deletedDevices, &queued, 100 / portTICK_PERIOD_MS) != pdTRUE)
+  {
+    Serial.print("! Liveness entry of a deleted device kept - sn: ");
+    Serial.println(deviceSerial.c_str());
+  }
+}
+
+// Connectivity handler, called by deviceLiveness when a device goes silent or comes back
+// The status goes through the shadow like any reading, a transition missed while disconnected is pushed after the reconnect
+void udpHandleConnectivityChange(const std::string &deviceSerial, bool online)
+{
+  DeviceAsset asset = assetManager.getDeviceAsset(deviceSerial);
+  if (asset.id == "")
+  {
+    return; // deleted in the meantime
+  }
+
+  Serial.print(online ? "+ Device online, sn: " : "! Device offline, sn: ");
+  Serial.println(deviceSerial.c_str());
+
+  JsonDocument attributes(&jsonAllocator);
+  attributes["connectionStatus"] = online ? "CONNECTED" : "DISCONNECTED";
+  // assets created before the templates had connectionStatus don't have the attribute in OpenRemote
+  if (assetManager.loadManagerJson(asset).find("\"connectionStatus\"") != std::string::npos)
+  {
+    udpPublishAttributes(asset.id, attributes);
+  }
+  publishAttributeEvent(asset.id, deviceSerial, attributes);
+}
+
 void udpHandleDataMessage(DeviceMessage deviceMessage)
 {
   Serial.print("Device data received - data: ");
   Serial.println(deviceMessage.data.c_str());
 
   if (!assetManager.isDeviceOnboarded(deviceMessage.device_sn.c_str()))
+  {
+    udpRequestOnboarding(deviceMessage.device_sn);
+    return;
+  }
+
+  const DeviceType *deviceType = DeviceTypes::get(deviceMessage.device_type_id);
+  if (deviceType == nullptr || deviceType->attributeCount == 0)
+  {
+    return; // unknown type, or a type without data attributes
+  }
+
+  JsonDocument attributes(&jsonAllocator);
+  if (deviceType->rawValue)
+  {
+    attributes[deviceType->attributes[0].attribute] = deviceMessage.data;
+  }
+  else
+  {
+    JsonDocument payload(&jsonAllocator);
+    deserializeJson(payload, deviceMessage.data);
+    udpMapAttributes(deviceType, payload, attributes);
+  }
+
+  if (attributes.size() == 0)
+  {
+    return; // nothing usable in the payload
+  }
+
+  std::string assetId = assetManager.getDeviceAssetId(deviceMessage.device_sn);
+  udpPublishAttributes(assetId, attributes);
+  attributeHistory.record(assetId, attributes, millis() / 1000);
+  publishAttributeEvent(assetId, deviceMessage.device_sn, attributes);
+}
+
+// Batch data: {"f":[field, ...],"r":[[age, value, ...], ...]}, readings oldest first, age in ms before the datagram was sent
+// Only the serial is sent, the device type is taken from the onboarded asset
+void udpHandleBatchMessage(DeviceMessage deviceMessage)
+{
+  if (!assetManager.isDeviceOnboarded(deviceMessage.device_sn.c_str()))
+  {
+    udpRequestOnboarding(deviceMessage.device_sn);
+    return;
+  }
+
+  DeviceAsset deviceAsset = assetManager.getDeviceAsset(deviceMessage.device_sn);
+  const DeviceType *deviceType = DeviceTypes::get(deviceAsset.typeId);
+  if (deviceType == nullptr || deviceType->attributeCount == 0 || deviceType->rawValue)
+  {
+    return; // only types with a JSON payload can be batched
+  }
+
+  JsonDocument batch(&jsonAllocator);
+  if (deserializeJson(batch, deviceMessage.data))
+  {
+    Serial.println("! Invalid batch message");
+    return;
+  }
+  JsonArray fields = batch["f"].as<JsonArray>();
+  JsonArray readings = batch["r"].as<JsonArray>();
+
+  // Every reading is forwarded as its own (multi-attribute) update, so no sample is lost in the datapoint history
+  JsonDocument attributes(&jsonAllocator);
+  int forwarded = 0;
+  unsigned long now = millis();
+  for (JsonArray reading : readings)
+  {
+    JsonDocument payload(&jsonAllocator);
+    for (int i = 0; i < fields.size() && i + 1 < reading.size(); i++)
+    {
+      payload[fields[i].as<const char *>()] = reading[i + 1];
+    }
+
+    attributes.clear();
+    udpMapAttributes(deviceType, payload, attributes);
+    if (attributes.size() > 0)
+    {
+      udpPublishAttributes(deviceAsset.id, attributes);
+      unsigned long age = min(reading[0].as<unsigned long>(), now);
+      attributeHistory.record(deviceAsset.id, attributes, (now - age) / 1000);
+      forwarded++;
+    }
+  }
+
+  Serial.print("Device batch received - readings: ");
+  Serial.println(forwarded);
+
+  // the live view only needs the latest reading
+  if (forwarded > 0)
+  {
+    publishAttributeEvent(deviceAsset.id, deviceMessage.device_sn, attributes);
+  }
+}
+
+// Ask an unknown device to onboard, rate limited per device (a request is already outstanding most of the time)
+void udpRequestOnboarding(const std::string &deviceSerial)
+{
+  if (onboardingManager.requestDue(deviceSerial, millis()))
   {
     udp.beginPacket(udp.remoteIP(), udp.remotePort());
     udp.write((const uint8_t *)ONBOARD_REQ, 11);
     udp.endPacket();
+    publishOnboardingEvent(deviceSerial, OnboardingManager::stateName(ONBOARDING_REQUESTED));
   }
-  else
+}
+
+// Map a device payload to attributes, through the compiled transforms if the device type has any
+void udpMapAttributes(const DeviceType *deviceType, JsonDocument &payload, JsonDocument &attributes)
+{
+  if (attributeTransforms.has(deviceType->id))
+  {
+    attributeTransforms.apply(deviceType->id, payload, attributes);
+    return;
+  }
+  for (int i = 0; i < deviceType->attributeCount; i++)
   {
-    if (deviceMessage.device_type == PRESENCE_SENSOR_ASSET)
+    attributes[deviceType->attributes[i].attribute] = payload[deviceType->attributes[i].field].as<std::string>();
+  }
+}
+
+// Publish the attribute values a device reported
+// Only the values that changed since they were last published are sent, the rest is known to OpenRemote
+void udpPublishAttributes(const std::string &assetId, JsonDocument &attributes)
+{
+  JsonDocument changed(&jsonAllocator);
+  if (attributeShadow.report(assetId, attributes, changed, millis()) == 0)
+  {
+    return;
+  }
+
+  // get the mqtt client, yields to control and ack traffic
+  if (outbound.acquire(TRAFFIC_TELEMETRY))
+  {
+    messageTracer.mark(udpTrace, TRACE_LOCK);
+    mqttTransport.setTag(udpTrace); // the PUBACK stamps TRACE_ACKED
+    bool published = mqttPublishAttributes(assetId, changed);
+    mqttTransport.setTag(0);
+    outbound.release();
+    if (published)
     {
-      std::string assetId = assetManager.getDeviceAssetId(deviceMessage.device_sn);
-      // get the semaphore cause we are going to access the mqtt client
-      if (xSemaphoreTake(pubSubSemaphore, portMAX_DELAY) == pdTRUE)
-      {
-        openRemoteMqtt.updateAttribute("master", assetId, "presence", deviceMessage.data, false);
-        // give the semaphore back
-        xSemaphoreGive(pubSubSemaphore);
-      }
+      messageTracer.mark(udpTrace, TRACE_PUBLISHED);
+      attributeShadow.markPublished(assetId, changed, millis()); // otherwise pushed after the next connect
+    }
+    if (published && !bootProfile.reached("first reading"))
+    {
+      bootProfile.milestone("first reading"); // time to first forwarded reading after power on
     }
+  }
+}
+
+// Publish attribute values of an asset, a single attribute is sent as a plain attribute update
+// The mqtt client must be held (OutboundScheduler)
+bool mqttPublishAttributes(const std::string &assetId, JsonDocument &attributes)
+{
+  if (attributes.size() == 1)
+  {
+    JsonPair attribute = *attributes.as<JsonObject>().begin();
+    return openRemoteMqtt.updateAttribute("master", assetId, attribute.key().c_str(), attribute.value().as<std::string>());
+  }
+  return openRemoteMqtt.updateMultipleAttributes("master", assetId, attributes.as<std::string>());
+}
 
-    if (deviceMessage.device_type == ENVIRONMENT_SENSOR_ASSET)
+// After a reconnect: publish what the devices reported while the values couldn't be published (shadow diffs)
+void mqttPushShadowDiffs()
+{
+  int pushed = 0;
+  for (const std::string &assetId : attributeShadow.pendingAssets())
+  {
+    JsonDocument diff(&jsonAllocator);
+    if (attributeShadow.pending(assetId, diff) == 0 || assetManager.getDeviceAssetById(assetId).id == "")
+    {
+      continue;
+    }
+    if (outbound.acquire(TRAFFIC_RESYNC))
     {
-      std::string assetId = assetManager.getDeviceAssetId(deviceMessage.device_sn);
-      JsonDocument doc;
-      deserializeJson(doc, deviceMessage.data);
-      // get the semaphore cause we are going to access the mqtt client
-      if (xSemaphoreTake(pubSubSemaphore, portMAX_DELAY) == pdTRUE)
+      if (mqttPublishAttributes(assetId, diff))
       {
-        openRemoteMqtt.updateAttribute("master", assetId, "temperature", doc["temperature"].as<std::string>(), false);
-        openRemoteMqtt.updateAttribute("master", assetId, "relativeHumidity", doc["relativeHumidity"].as<std::string>(), false);
-        // give the semaphore back
-        xSemaphoreGive(pubSubSemaphore);
+        attributeShadow.markPublished(assetId, diff, millis());
+        pushed += diff.size();
       }
+      outbound.release();
     }
+  }
+  if (pushed > 0)
+  {
+    Serial.print("+ Attribute values reported while offline published: ");
+    Serial.println(pushed);
+  }
+}
 
-    if (deviceMessage.device_type == AIR_QUALITY_SENSOR_ASSET)
+// An attribute update the QoS 1 window gave up (never acknowledged): OpenRemote doesn't have the values,
+// the shadow takes them back so the next shadow diff push sends them again
+void mqttHandleDroppedPublish(const std::string &topic, const std::string &payload)
+{
+  // <realm>/<client>/operations/assets/<assetId>/attributes/update or .../attributes/<name>/update
+  size_t assets = topic.find("/operations/assets/");
+  size_t attributes = assets == std::string::npos ? std::string::npos : topic.find("/attributes/", assets + 19);
+  if (attributes == std::string::npos)
+  {
+    return;
+  }
+  std::string assetId = topic.substr(assets + 19, attributes - assets - 19);
+  std::string rest = topic.substr(attributes + 12); // "update" or "<name>/update"
+  std::string name = rest.length() > 7 ? rest.substr(0, rest.length() - 7) : "";
+
+  JsonDocument values;
+  if (name.empty())
+  {
+    deserializeJson(values, payload); // object of attributes
+  }
+  else
+  {
+    JsonDocument value;
+    if (deserializeJson(value, payload) == DeserializationError::Ok)
     {
-      std::string assetId = assetManager.getDeviceAssetId(deviceMessage.device_sn);
-      JsonDocument doc;
-      deserializeJson(doc, deviceMessage.data);
-      // get the semaphore cause we are going to access the mqtt client
-      if (xSemaphoreTake(pubSubSemaphore, portMAX_DELAY) == pdTRUE)
-      {
-        JsonDocument attributeTemplateDoc;
-        attributeTemplateDoc["temperature"] = doc["temperature"].as<std::string>();
-        attributeTemplateDoc["humidity"] = doc["humidity"].as<std::string>();
-        attributeTemplateDoc["gasResistance"] = doc["gas"].as<std::string>();
-        attributeTemplateDoc["altitude"] = doc["altitude"].as<std::string>();
-        attributeTemplateDoc["pressure"] = doc["pressure"].as<std::string>();
-
-        openRemoteMqtt.updateMultipleAttributes("master", assetId, attributeTemplateDoc.as<std::string>(), false);
-        // give the semaphore back
-        xSemaphoreGive(pubSubSemaphore);
-      }
+      values[name] = value;
+    }
+    else
+    {
+      values[name] = payload; // plain string value
     }
   }
+  attributeShadow.markDropped(assetId, values);
+  Serial.print("! Attribute update given up, pushed again after the next connect - asset: ");
+  Serial.println(assetId.c_str());
 }
 
 void udpHandleOnboardMessage(DeviceMessage deviceMessage)
@@ -398,93 +1020,136 @@ void udpHandleOnboardMessage(DeviceMessage deviceMessage)
     Serial.print(", port: ");
     Serial.println(udp.remotePort());
 
-    assetManager.removePendingOnboarding(deviceMessage.device_sn.c_str()); // remove from pending onboarding - we are done.
+    onboardingManager.complete(deviceMessage.device_sn); // stop tracking onboarding - we are done.
+    publishOnboardingEvent(deviceMessage.device_sn, "onboarded");
+  }
+  else if (fleetFull())
+  {
+    Serial.print("! Fleet limit reached, onboarding refused - sn: ");
+    Serial.println(deviceMessage.device_sn.c_str());
   }
-  else if (assetManager.isOnboardingPending(deviceMessage.device_sn.c_str()))
+  else if (onboardingManager.enqueue(deviceMessage.device_sn, deviceMessage.device_name, deviceMessage.device_type, millis()))
   {
-    Serial.println("Device is pending onboarding");
+    publishOnboardingEvent(deviceMessage.device_sn, OnboardingManager::stateName(ONBOARDING_QUEUED));
+    udpProcessOnboardingQueue();
   }
   else
   {
-    assetManager.addPendingOnboarding(deviceMessage.device_sn.c_str());
-    if (deviceMessage.device_type == PLUG_ASSET)
-    {
-      PlugAsset asset = PlugAsset(deviceMessage.device_name.c_str(), deviceMessage.device_sn.c_str(), deviceMessage.device_type.c_str());
-      std::string json = asset.toJson();
+    // duplicate (queued, in flight, retrying) or blocked
+    Serial.print("Device onboarding ");
+    Serial.println(OnboardingManager::stateName(onboardingManager.getState(deviceMessage.device_sn)));
+  }
+}
 
-      // get the semaphore cause we are going to access the mqtt client
-      if (xSemaphoreTake(pubSubSemaphore, portMAX_DELAY) == pdTRUE)
-      {
-        if (openRemoteMqtt.createAsset("master", json, deviceMessage.device_sn.c_str(), true))
-        {
-          Serial.println("+ Sent asset create request");
-        }
-        // give the semaphore back
-        xSemaphoreGive(pubSubSemaphore);
-      }
+// Fleet limit of the static allocation mode, onboarded devices plus the ones being created (GATEWAY_MAX_DEVICES)
+// creating: devices of the caller already counted as in flight
+bool fleetFull(int creating)
+{
+#ifdef GATEWAY_STATIC_ALLOCATION
+  return (int)assetManager.size() + onboardingManager.getInFlight() - creating >= GATEWAY_MAX_DEVICES;
+#else
+  return false;
+#endif
+}
+
+// Asset template for a device that is being onboarded, empty if the device type is not supported
+// or the serial does not fit the asset registry (ASSET_SN_MAX_LENGTH)
+std::string udpOnboardingTemplate(const OnboardingEntry &entry)
+{
+  const DeviceType *deviceType = DeviceTypes::get(DeviceTypes::intern(entry.type));
+  if (deviceType == nullptr || entry.sn.length() > ASSET_SN_MAX_LENGTH)
+  {
+    return "";
+  }
+  return deviceType->buildTemplate(entry.name, entry.sn, entry.type);
+}
+
+// Send asset create requests for queued devices, as long as there are free in-flight slots
+void udpProcessOnboardingQueue()
+{
+  OnboardingEntry entry;
+  while (onboardingManager.next(entry, millis()))
+  {
+    // queued before the fleet filled up, retried after a backoff (a device may be deleted meanwhile)
+    if (fleetFull(1))
+    {
+      publishOnboardingEvent(entry.sn, OnboardingManager::stateName(onboardingManager.fail(entry.sn, millis())));
+      continue;
     }
 
-    if (deviceMessage.device_type == ENVIRONMENT_SENSOR_ASSET)
+    std::string json = udpOnboardingTemplate(entry);
+    if (json == "")
     {
-      EnvironmentSensorAsset asset = EnvironmentSensorAsset(deviceMessage.device_name.c_str(), deviceMessage.device_sn.c_str(), deviceMessage.device_type.c_str());
-      std::string json = asset.toJson();
-      // get the semaphore cause we are going to access the mqtt client
-      if (xSemaphoreTake(pubSubSemaphore, portMAX_DELAY) == pdTRUE)
-      {
-        if (openRemoteMqtt.createAsset("master", json, deviceMessage.device_sn.c_str(), true))
-        {
-          Serial.println("+ Sent asset create request");
-        }
-        // give the semaphore back
-        xSemaphoreGive(pubSubSemaphore);
-      }
+      Serial.print("! Unsupported device type or serial, sn: ");
+      Serial.println(entry.sn.c_str());
+      onboardingManager.block(entry.sn, millis());
+      publishOnboardingEvent(entry.sn, OnboardingManager::stateName(ONBOARDING_BLOCKED));
+      continue;
     }
 
-    if (deviceMessage.device_type == AIR_QUALITY_SENSOR_ASSET)
+    bool sent = false;
+    // get the mqtt client, ahead of telemetry
+    if (outbound.acquire(TRAFFIC_ONBOARDING))
     {
-      AirQualitySensorAsset asset = AirQualitySensorAsset(deviceMessage.device_name.c_str(), deviceMessage.device_sn.c_str(), deviceMessage.device_type.c_str());
-      std::string json = asset.toJson();
-      // get the semaphore cause we are going to access the mqtt client
-      if (xSemaphoreTake(pubSubSemaphore, portMAX_DELAY) == pdTRUE)
-      {
-        if (openRemoteMqtt.createAsset("master", json, deviceMessage.device_sn.c_str(), true))
+      std::string deviceSerial = entry.sn;
+      sent = openRemoteMqtt.createAsset("master", json, entry.sn, [deviceSerial](ResponseStatus status, const byte *payload, unsigned int length)
+                                        {
+        if (status == RESPONSE_RECEIVED)
         {
-          Serial.println("+ Sent asset create request");
+          mqttHandleAssetResponse(payload, length);
         }
-        // give the semaphore back
-        xSemaphoreGive(pubSubSemaphore);
-      }
+        else
+        {
+          // the onboarding manager retries once its own response timeout passes
+          Serial.print("! Asset create response lost, sn: ");
+          Serial.println(deviceSerial.c_str());
+        } }, ONBOARDING_RESPONSE_TIMEOUT);
+      outbound.release();
     }
 
-    if (deviceMessage.device_type == PRESENCE_SENSOR_ASSET)
+    if (sent)
     {
-      PresenceSensorAsset asset = PresenceSensorAsset(deviceMessage.device_name.c_str(), deviceMessage.device_sn.c_str(), deviceMessage.device_type.c_str());
-      std::string json = asset.toJson();
-      // get the semaphore cause we are going to access the mqtt client
-      if (xSemaphoreTake(pubSubSemaphore, portMAX_DELAY) == pdTRUE)
-      {
-        if (openRemoteMqtt.createAsset("master", json, deviceMessage.device_sn.c_str(), true))
-        {
-          Serial.println("+ Sent asset create request");
-        }
-        // give the semaphore back
-        xSemaphoreGive(pubSubSemaphore);
-      }
+      Serial.println("+ Sent asset create request");
+      publishOnboardingEvent(entry.sn, OnboardingManager::stateName(ONBOARDING_IN_FLIGHT));
+    }
+    else
+    {
+      publishOnboardingEvent(entry.sn, OnboardingManager::stateName(onboardingManager.fail(entry.sn, millis())));
     }
   }
 }
 
 // HTTP Request Buffers, large requests are split into multiple packets (This is default behavior for HTTP)
-std::map<String, std::vector<uint8_t>> requestBuffers;
+// fixed pool, bounded size per request, see REQUEST_BODY_SLOTS and REQUEST_BODY_MAX_SIZE
+RequestBodyPool requestBodyPool;
 
 // Start the web server
 // - /: serves index.html
 // - /view?id=xxxxx: view page of an asset
+// - static assets are served gzipped from SPIFFS, see scripts/build_web_assets.py
 // - /manager/assets: GET: list of assets, GET ?id=xxxxx, DELETE ?id=xxxxx, PUT ?id=xxxxx
+// - /manager/assets/shadow?id=xxxxx: GET: attribute state (reported, published, desired)
 // - /system/status: GET: system status (ip, heap, uptime)
+// - /events: SSE stream (status, attribute, onboarding events)
 void startWebServer()
 {
-  server.serveStatic("/", SPIFFS, "/").setDefaultFile("index.html");
+  requestBodyPool.init();
+
+  // Precompressed assets, fall back to plain file serving if the manifest is missing (outdated file system image)
+  if (staticAssets.load())
+  {
+    Serial.print("+ Static assets loaded, count: ");
+    Serial.println(staticAssets.assets.size());
+
+    server.on("/", HTTP_GET, [](AsyncWebServerRequest *request)
+              { staticAssets.send(request, "/index.html"); });
+    staticAssets.serve(server);
+  }
+  else
+  {
+    Serial.println("! Static asset manifest not found, serving plain files");
+    server.serveStatic("/", SPIFFS, "/").setDefaultFile("index.html");
+  }
 
   // Serve asset view page
   server.on("/view", HTTP_GET, [](AsyncWebServerRequest *request)
@@ -492,13 +1157,79 @@ void startWebServer()
         if (request->hasParam("id"))
         {
             String id = request->getParam("id")->value();
-            request->send(SPIFFS, "/view.html", "text/html");
+            if (!staticAssets.send(request, "/view.html"))
+            {
+                request->send(SPIFFS, "/view.html", "text/html");
+            }
         }
         else
         {
             request->send(404, "text/plain", "404: Not Found");
         } });
 
+  // Recent attribute values, kept on the gateway (works without OpenRemote)
+  // id: asset, attr: attribute (without: list of attributes with history)
+  // from: uptime (s), negative is relative to now (-3600: last hour), step: bucket size (s), 0 for raw values
+  // registered before /manager/assets, which would match this path as well
+  server.on("/manager/assets/history", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+        if (!request->hasParam("id"))
+        {
+            request->send(400, "application/json", "{\"status\": \"error\"}");
+            return;
+        }
+        std::string id = request->getParam("id")->value().c_str();
+        uint32_t now = millis() / 1000;
+
+        JsonDocument doc;
+        doc["id"] = id;
+        doc["now"] = now;
+        if (!request->hasParam("attr"))
+        {
+            attributeHistory.list(id, doc["attributes"].to<JsonArray>());
+        }
+        else
+        {
+            long from = request->hasParam("from") ? request->getParam("from")->value().toInt() : 0;
+            long step = request->hasParam("step") ? request->getParam("step")->value().toInt() : 0;
+            if (from < 0)
+            {
+                from = max((long)now + from, 0L);
+            }
+            std::string attribute = request->getParam("attr")->value().c_str();
+            doc["attr"] = attribute;
+            if (!attributeHistory.query(id, attribute, from, max(step, 0L), doc.as<JsonObject>()))
+            {
+                request->send(404, "application/json", "{\"status\": \"error\"}");
+                return;
+            }
+        }
+
+        std::string output;
+        ArduinoJson::serializeJson(doc, output);
+        request->send(200, "application/json", output.c_str()); });
+
+  // Attribute state of an asset, answered from the shadow: last reported, published and desired values
+  // registered before /manager/assets, which would match this path as well
+  server.on("/manager/assets/shadow", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+        if (!request->hasParam("id"))
+        {
+            request->send(400, "application/json", "{\"status\": \"error\"}");
+            return;
+        }
+        std::string id = request->getParam("id")->value().c_str();
+        JsonDocument doc;
+        doc["id"] = id;
+        if (!attributeShadow.toJson(id, doc["attributes"].to<JsonObject>(), millis()))
+        {
+            request->send(404, "application/json", "{\"status\": \"error\"}");
+            return;
+        }
+        std::string output;
+        ArduinoJson::serializeJson(doc, output);
+        request->send(200, "application/json", output.c_str()); });
+
   // List - Single asset endpoint
   server.on("/manager/assets", HTTP_GET, [](AsyncWebServerRequest *request)
             {
@@ -513,10 +1244,10 @@ void startWebServer()
             else
             {
                 JsonDocument doc;
-                doc["sn"] = asset.sn;
-                doc["type"] = asset.type;
-                doc["id"] = asset.id;
-                doc["managerJson"] = asset.managerJson;
+                doc["sn"] = asset.sn.c_str();
+                doc["type"] = asset.type();
+                doc["id"] = asset.id.c_str();
+                doc["managerJson"] = assetManager.loadManagerJson(asset); // cold, read from flash
 
                 std::string output;
                 ArduinoJson::serializeJson(doc, output);
@@ -528,13 +1259,13 @@ void startWebServer()
             JsonDocument doc;
             JsonArray assets = doc["assets"].to<JsonArray>();
 
-            for (int i = 0; i < assetManager.assets.size(); i++)
+            AssetSnapshot snapshot = assetManager.snapshot();
+            for (const DeviceAsset &asset : snapshot.assets())
             {
-                DeviceAsset asset = assetManager.assets[i];
                 JsonObject assetJson = assets.add<JsonObject>();
-                assetJson["sn"] = asset.sn;
-                assetJson["type"] = asset.type;
-                assetJson["id"] = asset.id;
+                assetJson["sn"] = asset.sn.c_str();
+                assetJson["type"] = asset.type();
+                assetJson["id"] = asset.id.c_str();
             }
             std::string output;
             ArduinoJson::serializeJson(doc, output);
@@ -547,20 +1278,23 @@ void startWebServer()
         if (request->hasParam("id"))
         {
             String id = request->getParam("id")->value();
-            // take the semaphore because we are going to access the mqtt client
-            if (xSemaphoreTake(pubSubSemaphore, portMAX_DELAY) == pdTRUE)
+            // take the mqtt client, deletes are part of the asset lifecycle
+            if (outbound.acquire(TRAFFIC_ONBOARDING))
             {
+                std::string deviceSerial = assetManager.getDeviceAssetById(id.c_str()).sn;
                 if (assetManager.deleteDeviceAssetById(id.c_str()))
                 {
-                    openRemoteMqtt.deleteAsset("master", id.c_str());
+                    openRemoteMqtt.deleteAsset("master", id.c_str(), mqttExpectResponse("delete", id.c_str()));
+                    attributeHistory.remove(id.c_str());
+                    attributeShadow.remove(id.c_str());
+                    forgetDevice(deviceSerial);
                     request->send(200, "application/json", "{\"status\": \"ok\"}");
                 }
                 else
                 {
                     request->send(500, "application/json", "{\"status\": \"error\"}");
                 }
-                // give the semaphore back
-                xSemaphoreGive(pubSubSemaphore);
+                outbound.release();
             }
             else
             {
@@ -574,54 +1308,293 @@ void startWebServer()
         if (request->hasParam("id") && request->url() == "/manager/assets" && request->method() == HTTP_PUT)
         {
             String id = request->getParam("id")->value();
+            RequestBodySlot *slot = nullptr;
             if (index == 0)
             {
-                requestBuffers[id].clear();
+                if (total > REQUEST_BODY_MAX_SIZE)
+                {
+                    request->send(413, "application/json", "{\"status\": \"error\"}");
+                    return;
+                }
+                slot = requestBodyPool.acquire(request);
+                if (slot == nullptr)
+                {
+                    request->send(503, "application/json", "{\"status\": \"error\"}");
+                    return;
+                }
+                // aborted uploads give their slot back right away
+                request->onDisconnect([request]()
+                                      { requestBodyPool.release(request); });
+            }
+            else
+            {
+                requestBodyPool.reclaimExpired();
+                slot = requestBodyPool.find(request);
+            }
+
+            // no slot: refused earlier or reclaimed after a timeout (already answered), the remaining chunks are dropped
+            if (slot == nullptr)
+            {
+                return;
+            }
+
+            if (!requestBodyPool.append(slot, data, len))
+            {
+                requestBodyPool.release(request);
+                request->send(400, "application/json", "{\"status\": \"error\"}");
+                return;
             }
-            requestBuffers[id].insert(requestBuffers[id].end(), data, data + len);
 
             if (index + len == total)
             {
-                std::vector<uint8_t>& buffer = requestBuffers[id];
+                if (!slot->scanner.complete)
+                {
+                    requestBodyPool.release(request);
+                    request->send(400, "application/json", "{\"status\": \"error\"}");
+                    return;
+                }
+
+                // parsed in place (zero-copy), the slot buffer is null terminated
                 JsonDocument doc;
-                ArduinoJson::deserializeJson(doc, buffer.data(), buffer.size());
+                ArduinoJson::deserializeJson(doc, (char *)slot->data, slot->length);
                 std::string json = doc.as<std::string>();
+                requestBodyPool.release(request);
 
-                // take the semaphore because we are going to access the mqtt client
-                if (xSemaphoreTake(pubSubSemaphore, portMAX_DELAY) == pdTRUE)
+                // take the mqtt client, a user is waiting for the edit
+                if (outbound.acquire(TRAFFIC_CONTROL))
                 {
                     if (assetManager.updateDeviceAssetJson(id.c_str(), json.c_str()))
                     {
-                        openRemoteMqtt.updateAsset("master", id.c_str(), json.c_str());
+                        openRemoteMqtt.updateAsset("master", id.c_str(), json.c_str(), mqttExpectResponse("update", id.c_str()));
                         request->send(200, "application/json", "{\"status\": \"ok\"}");
                     }
                     else
                     {
                         request->send(500, "application/json", "{\"status\": \"error\"}");
                     }
-                    // give the semaphore back
-                    xSemaphoreGive(pubSubSemaphore);
+                    outbound.release();
                 }
                 else
                 {
                     request->send(404, "application/json", "{\"status\": \"error\"}");
                 }
-                // Clear the buffer after processing
-                requestBuffers.erase(id);
             }
         } });
 
+  // Downlink config for a device (JSON object, e.g. {"interval":60000}), delivered after its next uplink
+  server.on("/manager/downlink", HTTP_POST, [](AsyncWebServerRequest *request)
+            {
+        if (!request->hasParam("sn", true) || !request->hasParam("config", true))
+        {
+            request->send(400, "application/json", "{\"status\": \"error\"}");
+            return;
+        }
+        std::string deviceSerial = request->getParam("sn", true)->value().c_str();
+        std::string config = request->getParam("config", true)->value().c_str();
+
+        JsonDocument doc;
+        if (deserializeJson(doc, config) || !doc.is<JsonObject>() || !assetManager.isDeviceOnboarded(deviceSerial))
+        {
+            request->send(400, "application/json", "{\"status\": \"error\"}");
+            return;
+        }
+        if (!downlinkMailbox.postConfig(deviceSerial, config, millis()))
+        {
+            request->send(413, "application/json", "{\"status\": \"error\"}");
+            return;
+        }
+        request->send(202, "application/json", "{\"status\": \"ok\"}"); });
+
+  // Pending (unacknowledged) downlinks
+  server.on("/manager/downlink", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+        JsonDocument doc;
+        downlinkMailbox.toJson(doc["pending"].to<JsonArray>());
+        std::string output;
+        ArduinoJson::serializeJson(doc, output);
+        request->send(200, "application/json", output.c_str()); });
+
+  // Packet budgets per device: admitted, throttled (over budget) and shed (upstream congested) packets
+  server.on("/manager/ingress", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+        JsonDocument doc;
+        ingressLimiter.toJson(doc["devices"].to<JsonArray>());
+        doc["congested"] = outbound.congested();
+        std::string output;
+        ArduinoJson::serializeJson(doc, output);
+        request->send(200, "application/json", output.c_str()); });
+
+  // Link quality per device: received, lost, duplicate, stale and reordered packets (sequence numbers)
+  server.on("/manager/links", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+        JsonDocument doc;
+        sequenceTracker.toJson(doc["links"].to<JsonArray>());
+        std::string output;
+        ArduinoJson::serializeJson(doc, output);
+        request->send(200, "application/json", output.c_str()); });
+
   // Endpoint to get local IP + free heap space + uptime
   server.on("/system/status", HTTP_GET, [](AsyncWebServerRequest *request)
+            { request->send(200, "application/json", systemStatusJson().c_str()); });
+
+  // Wait / hold times of the mqtt client per traffic class (control, ack, onboarding, telemetry, resync)
+  server.on("/system/outbound", HTTP_GET, [](AsyncWebServerRequest *request)
             {
         JsonDocument doc;
-        doc["ip"] = WiFi.localIP();
-        doc["heap"] = ESP.getFreeHeap() / 1024;
-        doc["uptime"] = millis() / 1000;
+        outbound.toJson(doc.to<JsonObject>());
+
+        // requests waiting for a response, lost responses show up as timeouts
+        JsonObject requests = doc["requests"].to<JsonObject>();
+        requests["pending"] = openRemoteMqtt.responses.pending();
+        requests["completed"] = openRemoteMqtt.responses.completed;
+        requests["timedOut"] = openRemoteMqtt.responses.timedOut;
+        requests["unmatched"] = openRemoteMqtt.responses.unmatched;
+        requests["rejected"] = openRemoteMqtt.responses.rejected;
+        requests["latencyMaxMs"] = openRemoteMqtt.responses.getLatencyMax();
+
+        // QoS 1 attribute updates
+        uint8_t inFlight, windowSize;
+        Qos1Stats qos1 = mqttTransport.getStats(inFlight, windowSize);
+        JsonObject reliable = doc["qos1"].to<JsonObject>();
+        reliable["window"] = windowSize;
+        reliable["inFlight"] = inFlight;
+        reliable["published"] = qos1.published;
+        reliable["acked"] = qos1.acked;
+        reliable["retransmitted"] = qos1.retransmitted;
+        reliable["dropped"] = qos1.dropped;
+        reliable["windowFull"] = qos1.windowFull;
+        reliable["rttAvgMs"] = qos1.acked > 0 ? (double)qos1.rttTotal / qos1.acked : 0;
+        reliable["rttMaxMs"] = qos1.rttMax;
+
+        // attribute values not published because OpenRemote already has them
+        ShadowStats shadowStats = attributeShadow.getStats();
+        JsonObject shadow = doc["shadow"].to<JsonObject>();
+        shadow["reported"] = shadowStats.reported;
+        shadow["unchanged"] = shadowStats.unchanged;
+        shadow["resynced"] = shadowStats.resynced;
         std::string output;
         ArduinoJson::serializeJson(doc, output);
         request->send(200, "application/json", output.c_str()); });
 
+  // Boot phases and milestones (WiFi, MQTT, first forwarded reading), ms since power on
+  server.on("/system/boot", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+        JsonDocument doc;
+        bootProfile.toJson(doc.to<JsonObject>());
+        std::string output;
+        ArduinoJson::serializeJson(doc, output);
+        request->send(200, "application/json", output.c_str()); });
+
+  // Per stage timestamps of the recent messages, ?format=chrome for chrome://tracing / Perfetto
+  server.on("/system/traces", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+        JsonDocument doc;
+        if (request->hasParam("format") && request->getParam("format")->value() == "chrome")
+        {
+            messageTracer.toChromeTrace(doc.to<JsonObject>());
+        }
+        else
+        {
+            messageTracer.toJson(doc.to<JsonArray>());
+        }
+        std::string output;
+        ArduinoJson::serializeJson(doc, output);
+        request->send(200, "application/json", output.c_str()); });
+
+  // Heap cost per device and how many devices fit, in the free heap (minus a reserve) or in ?budget= bytes
+  server.on("/system/memory", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+        uint32_t heap = ESP.getFreeHeap();
+        uint32_t budget = heap > MEMORY_HEAP_RESERVE ? heap - MEMORY_HEAP_RESERVE : 0;
+        if (request->hasParam("budget"))
+        {
+            budget = request->getParam("budget")->value().toInt();
+        }
+
+        JsonDocument doc;
+        doc["heap"] = heap;
+        doc["heapMin"] = ESP.getMinFreeHeap();
+        doc["assets"] = assetManager.size();
+        doc["registryBytes"] = assetManager.memoryBytes(); // every version, see ASSET_REGISTRY_VERSIONS
+
+        // every device has an asset, a liveness entry, a sequence window and a token bucket, managerJson stays in flash
+        JsonObject perDevice = doc["perDevice"].to<JsonObject>();
+        perDevice["asset"] = sizeof(DeviceAsset);
+        perDevice["liveness"] = sizeof(LivenessEntry) + MEMORY_MAP_NODE + sizeof(int);
+        perDevice["sequence"] = MEMORY_MAP_NODE + sizeof(SequenceState);
+        perDevice["ingress"] = MEMORY_MAP_NODE + sizeof(IngressBucket);
+        uint32_t total = sizeof(DeviceAsset) + sizeof(LivenessEntry) + sizeof(int) + sizeof(SequenceState) + sizeof(IngressBucket) + 3 * MEMORY_MAP_NODE;
+        perDevice["total"] = total;
+
+        doc["budget"] = budget;
+        doc["devicesFit"] = budget / total;
+
+        // task stacks and their unused part (high water mark)
+        JsonObject tasks = doc["tasks"].to<JsonObject>();
+        tasks["mqtt"]["stack"] = MQTT_TASK_STACK;
+        tasks["mqtt"]["unused"] = uxTaskGetStackHighWaterMark(mqttTask);
+        tasks["udp"]["stack"] = UDP_TASK_STACK;
+        tasks["udp"]["unused"] = uxTaskGetStackHighWaterMark(udpTask);
+
+#ifdef GATEWAY_STATIC_ALLOCATION
+        // fixed budget, allocated at boot: block pool, task stacks, request bodies, fleet
+        JsonObject fixed = doc["static"].to<JsonObject>();
+        fixed["maxDevices"] = GATEWAY_MAX_DEVICES;
+        fixed["poolBytes"] = BLOCK_POOL_BYTES;
+        fixed["stackBytes"] = MQTT_TASK_STACK + UDP_TASK_STACK;
+        fixed["requestBodyBytes"] = REQUEST_BODY_SLOTS * REQUEST_BODY_MAX_SIZE;
+        fixed["registryBytes"] = GATEWAY_MAX_DEVICES * sizeof(DeviceAsset);
+        fixed["total"] = BLOCK_POOL_BYTES + MQTT_TASK_STACK + UDP_TASK_STACK + REQUEST_BODY_SLOTS * REQUEST_BODY_MAX_SIZE + GATEWAY_MAX_DEVICES * sizeof(DeviceAsset);
+        staticMemory.toJson(fixed["memory"].to<JsonObject>());
+#endif
+        std::string output;
+        ArduinoJson::serializeJson(doc, output);
+        request->send(200, "application/json", output.c_str()); });
+
+  // Live event stream, new subscribers get the current status right away
+  eventStream.source.onConnect([](AsyncEventSourceClient *client)
+                               { client->send(systemStatusJson().c_str(), STREAM_EVENT_STATUS, eventStream.lastEventId); });
+  server.addHandler(&eventStream.source);
+
   // Start the server
   server.begin();
 }
+
+// System status (ip, heap, uptime), shared by /system/status and the event stream
+std::string systemStatusJson()
+{
+  JsonDocument doc(&jsonAllocator);
+  doc["ip"] = WiFi.localIP();
+  doc["heap"] = ESP.getFreeHeap() / 1024;
+  doc["uptime"] = millis() / 1000;
+  std::string output;
+  ArduinoJson::serializeJson(doc, output);
+  return output;
+}
+
+// Attribute values forwarded to OpenRemote, pushed to the management interface
+void publishAttributeEvent(std::string assetId, std::string deviceSerial, JsonDocument &attributes)
+{
+  if (!eventStream.hasSubscribers())
+  {
+    return;
+  }
+  JsonDocument doc(&jsonAllocator);
+  doc["id"] = assetId;
+  doc["sn"] = deviceSerial;
+  doc["attributes"] = attributes;
+  eventStream.publish(STREAM_EVENT_ATTRIBUTE, doc);
+}
+
+// Onboarding state changes (requested, queued, pending, retrying, blocked, created, onboarded), pushed to the management interface
+void publishOnboardingEvent(std::string deviceSerial, const char *state)
+{
+  if (!eventStream.hasSubscribers())
+  {
+    return;
+  }
+  JsonDocument doc(&jsonAllocator);
+  doc["sn"] = deviceSerial;
+  doc["state"] = state;
+  eventStream.publish(STREAM_EVENT_ONBOARDING, doc);
+}
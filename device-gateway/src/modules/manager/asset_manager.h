@@ -1,25 +1,112 @@
 #ifndef DEVICE_MANAGER_H
 #define DEVICE_MANAGER_H
 
+#include <Arduino.h>
 #include <string>
 #include <vector>
-#include <algorithm>
+#include <atomic>
 #include "device_asset.h"
 #include <Preferences.h>
+#include "../system/scoped_lock.h"
 
-// SUPPORTED TYPES: PlugAsset, PresenceSensorAsset, EnvironmentSensorAsset
+// SUPPORTED TYPES: see DEVICE_TYPES (device_types.h)
+
+// Compact index of the hot asset fields, one blob, read at boot instead of parsing every managerJson
+#define ASSET_INDEX_KEY "index"
+#define ASSET_INDEX_FORMAT_KEY "index-format"
+#define ASSET_INDEX_VERSION 1 // bump when DeviceAsset changes in a way sizeof does not catch
+
+#define ASSET_REGISTRY_VERSIONS 3 // the published version and older ones still pinned by readers
+
+/// @brief One version of the asset registry, never modified while it is published or pinned
+struct AssetVersion
+{
+    std::vector<DeviceAsset> assets;
+    uint32_t version = 0;
+    std::atomic<int> readers{0}; // snapshots pinning this version
+};
+
+/// @brief Read access to one consistent version of the asset registry
+/// The version stays valid (unchanged) until the snapshot is destroyed: writers publish new versions next to it.
+/// Keep it short lived, a writer waits for a free version if every older one is still pinned, don't hold one
+/// across a blocking call or a registry write.
+class AssetSnapshot
+{
+public:
+    AssetSnapshot(AssetVersion *pinned) : pinned(pinned) {}
+    AssetSnapshot(AssetSnapshot &&other) : pinned(other.pinned) { other.pinned = nullptr; }
+    AssetSnapshot(const AssetSnapshot &) = delete;
+    AssetSnapshot &operator=(const AssetSnapshot &) = delete;
+
+    ~AssetSnapshot()
+    {
+        if (pinned != nullptr)
+        {
+            pinned->readers--;
+        }
+    }
+
+    const std::vector<DeviceAsset> &assets() const { return pinned->assets; }
+
+    /// @brief Version number, increases with every write
+    uint32_t version() const { return pinned->version; }
+
+    /// @brief Find an asset by device serial number
+    /// @param deviceSerial
+    /// @return const DeviceAsset* (nullptr if not onboarded, valid as long as the snapshot)
+    const DeviceAsset *findBySerial(const std::string &deviceSerial) const
+    {
+        for (const DeviceAsset &asset : pinned->assets)
+        {
+            if (asset.sn == deviceSerial)
+            {
+                return &asset;
+            }
+        }
+        return nullptr;
+    }
+
+    /// @brief Find an asset by ID
+    /// @param id
+    /// @return const DeviceAsset* (nullptr if unknown, valid as long as the snapshot)
+    const DeviceAsset *findById(const std::string &id) const
+    {
+        for (const DeviceAsset &asset : pinned->assets)
+        {
+            if (asset.id == id)
+            {
+                return &asset;
+            }
+        }
+        return nullptr;
+    }
+
+private:
+    AssetVersion *pinned;
+};
 
 /// @brief Device Manager class
 /// This class is responsible for managing devices and their assets
-/// It keeps track of devices that are pending onboarding, devices that are onboarded and their assets
+/// It keeps track of devices that are onboarded and their assets (onboarding itself is tracked by OnboardingManager)
 /// It also stores the device assets in the ESP32's preferences (non-volatile memory, key-value store)
+/// Only the hot fields are kept in RAM (DeviceAsset), the managerJson of an asset stays in the preferences,
+/// under the key of its slot ("0" .. count - 1), and is read with loadManagerJson when needed.
+/// The hot fields of all assets are also stored as one binary index, so booting is a single read, independent of
+/// the size of the asset JSON. The index is rebuilt from the JSON if it is missing or from another firmware version.
+///
+/// The registry is read by the UDP task, the mqtt task and the web server, and written by the mqtt callback
+/// (loop task) and the web server. It is published as immutable versions (ASSET_REGISTRY_VERSIONS, preallocated):
+/// - readers pin the published version (snapshot()) with two atomic operations, they never block and never see
+///   a write halfway, a vector being reallocated under them or an asset half copied
+/// - writers are serialized by a mutex, copy the published version into a version no reader pins, change the
+///   copy and publish it with one atomic store (copy-on-write)
+/// Connection details are only written when they change, a device sending from the same address costs no copy.
 class AssetManager
 {
 
 public:
-    std::vector<std::string> pendingOnboarding;
-    std::vector<DeviceAsset> assets;
     Preferences &preferences;
+    uint16_t slotCount = 0; // preferences keys in use, "0" .. slotCount - 1 (a key can be empty)
 
     /// @brief Constructor
     /// @param clientId Client ID for MQTT
@@ -28,61 +115,115 @@ public:
     {
     }
 
-    /// @brief Initialize the device manager
-    void init()
+    /// @brief Initialize the device manager, loads the asset index (rebuilds it from the asset JSON if needed)
+    /// Runs before the tasks start, the first version is filled in place.
+    /// @return bool (false if the index had to be rebuilt, a slow boot)
+    bool init()
     {
+        semaphore = xSemaphoreCreateMutex();
+        std::vector<DeviceAsset> &assets = versions[0].assets;
         uint count = preferences.getUInt("count", 0);
+        slotCount = count;
 
-        if (count == 0)
+        if (count == 0 || loadIndex(assets))
         {
-            return;
+            return true;
         }
 
-        for (int i = 0; i < preferences.getUInt("count", 0); i++)
+        assets.reserve(count);
+        for (int i = 0; i < count; i++)
         {
             std::string id = std::to_string(i);
             std::string assetJson = std::string(preferences.getString(id.c_str(), "").c_str());
             if (assetJson != "")
             {
-                DeviceAsset asset = DeviceAsset::fromJson(assetJson.c_str());
-                assets.push_back(std::move(asset));
+                DeviceAsset asset = DeviceAsset::fromJson(assetJson);
+                asset.slot = i;
+                assets.push_back(asset);
             }
         }
+        saveIndex(assets);
+        return false;
     }
 
-    /// @brief Set the connection details for a device
-    void setConnection(std::string deviceSerial, IPAddress address, uint port)
+    /// @brief Allocate every version for a fleet up front, writes up to that many assets don't allocate
+    /// @param devices
+    void reserve(size_t devices)
     {
-        for (int i = 0; i < assets.size(); i++)
+        ScopedLock lock(semaphore);
+        for (int i = 0; i < ASSET_REGISTRY_VERSIONS; i++)
+        {
+            versions[i].assets.reserve(devices);
+        }
+    }
+
+    /// @brief Pin the published version of the registry, lock-free
+    /// @return AssetSnapshot
+    AssetSnapshot snapshot()
+    {
+        while (true)
         {
-            if (assets[i].sn.c_str() == deviceSerial)
+            int index = published.load();
+            versions[index].readers++;
+            if (published.load() == index)
             {
-                assets[i].address = address;
-                assets[i].port = port;
-                return;
+                return AssetSnapshot(&versions[index]);
             }
+            versions[index].readers--; // a write was published meanwhile, the version may be rewritten
         }
     }
 
-    /// @brief Add a device to the pending onboarding list
-    /// @param deviceSerial
-    void addPendingOnboarding(std::string deviceSerial)
+    /// @brief Number of onboarded assets
+    size_t size()
     {
-        pendingOnboarding.push_back(deviceSerial);
+        return snapshot().assets().size();
     }
 
-    /// @brief Remove a device from the pending onboarding list
-    void removePendingOnboarding(std::string deviceSerial)
+    /// @brief Memory of all versions
+    /// @return size_t bytes
+    size_t memoryBytes()
     {
-        pendingOnboarding.erase(std::remove(pendingOnboarding.begin(), pendingOnboarding.end(), deviceSerial), pendingOnboarding.end());
+        ScopedLock lock(semaphore); // capacities only change under the writer lock
+        size_t bytes = 0;
+        for (int i = 0; i < ASSET_REGISTRY_VERSIONS; i++)
+        {
+            bytes += versions[i].assets.capacity() * sizeof(DeviceAsset);
+        }
+        return bytes;
     }
 
-    /// @brief  Check if a device is pending onboarding
-    /// @param deviceSerial
-    /// @return bool
-    bool isOnboardingPending(std::string deviceSerial)
+    /// @brief Read the OpenRemote representation of an asset from flash
+    /// @param asset
+    /// @return std::string (empty if missing)
+    std::string loadManagerJson(const DeviceAsset &asset)
+    {
+        return std::string(preferences.getString(std::to_string(asset.slot).c_str(), "").c_str());
+    }
+
+    /// @brief Set the connection details for a device
+    void setConnection(std::string deviceSerial, IPAddress address, uint port)
     {
-        return std::find(pendingOnboarding.begin(), pendingOnboarding.end(), deviceSerial) != pendingOnboarding.end();
+        {
+            AssetSnapshot current = snapshot();
+            const DeviceAsset *asset = current.findBySerial(deviceSerial);
+            if (asset == nullptr || (asset->address == (uint32_t)address && asset->port == port))
+            {
+                return;
+            }
+        }
+
+        ScopedLock lock(semaphore);
+        AssetVersion &next = beginWrite();
+        for (DeviceAsset &asset : next.assets)
+        {
+            if (asset.sn == deviceSerial)
+            {
+                asset.address = (uint32_t)address;
+                asset.port = port;
+                publish(next);
+                return;
+            }
+        }
     }
 
     /// @brief Check if a device is onboarded with OpenRemote
@@ -90,30 +231,30 @@ public:
     /// @return bool
     bool isDeviceOnboarded(std::string deviceSerial)
     {
-        return std::any_of(assets.begin(), assets.end(), [&deviceSerial](const DeviceAsset &asset)
-                           { return asset.sn == deviceSerial; });
+        return snapshot().findBySerial(deviceSerial) != nullptr;
     }
 
     /// @brief Add a device asset to the device manager,
     /// should only be called after confirming the device has been created on OpenRemote (MQTT Callback)
-    void addDeviceAsset(DeviceAsset asset)
+    /// @param asset
+    /// @param managerJson OpenRemote representation, stored in flash only
+    void addDeviceAsset(DeviceAsset asset, const std::string &managerJson)
     {
-        for (int i = 0; i < assets.size(); i++)
+        ScopedLock lock(semaphore);
+        if (snapshot().findById(asset.id.c_str()) != nullptr)
         {
-            if (assets[i].id == asset.id)
-            {
-                return;
-            }
+            return;
         }
-        assets.push_back(asset);
-
-        // get the current count of assets
-        uint id = preferences.getUInt("count", 0);
-        // increment the count, id = count
-        preferences.putString(std::to_string(id).c_str(), asset.managerJson.c_str());
-        preferences.putUInt("count", assets.size());
 
-        uint count = preferences.getUInt("count", 0);
+        // the next free slot, slots are kept contiguous
+        AssetVersion &next = beginWrite();
+        invalidateIndex();
+        asset.slot = slotCount++;
+        preferences.putString(std::to_string(asset.slot).c_str(), managerJson.c_str());
+        next.assets.push_back(asset);
+        preferences.putUInt("count", slotCount);
+        saveIndex(next.assets);
+        publish(next);
     }
 
     /// @brief Handle an attribute event from the OpenRemote platform, updates the local device asset representation respectively
@@ -127,85 +268,153 @@ public:
     /// @param deviceSerial
     std::string getDeviceAssetId(std::string deviceSerial)
     {
-        for (int i = 0; i < assets.size(); i++)
-        {
-            if (assets[i].sn.c_str() == deviceSerial)
-            {
-                return assets[i].id;
-            }
-        }
-        return "";
+        AssetSnapshot current = snapshot();
+        const DeviceAsset *asset = current.findBySerial(deviceSerial);
+        return asset != nullptr ? std::string(asset->id) : "";
     }
 
     bool deleteDeviceAssetById(std::string assetId)
     {
+        ScopedLock lock(semaphore);
+        AssetVersion &next = beginWrite();
+        std::vector<DeviceAsset> &assets = next.assets;
         for (int i = 0; i < assets.size(); i++)
         {
-            if (assets[i].id.c_str() == assetId)
+            if (assets[i].id == assetId)
             {
+                // the asset in the last slot moves into the freed one, only two keys are rewritten
+                invalidateIndex();
+                uint16_t slot = assets[i].slot;
+                uint16_t last = slotCount - 1;
+                bool moved = false;
+                for (int j = 0; j < assets.size() && slot != last; j++)
+                {
+                    if (assets[j].slot == last)
+                    {
+                        preferences.putString(std::to_string(slot).c_str(), loadManagerJson(assets[j]).c_str());
+                        assets[j].slot = slot;
+                        moved = true;
+                    }
+                }
+                if (!moved)
+                {
+                    preferences.remove(std::to_string(slot).c_str());
+                }
+                preferences.remove(std::to_string(last).c_str());
+                slotCount--;
                 assets.erase(assets.begin() + i);
-                updatePreferences();
+                preferences.putUInt("count", slotCount);
+                saveIndex(assets);
+                publish(next);
                 return true;
             }
         }
-        return false;
-    }
-
-    /// @brief Update the preferences with the current device assets, should be called after adding, updating or removing a device asset
-    void updatePreferences()
-    {
-        uint count = preferences.getUInt("count", 0);
-        for (int i = 0; i < count; i++)
-        {
-            preferences.remove(std::to_string(i).c_str());
-        }
-        for (int i = 0; i < assets.size(); i++)
-        {
-            preferences.putString(std::to_string(i).c_str(), assets[i].managerJson.c_str());
-        }
-        preferences.putUInt("count", assets.size());
+        return false; // the copy is not published
     }
 
     /// @brief Update the device asset JSON representation
     bool updateDeviceAssetJson(std::string assetId, std::string json)
     {
-        for (int i = 0; i < assets.size(); i++)
+        ScopedLock lock(semaphore); // the slot must not move meanwhile
+        AssetSnapshot current = snapshot();
+        const DeviceAsset *asset = current.findById(assetId);
+        if (asset == nullptr)
         {
-            if (assets[i].id.c_str() == assetId)
-            {
-                assets[i].managerJson = json;
-                updatePreferences();
-                return true;
-            }
+            return false;
         }
-        return false;
+        preferences.putString(std::to_string(asset->slot).c_str(), json.c_str());
+        return true;
     }
 
     /// @brief Remove a device asset from the device manager (should only be called after confirming the device has been removed from OpenRemote)
     DeviceAsset getDeviceAsset(std::string deviceSerial)
     {
-        for (int i = 0; i < assets.size(); i++)
-        {
-            if (assets[i].sn.c_str() == deviceSerial)
-            {
-                return assets[i];
-            }
-        }
-        return DeviceAsset();
+        AssetSnapshot current = snapshot();
+        const DeviceAsset *asset = current.findBySerial(deviceSerial);
+        return asset != nullptr ? *asset : DeviceAsset();
     }
 
     /// @brief Get a device asset by ID
     /// @param id
     DeviceAsset getDeviceAssetById(std::string id)
     {
-        for (int i = 0; i < assets.size(); i++)
+        AssetSnapshot current = snapshot();
+        const DeviceAsset *asset = current.findById(id);
+        return asset != nullptr ? *asset : DeviceAsset();
+    }
+
+private:
+    AssetVersion versions[ASSET_REGISTRY_VERSIONS];
+    std::atomic<int> published{0}; // index of the published version
+    SemaphoreHandle_t semaphore = NULL; // writers
+
+    /// @brief Copy the published version into one no reader pins, the writer lock must be held
+    /// A reader that pins the free version late sees it is not published and retries, it never reads the copy.
+    /// @return AssetVersion& (publish() it, or drop it)
+    AssetVersion &beginWrite()
+    {
+        int current = published.load();
+        while (true)
         {
-            if (assets[i].id == id.c_str())
+            for (int i = 0; i < ASSET_REGISTRY_VERSIONS; i++)
             {
-                return assets[i];
+                if (i != current && versions[i].readers.load() == 0)
+                {
+                    versions[i].assets = versions[current].assets; // keeps the capacity, no allocation once reserved
+                    versions[i].version = versions[current].version + 1;
+                    return versions[i];
+                }
             }
+            vTaskDelay(1); // every older version is still pinned
+        }
+    }
+
+    /// @brief Make a written version the one readers get, the writer lock must be held
+    void publish(AssetVersion &next)
+    {
+        published.store(&next - versions);
+    }
+
+    static uint32_t indexFormat()
+    {
+        return (ASSET_INDEX_VERSION << 16) | sizeof(DeviceAsset);
+    }
+
+    /// @brief Load the hot fields of all assets from the index
+    /// @return bool (false if there is no valid index)
+    bool loadIndex(std::vector<DeviceAsset> &assets)
+    {
+        size_t length = preferences.getBytesLength(ASSET_INDEX_KEY);
+        if (preferences.getUInt(ASSET_INDEX_FORMAT_KEY, 0) != indexFormat() || length % sizeof(DeviceAsset) != 0)
+        {
+            return false;
+        }
+
+        assets.resize(length / sizeof(DeviceAsset));
+        if (length > 0 && preferences.getBytes(ASSET_INDEX_KEY, assets.data(), length) != length)
+        {
+            assets.clear();
+            return false;
         }
-        return DeviceAsset();
+        for (DeviceAsset &asset : assets)
+        {
+            asset.address = 0; // connection details are learned again
+            asset.port = 0;
+        }
+        return true;
+    }
+
+    /// @brief Mark the index stale before the slots change, a reset halfway through rebuilds it on the next boot
+    void invalidateIndex()
+    {
+        preferences.remove(ASSET_INDEX_FORMAT_KEY);
+    }
+
+    /// @brief Store the hot fields of all assets, after adding or removing one
+    void saveIndex(const std::vector<DeviceAsset> &assets)
+    {
+        preferences.putBytes(ASSET_INDEX_KEY, assets.data(), assets.size() * sizeof(DeviceAsset));
+        preferences.putUInt(ASSET_INDEX_FORMAT_KEY, indexFormat());
     }
 };
 
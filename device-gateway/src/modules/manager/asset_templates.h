@@ -1,3 +1,5 @@
+#ifndef ASSET_TEMPLATES_H
+#define ASSET_TEMPLATES_H
 
 #include <ArduinoJson.h>
 #include <vector>
@@ -21,8 +23,8 @@ struct BaseAsset
         this->name = name;
     }
 
-    // accept array of std::strings
-    std::string toJson(std::vector<std::string> extras)
+    // accept array of std::strings, derived are read-only numbers computed by the gateway (see config/transforms.json)
+    std::string toJson(std::vector<std::string> extras, std::vector<std::string> derived = {})
     {
         JsonDocument doc;
         doc["type"] = type;
@@ -37,8 +39,23 @@ struct BaseAsset
             }
         }
 
+        for (int i = 0; i < derived.size(); i++)
+        {
+            JsonObject value = attributes[derived[i]].to<JsonObject>();
+            value["type"] = "number";
+            JsonObject valueMeta = value["meta"].to<JsonObject>();
+            valueMeta["readOnly"] = true;
+        }
+
         JsonObject notes = attributes["notes"].to<JsonObject>();
         JsonObject location = attributes["location"].to<JsonObject>();
+
+        // maintained by the gateway, see DeviceLiveness
+        JsonObject connection = attributes["connectionStatus"].to<JsonObject>();
+        JsonObject connectionMeta = connection["meta"].to<JsonObject>();
+        connectionMeta["readOnly"] = true;
+        connection["type"] = "connectionStatus";
+
         JsonObject serial = attributes["sn"].to<JsonObject>();
         JsonObject serialMeta = serial["meta"].to<JsonObject>();
 
@@ -88,7 +105,8 @@ struct EnvironmentSensorAsset : BaseAsset
     std::string toJson()
     {
         std::vector<std::string> extras = {"temperature", "relativeHumidity", "NO2Level", "ozoneLevel", "particlesPM1", "particlesPM10", "particlesPM2_5"};
-        return BaseAsset::toJson(extras);
+        std::vector<std::string> derived = {"dewPoint"};
+        return BaseAsset::toJson(extras, derived);
     }
 };
 
@@ -118,8 +136,21 @@ struct AirQualitySensorAsset : BaseAsset
             }
         }
 
+        // derived by the gateway (see config/transforms.json), can be negative
+        JsonObject dewPoint = attributes["dewPoint"].to<JsonObject>();
+        dewPoint["type"] = "number";
+        JsonObject dewPointMeta = dewPoint["meta"].to<JsonObject>();
+        dewPointMeta["readOnly"] = true;
+
         JsonObject notes = attributes["notes"].to<JsonObject>();
         JsonObject location = attributes["location"].to<JsonObject>();
+
+        // maintained by the gateway, see DeviceLiveness
+        JsonObject connection = attributes["connectionStatus"].to<JsonObject>();
+        JsonObject connectionMeta = connection["meta"].to<JsonObject>();
+        connectionMeta["readOnly"] = true;
+        connection["type"] = "connectionStatus";
+
         JsonObject serial = attributes["sn"].to<JsonObject>();
         JsonObject serialMeta = serial["meta"].to<JsonObject>();
 
@@ -133,3 +164,5 @@ struct AirQualitySensorAsset : BaseAsset
         return output;
     }
 };
+
+#endif
@@ -0,0 +1,312 @@
+#ifndef ATTRIBUTE_HISTORY_H
+#define ATTRIBUTE_HISTORY_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "time_series.h"
+#include "../system/scoped_lock.h"
+
+#define HISTORY_POOL_BLOCKS 128 // compressed blocks shared by all series, 128 * 268 B ~ 34 KB
+#define HISTORY_MAX_SERIES 48  // asset attributes with history, others are not recorded
+#define HISTORY_MAX_POINTS 200 // per query response, the step is raised to stay below
+
+/// @brief Recent values of one asset attribute, blocks oldest first (the last one is being written)
+struct HistorySeries
+{
+    std::string assetId;
+    std::string attribute;
+    std::vector<uint16_t> blocks; // pool indexes
+    TimeSeriesEncoder encoder;
+};
+
+/// @brief In-RAM recent history of numeric attribute values, for the local UI and troubleshooting without OpenRemote
+/// Every series is a list of compressed TimeSeriesBlocks (delta-of-delta timestamps, XOR floats), rounded sensor
+/// values reported every 30s take 1-4 bytes per sample, 3-12 KB per attribute and day (bench/history_bench.cpp).
+/// Blocks come from a shared pool, allocated once. When the pool is empty the series with the most blocks
+/// gives up its oldest block, so every series keeps roughly the same share of the memory.
+/// Timestamps are gateway uptime seconds, the gateway has no wall clock.
+/// Written by the UDP task, read by the web server, all methods are guarded by a mutex.
+class AttributeHistory
+{
+public:
+    SemaphoreHandle_t semaphore = NULL;
+
+    /// @brief Initialize the history and allocate the block pool, must be called before use
+    void init()
+    {
+        semaphore = xSemaphoreCreateMutex();
+        pool = new TimeSeriesBlock[HISTORY_POOL_BLOCKS];
+        for (int i = HISTORY_POOL_BLOCKS - 1; i >= 0; i--)
+        {
+            freeBlocks.push_back(i);
+        }
+        series.reserve(HISTORY_MAX_SERIES);
+    }
+
+    /// @brief Record the numeric values of an attribute update, other values are skipped
+    /// @param assetId
+    /// @param attributes Attribute name -> value (number, bool or numeric string)
+    /// @param time Uptime (s)
+    void record(const std::string &assetId, JsonDocument &attributes, uint32_t time)
+    {
+        ScopedLock lock(semaphore);
+        for (JsonPair attribute : attributes.as<JsonObject>())
+        {
+            float value;
+            if (!numericValue(attribute.value(), value))
+            {
+                continue;
+            }
+            HistorySeries *entry = findOrCreate(assetId, attribute.key().c_str());
+            if (entry != nullptr)
+            {
+                append(*entry, time, value);
+            }
+        }
+    }
+
+    /// @brief Drop the history of an asset (deleted)
+    /// @param assetId
+    void remove(const std::string &assetId)
+    {
+        ScopedLock lock(semaphore);
+        for (size_t i = 0; i < series.size();)
+        {
+            if (series[i].assetId == assetId)
+            {
+                freeBlocks.insert(freeBlocks.end(), series[i].blocks.begin(), series[i].blocks.end());
+                series.erase(series.begin() + i);
+            }
+            else
+            {
+                i++;
+            }
+        }
+    }
+
+    /// @brief Attributes with history of an asset
+    /// @param assetId
+    /// @param out Output array, one object per attribute
+    void list(const std::string &assetId, JsonArray out)
+    {
+        ScopedLock lock(semaphore);
+        for (const HistorySeries &entry : series)
+        {
+            if (entry.assetId != assetId || entry.blocks.empty())
+            {
+                continue;
+            }
+            uint32_t samples = 0;
+            for (uint16_t block : entry.blocks)
+            {
+                samples += pool[block].count;
+            }
+            JsonObject item = out.add<JsonObject>();
+            item["attr"] = entry.attribute;
+            item["samples"] = samples;
+            item["bytes"] = entry.blocks.size() * sizeof(TimeSeriesBlock);
+            item["from"] = pool[entry.blocks.front()].start;
+            item["to"] = pool[entry.blocks.back()].end;
+        }
+    }
+
+    /// @brief Values of an attribute since a point in time, downsampled to one point per step
+    /// Raw points are [time, value], downsampled points [bucket start, mean, min, max].
+    /// The step is raised if there would be more than HISTORY_MAX_POINTS points.
+    /// @param assetId
+    /// @param attribute
+    /// @param from Uptime (s), older samples are skipped
+    /// @param step Bucket size (s), 0 for raw samples
+    /// @param out Output object: step, points
+    /// @return bool (false if the attribute has no history)
+    bool query(const std::string &assetId, const std::string &attribute, uint32_t from, uint32_t step, JsonObject out)
+    {
+        ScopedLock lock(semaphore);
+        HistorySeries *entry = find(assetId, attribute);
+        if (entry == nullptr || entry->blocks.empty())
+        {
+            return false;
+        }
+
+        // first block with samples since from, and the number of samples to return
+        size_t first = 0;
+        while (first + 1 < entry->blocks.size() && pool[entry->blocks[first]].end < from)
+        {
+            first++;
+        }
+        uint32_t start = max(from, pool[entry->blocks[first]].start);
+        uint32_t end = pool[entry->blocks.back()].end;
+        uint32_t samples = 0;
+        for (size_t i = first; i < entry->blocks.size(); i++)
+        {
+            samples += pool[entry->blocks[i]].count;
+        }
+        if ((step == 0 && samples > HISTORY_MAX_POINTS) || (step > 0 && end >= start && (end - start) / step >= HISTORY_MAX_POINTS))
+        {
+            step = (end - start) / HISTORY_MAX_POINTS + 1;
+        }
+
+        out["step"] = step;
+        JsonArray points = out["points"].to<JsonArray>();
+        uint32_t bucket = 0;
+        float sum = 0, low = 0, high = 0;
+        uint16_t count = 0;
+        for (size_t i = first; i < entry->blocks.size(); i++)
+        {
+            TimeSeriesDecoder decoder(pool[entry->blocks[i]]);
+            uint32_t time;
+            float value;
+            while (decoder.next(time, value))
+            {
+                if (time < from)
+                {
+                    continue;
+                }
+                if (step == 0)
+                {
+                    JsonArray point = points.add<JsonArray>();
+                    point.add(time);
+                    point.add(value);
+                    continue;
+                }
+                if (count > 0 && time - time % step != bucket)
+                {
+                    addBucket(points, bucket, sum / count, low, high);
+                    count = 0;
+                }
+                if (count == 0)
+                {
+                    bucket = time - time % step;
+                    sum = 0;
+                    low = high = value;
+                }
+                sum += value;
+                low = min(low, value);
+                high = max(high, value);
+                count++;
+            }
+        }
+        if (count > 0)
+        {
+            addBucket(points, bucket, sum / count, low, high);
+        }
+        return true;
+    }
+
+private:
+    TimeSeriesBlock *pool = nullptr;
+    std::vector<uint16_t> freeBlocks;
+    std::vector<HistorySeries> series;
+
+    static bool numericValue(JsonVariant variant, float &value)
+    {
+        if (variant.is<bool>())
+        {
+            value = variant.as<bool>() ? 1 : 0;
+            return true;
+        }
+        if (variant.is<float>())
+        {
+            value = variant.as<float>();
+            return true;
+        }
+        const char *text = variant.as<const char *>();
+        if (text == nullptr || *text == '\0')
+        {
+            return false;
+        }
+        if (strcmp(text, "true") == 0 || strcmp(text, "false") == 0)
+        {
+            value = text[0] == 't' ? 1 : 0;
+            return true;
+        }
+        char *end;
+        value = strtof(text, &end);
+        return *end == '\0' && !isnan(value);
+    }
+
+    static void addBucket(JsonArray points, uint32_t bucket, float mean, float low, float high)
+    {
+        JsonArray point = points.add<JsonArray>();
+        point.add(bucket);
+        point.add(mean);
+        point.add(low);
+        point.add(high);
+    }
+
+    HistorySeries *find(const std::string &assetId, const std::string &attribute)
+    {
+        for (HistorySeries &entry : series)
+        {
+            if (entry.assetId == assetId && entry.attribute == attribute)
+            {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    HistorySeries *findOrCreate(const std::string &assetId, const char *attribute)
+    {
+        HistorySeries *entry = find(assetId, attribute);
+        if (entry != nullptr || series.size() >= HISTORY_MAX_SERIES)
+        {
+            return entry;
+        }
+        series.push_back(HistorySeries());
+        series.back().assetId = assetId;
+        series.back().attribute = attribute;
+        return &series.back();
+    }
+
+    void append(HistorySeries &entry, uint32_t time, float value)
+    {
+        if (!entry.blocks.empty())
+        {
+            time = max(time, pool[entry.blocks.back()].end); // late readings are recorded as the latest
+            if (entry.encoder.append(time, value))
+            {
+                return;
+            }
+        }
+
+        int block = allocate();
+        if (block < 0)
+        {
+            return;
+        }
+        entry.blocks.push_back(block);
+        entry.encoder.begin(&pool[block], time, value);
+    }
+
+    /// @brief Take a block from the pool, evicts the oldest block of the largest series if it is empty
+    int allocate()
+    {
+        if (freeBlocks.empty())
+        {
+            HistorySeries *largest = nullptr;
+            for (HistorySeries &entry : series)
+            {
+                if (largest == nullptr || entry.blocks.size() > largest->blocks.size())
+                {
+                    largest = &entry;
+                }
+            }
+            // a series keeps the block it is writing
+            if (largest == nullptr || largest->blocks.size() < 2)
+            {
+                return -1;
+            }
+            freeBlocks.push_back(largest->blocks.front());
+            largest->blocks.erase(largest->blocks.begin());
+        }
+        int block = freeBlocks.back();
+        freeBlocks.pop_back();
+        return block;
+    }
+};
+
+#endif
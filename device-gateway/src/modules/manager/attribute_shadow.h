@@ -0,0 +1,299 @@
+#ifndef ATTRIBUTE_SHADOW_H
+#define ATTRIBUTE_SHADOW_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "../system/scoped_lock.h"
+
+#define SHADOW_MAX_ATTRIBUTES 16 // per asset, further attributes are published every time but not shadowed
+#define SHADOW_MAX_VALUE 64      // serialized value length, longer values are published every time but not shadowed
+
+/// @brief Shadowed state of one asset attribute, values are serialized JSON (empty: none yet)
+struct ShadowAttribute
+{
+    std::string name;
+    std::string reported;  // last value the device sent
+    std::string published; // last value handed to OpenRemote
+    std::string desired;   // last value OpenRemote asked for (control events)
+    unsigned long reportedAt = 0;
+    unsigned long publishedAt = 0;
+    unsigned long desiredAt = 0;
+};
+
+/// @brief Counters of the shadow
+struct ShadowStats
+{
+    uint32_t reported = 0;  // attribute values reported by devices
+    uint32_t unchanged = 0; // not published, equal to the last published value
+    uint32_t resynced = 0;  // published after a reconnect, reported while they couldn't be
+};
+
+/// @brief Last reported, published and desired value of every asset attribute
+/// - report() keeps the values a device sent and returns only those that differ from the last published ones,
+///   a sensor repeating its reading costs no publish
+/// - markPublished() once the values are handed to the mqtt client: whatever is reported but not published
+///   (offline, window full) is a pending diff, pushed after the next connect (pendingAssets(), pending()).
+///   QoS 1 retransmits what is in flight, markDropped() takes back what the window gives up.
+/// - desired values come from control events, the state of an actuator is answered locally (toJson()); OpenRemote
+///   holds the desired value after a control event, it counts as published
+/// Kept in RAM only, empty after a restart (the first report of every attribute is published).
+/// Written by the UDP task and the loop task (control events), read by the mqtt task and the web server, guarded by a mutex.
+class AttributeShadow
+{
+public:
+    /// @brief Initialize the shadow, must be called before use
+    void init()
+    {
+        semaphore = xSemaphoreCreateMutex();
+    }
+
+    /// @brief Record reported values
+    /// @param assetId
+    /// @param attributes Attribute name -> value
+    /// @param changed Output, the attributes to publish (changed, never published or not shadowed)
+    /// @param now millis()
+    /// @return int number of attributes to publish
+    int report(const std::string &assetId, JsonDocument &attributes, JsonDocument &changed, unsigned long now)
+    {
+        ScopedLock lock(semaphore);
+        for (JsonPair attribute : attributes.as<JsonObject>())
+        {
+            std::string value;
+            serializeJson(attribute.value(), value);
+            ShadowAttribute *entry = value.length() <= SHADOW_MAX_VALUE ? findOrCreate(assetId, attribute.key().c_str()) : nullptr;
+            stats.reported++;
+            if (entry == nullptr)
+            {
+                changed[attribute.key().c_str()] = attribute.value();
+                continue;
+            }
+            entry->reported = value;
+            entry->reportedAt = now;
+            if (entry->published == value)
+            {
+                stats.unchanged++;
+                continue;
+            }
+            changed[attribute.key().c_str()] = attribute.value();
+        }
+        return changed.size();
+    }
+
+    /// @brief Values were handed to the mqtt client
+    /// @param assetId
+    /// @param attributes Attribute name -> value, as published
+    /// @param now millis()
+    void markPublished(const std::string &assetId, JsonDocument &attributes, unsigned long now)
+    {
+        ScopedLock lock(semaphore);
+        for (JsonPair attribute : attributes.as<JsonObject>())
+        {
+            ShadowAttribute *entry = find(assetId, attribute.key().c_str());
+            if (entry != nullptr)
+            {
+                entry->published.clear();
+                serializeJson(attribute.value(), entry->published);
+                entry->publishedAt = now;
+            }
+        }
+    }
+
+    /// @brief Values handed to the mqtt client never reached OpenRemote (given up by the QoS 1 window)
+    /// Attributes still published with the dropped value are pending again, pushed after the next connect.
+    /// @param assetId
+    /// @param attributes Attribute name -> value, as dropped
+    void markDropped(const std::string &assetId, JsonDocument &attributes)
+    {
+        ScopedLock lock(semaphore);
+        for (JsonPair attribute : attributes.as<JsonObject>())
+        {
+            ShadowAttribute *entry = find(assetId, attribute.key().c_str());
+            std::string value;
+            serializeJson(attribute.value(), value);
+            if (entry != nullptr && entry->published != "" && unquoted(entry->published) == unquoted(value))
+            {
+                entry->published.clear(); // a newer value published since stays
+            }
+        }
+    }
+
+    /// @brief Record a value OpenRemote asked for, it is OpenRemote's current value from now on (published)
+    /// A device that keeps reporting something else (command lost, ignored) differs from it and gets published.
+    /// @param assetId
+    /// @param attribute
+    /// @param value Serialized JSON
+    /// @param now millis()
+    void desire(const std::string &assetId, const std::string &attribute, const std::string &value, unsigned long now)
+    {
+        ScopedLock lock(semaphore);
+        ShadowAttribute *entry = value.length() <= SHADOW_MAX_VALUE ? findOrCreate(assetId, attribute) : nullptr;
+        if (entry != nullptr)
+        {
+            entry->desired = value;
+            entry->desiredAt = now;
+            entry->published = value;
+            entry->publishedAt = now;
+        }
+    }
+
+    /// @brief Check if the device last reported a value, string and plain JSON values compare equal ("true" / true)
+    /// @param assetId
+    /// @param attribute
+    /// @param value Serialized JSON
+    /// @return bool
+    bool isReported(const std::string &assetId, const std::string &attribute, const std::string &value)
+    {
+        ScopedLock lock(semaphore);
+        ShadowAttribute *entry = find(assetId, attribute);
+        return entry != nullptr && entry->reported != "" && unquoted(entry->reported) == unquoted(value);
+    }
+
+    /// @brief Assets with values reported but not published
+    std::vector<std::string> pendingAssets()
+    {
+        ScopedLock lock(semaphore);
+        std::vector<std::string> pending;
+        for (auto &asset : assets)
+        {
+            for (const ShadowAttribute &entry : asset.second)
+            {
+                if (entry.reported != "" && entry.reported != entry.published)
+                {
+                    pending.push_back(asset.first);
+                    break;
+                }
+            }
+        }
+        return pending;
+    }
+
+    /// @brief Values of an asset reported but not published (the diff to push after a reconnect)
+    /// @param assetId
+    /// @param out Output, attribute name -> reported value
+    /// @return int number of attributes
+    int pending(const std::string &assetId, JsonDocument &out)
+    {
+        ScopedLock lock(semaphore);
+        auto it = assets.find(assetId);
+        if (it == assets.end())
+        {
+            return 0;
+        }
+        // the stored values are JSON already, parsed once as an object (into the memory of out)
+        std::string diff = "{";
+        for (const ShadowAttribute &entry : it->second)
+        {
+            if (entry.reported != "" && entry.reported != entry.published)
+            {
+                diff += (diff.length() > 1 ? ",\"" : "\"") + entry.name + "\":" + entry.reported;
+                stats.resynced++;
+            }
+        }
+        diff += "}";
+        deserializeJson(out, diff);
+        return out.size();
+    }
+
+    /// @brief Shadow of an asset
+    /// @param assetId
+    /// @param out Output object: {attribute: {reported, published, desired, reportedAge, publishedAge, desiredAge, inSync}}, ages in s
+    /// @param now millis()
+    /// @return bool (false if nothing is shadowed for the asset)
+    bool toJson(const std::string &assetId, JsonObject out, unsigned long now)
+    {
+        ScopedLock lock(semaphore);
+        auto it = assets.find(assetId);
+        if (it == assets.end())
+        {
+            return false;
+        }
+        for (const ShadowAttribute &entry : it->second)
+        {
+            JsonObject item = out[entry.name].to<JsonObject>();
+            setValue(item, "reported", entry.reported, entry.reportedAt, now);
+            setValue(item, "published", entry.published, entry.publishedAt, now);
+            setValue(item, "desired", entry.desired, entry.desiredAt, now);
+            if (entry.desired != "")
+            {
+                item["inSync"] = entry.reported != "" && unquoted(entry.reported) == unquoted(entry.desired);
+            }
+        }
+        return true;
+    }
+
+    /// @brief Drop the shadow of an asset (deleted)
+    /// @param assetId
+    void remove(const std::string &assetId)
+    {
+        ScopedLock lock(semaphore);
+        assets.erase(assetId);
+    }
+
+    /// @brief Copy of the counters
+    ShadowStats getStats()
+    {
+        ScopedLock lock(semaphore);
+        return stats;
+    }
+
+private:
+    SemaphoreHandle_t semaphore = NULL;
+    std::unordered_map<std::string, std::vector<ShadowAttribute>> assets;
+    ShadowStats stats;
+
+    ShadowAttribute *find(const std::string &assetId, const std::string &attribute)
+    {
+        auto it = assets.find(assetId);
+        if (it == assets.end())
+        {
+            return nullptr;
+        }
+        for (ShadowAttribute &entry : it->second)
+        {
+            if (entry.name == attribute)
+            {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    /// @brief The entry of an attribute, nullptr if the asset already shadows SHADOW_MAX_ATTRIBUTES others
+    ShadowAttribute *findOrCreate(const std::string &assetId, const std::string &attribute)
+    {
+        ShadowAttribute *entry = find(assetId, attribute);
+        if (entry != nullptr)
+        {
+            return entry;
+        }
+        std::vector<ShadowAttribute> &attributes = assets[assetId];
+        if (attributes.size() >= SHADOW_MAX_ATTRIBUTES)
+        {
+            return nullptr;
+        }
+        attributes.emplace_back();
+        attributes.back().name = attribute;
+        return &attributes.back();
+    }
+
+    static std::string unquoted(const std::string &value)
+    {
+        bool quoted = value.length() >= 2 && value.front() == '"' && value.back() == '"';
+        return quoted ? value.substr(1, value.length() - 2) : value;
+    }
+
+    static void setValue(JsonObject item, const char *key, const std::string &value, unsigned long at, unsigned long now)
+    {
+        if (value == "")
+        {
+            return;
+        }
+        item[key] = serialized(value);
+        item[std::string(key) + "Age"] = (now - at) / 1000;
+    }
+};
+
+#endif // ATTRIBUTE_SHADOW_H
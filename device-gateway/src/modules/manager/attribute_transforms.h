@@ -0,0 +1,186 @@
+#ifndef ATTRIBUTE_TRANSFORMS_H
+#define ATTRIBUTE_TRANSFORMS_H
+
+#include <string>
+#include <ArduinoJson.h>
+#include <FS.h>
+#include "device_types.h"
+#include "transform_program.h"
+
+#define ATTRIBUTE_TRANSFORMS_FILE "/transforms.json"
+
+/// @brief Per device type attribute transforms, loaded from the file system (config/transforms.json)
+///
+/// The spec maps a device type to its attributes, every attribute has a source and optional steps:
+///   "AirQualitySensorAsset": {
+///     "gasResistance": {"from": "gas", "decimals": 1},
+///     "dewPoint": {"dewPoint": ["temperature", "humidity"], "decimals": 1}
+///   }
+/// Sources: "from" (payload field) or "dewPoint" ([temperature field, humidity field]).
+/// Steps, applied in this order: "scale", "offset", "min", "max", "decimals".
+///
+/// The spec is compiled to a TransformProgram per device type when it is loaded, packets only run the program.
+/// Device types without a spec keep the plain field mapping of DEVICE_TYPES.
+class AttributeTransforms
+{
+public:
+    TransformProgram programs[DEVICE_TYPE_COUNT];
+
+    /// @brief Load and compile the transform spec
+    /// @param fs
+    /// @return int number of device types with transforms (0 if the spec is missing or invalid)
+    int load(fs::FS &fs)
+    {
+        File file = fs.open(ATTRIBUTE_TRANSFORMS_FILE, "r");
+        if (!file)
+        {
+            return 0;
+        }
+
+        JsonDocument doc;
+        DeserializationError error = deserializeJson(doc, file);
+        file.close();
+        if (error)
+        {
+            Serial.print("! Invalid transform spec: ");
+            Serial.println(error.c_str());
+            return 0;
+        }
+
+        int loaded = 0;
+        for (JsonPair type : doc.as<JsonObject>())
+        {
+            uint8_t typeId = DeviceTypes::intern(type.key().c_str());
+            if (typeId == DEVICE_TYPE_UNKNOWN)
+            {
+                Serial.print("! Transform spec for unknown device type: ");
+                Serial.println(type.key().c_str());
+                continue;
+            }
+
+            TransformProgram &program = programs[typeId];
+            program.clear();
+            for (JsonPair attribute : type.value().as<JsonObject>())
+            {
+                if (!compile(program, attribute.key().c_str(), attribute.value().as<JsonObject>()))
+                {
+                    Serial.print("! Invalid transform: ");
+                    Serial.print(type.key().c_str());
+                    Serial.print(".");
+                    Serial.println(attribute.key().c_str());
+                    program.clear(); // all or nothing, a partial program would drop attributes silently
+                    break;
+                }
+            }
+            if (!program.empty())
+            {
+                loaded++;
+            }
+        }
+        return loaded;
+    }
+
+    /// @brief Check if a device type has transforms
+    /// @param typeId
+    bool has(uint8_t typeId) const
+    {
+        return typeId < DEVICE_TYPE_COUNT && !programs[typeId].empty();
+    }
+
+    /// @brief Run the transforms of a device type on a payload
+    /// @param typeId
+    /// @param payload Parsed device payload
+    /// @param attributes Output, the transformed attribute values (attributes with missing inputs are left out)
+    /// @return int number of attributes written
+    int apply(uint8_t typeId, const JsonDocument &payload, JsonDocument &attributes) const
+    {
+        if (!has(typeId))
+        {
+            return 0;
+        }
+
+        const TransformProgram &program = programs[typeId];
+        float in[TRANSFORM_MAX_INPUTS];
+        float out[TRANSFORM_MAX_OUTPUTS];
+        for (uint8_t i = 0; i < program.inputCount; i++)
+        {
+            JsonVariantConst value = payload[program.inputs[i]];
+            if (value.is<float>())
+            {
+                in[i] = value.as<float>();
+            }
+            else if (value.is<const char *>())
+            {
+                in[i] = strtof(value.as<const char *>(), NULL); // older firmware sends numbers as strings
+            }
+            else
+            {
+                in[i] = NAN;
+            }
+        }
+
+        program.evaluate(in, out);
+
+        int written = 0;
+        for (uint8_t i = 0; i < program.outputCount; i++)
+        {
+            if (!isnan(out[i]))
+            {
+                attributes[program.outputs[i]] = out[i];
+                written++;
+            }
+        }
+        return written;
+    }
+
+private:
+    /// @brief Compile the transform of a single attribute
+    /// @return bool (false if the spec is invalid or a program limit is reached)
+    static bool compile(TransformProgram &program, const char *attribute, JsonObject spec)
+    {
+        bool ok;
+        if (spec["from"].is<const char *>())
+        {
+            int field = program.input(spec["from"].as<const char *>());
+            ok = field >= 0 && program.emit(TRANSFORM_OP_LOAD, field);
+        }
+        else if (spec["dewPoint"].is<JsonArray>() && spec["dewPoint"].size() == 2)
+        {
+            int temperature = program.input(spec["dewPoint"][0].as<const char *>());
+            int humidity = program.input(spec["dewPoint"][1].as<const char *>());
+            ok = temperature >= 0 && humidity >= 0 &&
+                 program.emit(TRANSFORM_OP_LOAD, temperature) &&
+                 program.emit(TRANSFORM_OP_DEW_POINT, humidity);
+        }
+        else
+        {
+            return false; // no source
+        }
+
+        if (ok && spec["scale"].is<float>())
+        {
+            ok = program.emit(TRANSFORM_OP_SCALE, 0, spec["scale"].as<float>());
+        }
+        if (ok && spec["offset"].is<float>())
+        {
+            ok = program.emit(TRANSFORM_OP_OFFSET, 0, spec["offset"].as<float>());
+        }
+        if (ok && spec["min"].is<float>())
+        {
+            ok = program.emit(TRANSFORM_OP_CLAMP_LOW, 0, spec["min"].as<float>());
+        }
+        if (ok && spec["max"].is<float>())
+        {
+            ok = program.emit(TRANSFORM_OP_CLAMP_HIGH, 0, spec["max"].as<float>());
+        }
+        if (ok && spec["decimals"].is<int>())
+        {
+            ok = program.emit(TRANSFORM_OP_ROUND, 0, powf(10, spec["decimals"].as<int>()));
+        }
+
+        int output = ok ? program.output(attribute) : -1;
+        return output >= 0 && program.emit(TRANSFORM_OP_STORE, output);
+    }
+};
+
+#endif
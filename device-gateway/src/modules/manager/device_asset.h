@@ -1,32 +1,79 @@
+#ifndef DEVICE_ASSET_H
+#define DEVICE_ASSET_H
+
+#include <string>
+#include <string.h>
 #include <ArduinoJson.h>
+#include "device_types.h"
 
-struct DeviceAsset
+#define ASSET_ID_LENGTH 22     // OpenRemote asset ids (base62 UUID)
+#define ASSET_SN_MAX_LENGTH 23 // longest device serial that can be onboarded
+
+/// @brief Fixed size, null terminated string stored inline (no heap allocation)
+/// Converts to std::string where one is needed, compares with std::string and C strings.
+template <size_t N>
+struct InlineString
 {
-    std::string id;
-    std::string sn;
-    std::string type;
+    char value[N + 1];
+
+    InlineString() { value[0] = '\0'; }
+    InlineString(const char *text) { assign(text); }
+    InlineString(const std::string &text) { assign(text.c_str()); }
+
+    void assign(const char *text)
+    {
+        strncpy(value, text, N);
+        value[N] = '\0';
+    }
+
+    const char *c_str() const { return value; }
+    bool empty() const { return value[0] == '\0'; }
+    operator std::string() const { return std::string(value); }
 
-    // openremote manager representation (we are the source of truth for this data, so we store the json representation here)
-    std::string managerJson;
+    bool operator==(const char *other) const { return strcmp(value, other) == 0; }
+    bool operator==(const std::string &other) const { return other == value; }
+    bool operator==(const InlineString &other) const { return strcmp(value, other.value) == 0; }
+    bool operator!=(const char *other) const { return !(*this == other); }
+};
+
+/// @brief Onboarded device, hot fields only (~56 bytes, no heap)
+/// The OpenRemote representation (managerJson) is cold: it stays in flash (Preferences) and is loaded by
+/// AssetManager::loadManagerJson when the web interface or a resync needs it.
+struct DeviceAsset
+{
+    InlineString<ASSET_ID_LENGTH> id;
+    InlineString<ASSET_SN_MAX_LENGTH> sn;
+    uint8_t typeId = DEVICE_TYPE_UNKNOWN; // interned type, see DeviceTypes
+    uint16_t slot = 0;                    // Preferences key of the managerJson
 
     // optional ones
-    IPAddress address = IPAddress();
-    uint port = 0;
+    uint16_t port = 0;
+    uint32_t address = 0; // IPv4
+
+    /// @brief Device type name, empty if the type is not supported
+    const char *type() const
+    {
+        const DeviceType *deviceType = DeviceTypes::get(typeId);
+        return deviceType != nullptr ? deviceType->name : "";
+    }
 
     std::string toString()
     {
-        return "id: " + id + ", sn: " + sn + ", type: " + type;
+        return "id: " + std::string(id) + ", sn: " + std::string(sn) + ", type: " + type();
     }
 
-    static DeviceAsset fromJson(std::string json)
+    /// @brief Hot fields of an OpenRemote asset
+    /// @param json managerJson, not kept
+    static DeviceAsset fromJson(const std::string &json)
     {
         JsonDocument doc;
         deserializeJson(doc, json);
         DeviceAsset asset;
-        asset.id = doc["id"].as<std::string>();
-        asset.type = doc["type"].as<std::string>();
-        asset.sn = doc["attributes"]["sn"]["value"].as<std::string>();
-        asset.managerJson = json;
+        asset.id = doc["id"] | "";
+        asset.typeId = DeviceTypes::intern(doc["type"] | "");
+        asset.sn = doc["attributes"]["sn"]["value"] | "";
         return asset;
     }
-};
\ No newline at end of file
+};
+
+#endif
@@ -0,0 +1,240 @@
+#ifndef DEVICE_LIVENESS_H
+#define DEVICE_LIVENESS_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+
+#define LIVENESS_WHEEL_SLOTS 64     // wheel size, timeouts longer than a revolution use rounds
+#define LIVENESS_TICK_MS 1000       // wheel resolution
+#define LIVENESS_TIMEOUT_MS 360000  // silence before a device is considered offline, until its uplink period is known (3x a climate batch)
+#define LIVENESS_PERIODS 3          // timeout in uplink periods, once the period is known
+#define LIVENESS_MIN_TIMEOUT_MS 60000
+#define LIVENESS_MAX_TIMEOUT_MS 3600000
+
+/// @brief Liveness state of a single device, linked into one wheel slot
+struct LivenessEntry
+{
+    std::string sn;
+    unsigned long lastSeen = 0;
+    unsigned long period = 0; // observed uplink period (ms, smoothed), 0 until the second packet
+    unsigned int rounds = 0; // remaining wheel revolutions before the timeout fires
+    bool online = false;
+    bool used = false;
+    int slot = -1; // wheel slot, -1 if not scheduled
+    int prev = -1;
+    int next = -1;
+};
+
+/// @brief Tracks when devices were last seen, using a hashed timer wheel for the timeouts
+/// - touch() (every packet) reschedules the device's timeout in O(1)
+/// - advance() (periodically) only visits the slot of the current tick, there is no scan over all devices
+/// - the callback fires when a device goes silent for LIVENESS_PERIODS of its own uplink period, and again when it
+///   comes back. The period is learned per device (batching and the configurable interval vary it), a single lost
+///   uplink doesn't flip a device offline.
+/// Not thread safe, touch(), advance() and remove() are called from the UDP task only.
+class DeviceLiveness
+{
+public:
+    typedef std::function<void(const std::string &deviceSerial, bool online)> StateCallback;
+
+    /// @brief Constructor
+    /// @param callback Called on online/offline transitions
+    DeviceLiveness(StateCallback callback) : callback(callback)
+    {
+        for (int i = 0; i < LIVENESS_WHEEL_SLOTS; i++)
+        {
+            wheel[i] = -1;
+        }
+    }
+
+    /// @brief Allocate the entries of a fleet up front, tracking up to that many devices doesn't allocate
+    /// @param devices
+    void reserve(size_t devices)
+    {
+        entries.reserve(devices);
+        freeEntries.reserve(devices);
+        index.reserve(devices);
+    }
+
+    /// @brief Record a packet from a device, (re)starts its timeout
+    /// @param deviceSerial
+    /// @param now millis()
+    void touch(const std::string &deviceSerial, unsigned long now)
+    {
+        int index = findOrCreate(deviceSerial);
+        LivenessEntry &entry = entries[index];
+        if (entry.online)
+        {
+            // gaps while offline are outages, not the period; a late uplink only moves the average by a quarter
+            unsigned long gap = now - entry.lastSeen;
+            entry.period = entry.period == 0 ? gap : (3 * entry.period + gap) / 4;
+        }
+        entry.lastSeen = now;
+
+        unlink(index);
+        schedule(index);
+
+        if (!entry.online)
+        {
+            entry.online = true;
+            callback(entry.sn, true);
+        }
+    }
+
+    /// @brief Advance the wheel to now, firing the timeouts of every tick passed
+    /// @param now millis()
+    void advance(unsigned long now)
+    {
+        while (now - lastTickMillis >= LIVENESS_TICK_MS)
+        {
+            lastTickMillis += LIVENESS_TICK_MS;
+            currentTick++;
+            expireSlot(currentTick % LIVENESS_WHEEL_SLOTS);
+        }
+    }
+
+    /// @brief Check if a device is online (seen within the timeout)
+    /// @param deviceSerial
+    /// @return bool
+    bool isOnline(const std::string &deviceSerial)
+    {
+        auto it = index.find(deviceSerial);
+        return it != index.end() && entries[it->second].online;
+    }
+
+    /// @brief Get the time a device was last seen
+    /// @param deviceSerial
+    /// @return unsigned long (millis(), 0 if never seen)
+    unsigned long getLastSeen(const std::string &deviceSerial)
+    {
+        auto it = index.find(deviceSerial);
+        return it != index.end() ? entries[it->second].lastSeen : 0;
+    }
+
+    /// @brief Stop tracking a device (e.g. deleted), no callback is fired
+    /// @param deviceSerial
+    void remove(const std::string &deviceSerial)
+    {
+        auto it = index.find(deviceSerial);
+        if (it == index.end())
+        {
+            return;
+        }
+        int entryIndex = it->second;
+        unlink(entryIndex);
+        entries[entryIndex] = LivenessEntry();
+        freeEntries.push_back(entryIndex);
+        index.erase(it);
+    }
+
+private:
+    StateCallback callback;
+    std::vector<LivenessEntry> entries;
+    std::vector<int> freeEntries;
+    std::unordered_map<std::string, int> index;
+    int wheel[LIVENESS_WHEEL_SLOTS]; // head entry per slot, -1 if empty
+    unsigned long currentTick = 0;
+    unsigned long lastTickMillis = 0;
+
+    int findOrCreate(const std::string &deviceSerial)
+    {
+        auto it = index.find(deviceSerial);
+        if (it != index.end())
+        {
+            return it->second;
+        }
+
+        int entryIndex;
+        if (!freeEntries.empty())
+        {
+            entryIndex = freeEntries.back();
+            freeEntries.pop_back();
+        }
+        else
+        {
+            entryIndex = entries.size();
+            entries.push_back(LivenessEntry());
+        }
+        entries[entryIndex].sn = deviceSerial;
+        entries[entryIndex].used = true;
+        index[deviceSerial] = entryIndex;
+        return entryIndex;
+    }
+
+    /// @brief Timeout of a device, LIVENESS_PERIODS of its uplink period (LIVENESS_TIMEOUT_MS while unknown)
+    static unsigned long timeoutOf(const LivenessEntry &entry)
+    {
+        if (entry.period == 0)
+        {
+            return LIVENESS_TIMEOUT_MS;
+        }
+        unsigned long timeout = LIVENESS_PERIODS * entry.period;
+        return timeout < LIVENESS_MIN_TIMEOUT_MS ? LIVENESS_MIN_TIMEOUT_MS : (timeout > LIVENESS_MAX_TIMEOUT_MS ? LIVENESS_MAX_TIMEOUT_MS : timeout);
+    }
+
+    void schedule(int entryIndex)
+    {
+        LivenessEntry &entry = entries[entryIndex];
+        unsigned long ticks = (timeoutOf(entry) + LIVENESS_TICK_MS - 1) / LIVENESS_TICK_MS;
+        int slot = (currentTick + ticks) % LIVENESS_WHEEL_SLOTS;
+
+        entry.rounds = (ticks - 1) / LIVENESS_WHEEL_SLOTS; // earlier visits of the slot before the deadline
+        entry.slot = slot;
+        entry.prev = -1;
+        entry.next = wheel[slot];
+        if (wheel[slot] != -1)
+        {
+            entries[wheel[slot]].prev = entryIndex;
+        }
+        wheel[slot] = entryIndex;
+    }
+
+    void unlink(int entryIndex)
+    {
+        LivenessEntry &entry = entries[entryIndex];
+        if (entry.slot == -1)
+        {
+            return;
+        }
+        if (entry.prev != -1)
+        {
+            entries[entry.prev].next = entry.next;
+        }
+        else
+        {
+            wheel[entry.slot] = entry.next;
+        }
+        if (entry.next != -1)
+        {
+            entries[entry.next].prev = entry.prev;
+        }
+        entry.slot = -1;
+        entry.prev = -1;
+        entry.next = -1;
+    }
+
+    void expireSlot(int slot)
+    {
+        int entryIndex = wheel[slot];
+        while (entryIndex != -1)
+        {
+            LivenessEntry &entry = entries[entryIndex];
+            int next = entry.next;
+            if (entry.rounds > 0)
+            {
+                entry.rounds--;
+            }
+            else
+            {
+                unlink(entryIndex);
+                entry.online = false;
+                callback(entry.sn, false);
+            }
+            entryIndex = next;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef DEVICE_TYPES_H
+#define DEVICE_TYPES_H
+
+#include <string>
+#include <cstring>
+#include "asset_templates.h"
+#include "../messaging/device_message.h"
+
+// Interned device type ids, index into the device type table
+#define DEVICE_TYPE_UNKNOWN 0xFF
+#define DEVICE_TYPE_PLUG 0
+#define DEVICE_TYPE_PRESENCE_SENSOR 1
+#define DEVICE_TYPE_ENVIRONMENT_SENSOR 2
+#define DEVICE_TYPE_AIR_QUALITY_SENSOR 3
+
+/// @brief Maps a field of the device payload to an OpenRemote attribute
+struct AttributeMapping
+{
+    const char *field;     // payload field (ignored for raw values)
+    const char *attribute; // attribute name in OpenRemote
+};
+
+/// @brief Maps a control attribute (written in OpenRemote) to the actions sent to the device
+struct ControlMapping
+{
+    const char *attribute;
+    const char *onAction;  // sent for "true"
+    const char *offAction; // sent for anything else
+};
+
+/// @brief Everything the gateway needs to know about a device type
+struct DeviceType
+{
+    uint8_t id;
+    const char *name;
+    std::string (*buildTemplate)(const std::string &name, const std::string &sn, const std::string &type);
+    bool rawValue; // payload is the value of the single mapped attribute, not a JSON object
+    const AttributeMapping *attributes;
+    uint8_t attributeCount;
+    const ControlMapping *controls;
+    uint8_t controlCount;
+};
+
+static const AttributeMapping PRESENCE_SENSOR_ATTRIBUTES[] = {{"", "presence"}};
+static const AttributeMapping ENVIRONMENT_SENSOR_ATTRIBUTES[] = {{"temperature", "temperature"}, {"relativeHumidity", "relativeHumidity"}};
+static const AttributeMapping AIR_QUALITY_SENSOR_ATTRIBUTES[] = {
+    {"temperature", "temperature"},
+    {"humidity", "humidity"},
+    {"gas", "gasResistance"},
+    {"altitude", "altitude"},
+    {"pressure", "pressure"}};
+static const ControlMapping PLUG_CONTROLS[] = {{"onOff", ACTION_ON, ACTION_OFF}};
+
+// Indexed by id, new device types are added here (+ their asset template)
+static const DeviceType DEVICE_TYPES[] = {
+    {DEVICE_TYPE_PLUG, PLUG_ASSET,
+     [](const std::string &name, const std::string &sn, const std::string &type)
+     { return PlugAsset(name, sn, type).toJson(); },
+     false, nullptr, 0, PLUG_CONTROLS, 1},
+    {DEVICE_TYPE_PRESENCE_SENSOR, PRESENCE_SENSOR_ASSET,
+     [](const std::string &name, const std::string &sn, const std::string &type)
+     { return PresenceSensorAsset(name, sn, type).toJson(); },
+     true, PRESENCE_SENSOR_ATTRIBUTES, 1, nullptr, 0},
+    {DEVICE_TYPE_ENVIRONMENT_SENSOR, ENVIRONMENT_SENSOR_ASSET,
+     [](const std::string &name, const std::string &sn, const std::string &type)
+     { return EnvironmentSensorAsset(name, sn, type).toJson(); },
+     false, ENVIRONMENT_SENSOR_ATTRIBUTES, 2, nullptr, 0},
+    {DEVICE_TYPE_AIR_QUALITY_SENSOR, AIR_QUALITY_SENSOR_ASSET,
+     [](const std::string &name, const std::string &sn, const std::string &type)
+     { return AirQualitySensorAsset(name, sn, type).toJson(); },
+     false, AIR_QUALITY_SENSOR_ATTRIBUTES, 5, nullptr, 0},
+};
+
+#define DEVICE_TYPE_COUNT (sizeof(DEVICE_TYPES) / sizeof(DEVICE_TYPES[0]))
+
+/// @brief Device type registry
+/// Device types are interned to a small id once, when a message is parsed or an asset is loaded.
+/// Everything after that (templates, attribute mapping, controls) is a table lookup by id.
+class DeviceTypes
+{
+public:
+    /// @brief Intern a device type name
+    /// @param name
+    /// @return uint8_t (DEVICE_TYPE_UNKNOWN if not supported)
+    static uint8_t intern(const std::string &name)
+    {
+        for (uint8_t i = 0; i < DEVICE_TYPE_COUNT; i++)
+        {
+            if (name.size() == strlen(DEVICE_TYPES[i].name) && name == DEVICE_TYPES[i].name)
+            {
+                return i;
+            }
+        }
+        return DEVICE_TYPE_UNKNOWN;
+    }
+
+    /// @brief Get a device type by id
+    /// @param id
+    /// @return const DeviceType* (nullptr if unknown)
+    static const DeviceType *get(uint8_t id)
+    {
+        return id < DEVICE_TYPE_COUNT ? &DEVICE_TYPES[id] : nullptr;
+    }
+
+    /// @brief Find the control mapping of an attribute
+    /// @param deviceType
+    /// @param attribute
+    /// @return const ControlMapping* (nullptr if the attribute is not a control attribute)
+    static const ControlMapping *findControl(const DeviceType *deviceType, const std::string &attribute)
+    {
+        for (uint8_t i = 0; deviceType != nullptr && i < deviceType->controlCount; i++)
+        {
+            if (attribute == deviceType->controls[i].attribute)
+            {
+                return &deviceType->controls[i];
+            }
+        }
+        return nullptr;
+    }
+};
+
+#endif
@@ -0,0 +1,291 @@
+#ifndef ONBOARDING_MANAGER_H
+#define ONBOARDING_MANAGER_H
+
+#include <Arduino.h>
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include "../system/scoped_lock.h"
+
+#define ONBOARDING_MAX_ENTRIES 64           // devices tracked at once, others are ignored until there is room
+#define ONBOARDING_MAX_IN_FLIGHT 4          // concurrent createAsset requests
+#define ONBOARDING_REQUEST_INTERVAL 30000   // min. time between ONBOARD_REQ datagrams to the same device
+#define ONBOARDING_RESPONSE_TIMEOUT 15000   // time to wait for the createAsset response before retrying
+#define ONBOARDING_RETRY_BACKOFF 5000       // first retry delay, doubles per attempt
+#define ONBOARDING_MAX_ATTEMPTS 4           // failed createAsset attempts before a device is blocked
+#define ONBOARDING_BLOCK_TIME 600000        // negative cache duration for blocked devices
+
+enum OnboardingState
+{
+    ONBOARDING_NONE,      // not tracked
+    ONBOARDING_REQUESTED, // ONBOARD_REQ sent, waiting for the device to onboard
+    ONBOARDING_QUEUED,    // onboard message received, waiting for a createAsset slot
+    ONBOARDING_IN_FLIGHT, // createAsset sent, waiting for the response
+    ONBOARDING_BACKOFF,   // createAsset failed or timed out, retried after a delay
+    ONBOARDING_BLOCKED    // too many failures or unsupported, ignored until the block expires
+};
+
+/// @brief Onboarding state of a single device
+struct OnboardingEntry
+{
+    std::string sn;
+    std::string name;
+    std::string type;
+    OnboardingState state = ONBOARDING_NONE;
+    unsigned long deadline = 0; // state expiry (millis)
+    uint8_t attempts = 0;       // createAsset attempts
+};
+
+/// @brief Onboarding admission control
+/// - ONBOARD_REQ datagrams are rate limited per device
+/// - duplicate onboard messages are ignored while a device is queued or in flight
+/// - at most ONBOARDING_MAX_IN_FLIGHT createAsset requests are outstanding, the rest waits in a FIFO queue
+/// - lost responses time out and are retried with exponential backoff, repeat offenders are blocked (negative cache)
+/// Used from the UDP task and the MQTT callback, all methods are guarded by a mutex.
+class OnboardingManager
+{
+public:
+    SemaphoreHandle_t semaphore = NULL;
+
+    /// @brief Initialize the onboarding manager, must be called before use
+    void init()
+    {
+        semaphore = xSemaphoreCreateMutex();
+    }
+
+    /// @brief Check if an ONBOARD_REQ should be sent to an unknown device, records the request
+    /// @param deviceSerial
+    /// @param now millis()
+    /// @return bool (false if recently requested, already onboarding, blocked or no room)
+    bool requestDue(const std::string &deviceSerial, unsigned long now)
+    {
+        ScopedLock lock(semaphore);
+        if (entries.count(deviceSerial) > 0 || entries.size() >= ONBOARDING_MAX_ENTRIES)
+        {
+            return false;
+        }
+        OnboardingEntry &entry = entries[deviceSerial];
+        entry.sn = deviceSerial;
+        entry.state = ONBOARDING_REQUESTED;
+        entry.deadline = now + ONBOARDING_REQUEST_INTERVAL;
+        return true;
+    }
+
+    /// @brief Queue a device that sent an onboard message
+    /// @param deviceSerial
+    /// @param deviceName
+    /// @param deviceType
+    /// @param now millis()
+    /// @return bool (false if duplicate, blocked or no room)
+    bool enqueue(const std::string &deviceSerial, const std::string &deviceName, const std::string &deviceType, unsigned long now)
+    {
+        ScopedLock lock(semaphore);
+        auto it = entries.find(deviceSerial);
+        if (it == entries.end())
+        {
+            if (entries.size() >= ONBOARDING_MAX_ENTRIES)
+            {
+                return false;
+            }
+            it = entries.insert(std::make_pair(deviceSerial, OnboardingEntry())).first;
+        }
+        else if (it->second.state != ONBOARDING_REQUESTED)
+        {
+            return false;
+        }
+
+        OnboardingEntry &entry = it->second;
+        entry.sn = deviceSerial;
+        entry.name = deviceName;
+        entry.type = deviceType;
+        entry.state = ONBOARDING_QUEUED;
+        queue.push_back(deviceSerial);
+        return true;
+    }
+
+    /// @brief Admit the next queued device if a createAsset slot is free, the device is moved in flight
+    /// @param out Copy of the admitted entry
+    /// @param now millis()
+    /// @return bool (false if nothing is queued or all slots are taken)
+    bool next(OnboardingEntry &out, unsigned long now)
+    {
+        ScopedLock lock(semaphore);
+        while (inFlight < ONBOARDING_MAX_IN_FLIGHT && !queue.empty())
+        {
+            std::string deviceSerial = queue.front();
+            queue.pop_front();
+
+            auto it = entries.find(deviceSerial);
+            if (it == entries.end() || it->second.state != ONBOARDING_QUEUED)
+            {
+                continue; // completed or blocked while queued
+            }
+
+            OnboardingEntry &entry = it->second;
+            entry.state = ONBOARDING_IN_FLIGHT;
+            entry.deadline = now + ONBOARDING_RESPONSE_TIMEOUT;
+            entry.attempts++;
+            inFlight++;
+            out = entry;
+            return true;
+        }
+        return false;
+    }
+
+    /// @brief Mark a createAsset attempt as failed (e.g. publish failed), retried after a backoff
+    /// @param deviceSerial
+    /// @param now millis()
+    /// @return OnboardingState (new state, BACKOFF or BLOCKED)
+    OnboardingState fail(const std::string &deviceSerial, unsigned long now)
+    {
+        ScopedLock lock(semaphore);
+        auto it = entries.find(deviceSerial);
+        if (it == entries.end())
+        {
+            return ONBOARDING_NONE;
+        }
+        if (it->second.state == ONBOARDING_IN_FLIGHT)
+        {
+            inFlight--;
+        }
+        return retryOrBlock(it->second, now);
+    }
+
+    /// @brief Block a device (negative cache), e.g. unsupported device type
+    /// @param deviceSerial
+    /// @param now millis()
+    void block(const std::string &deviceSerial, unsigned long now)
+    {
+        ScopedLock lock(semaphore);
+        auto it = entries.find(deviceSerial);
+        if (it == entries.end())
+        {
+            return;
+        }
+        if (it->second.state == ONBOARDING_IN_FLIGHT)
+        {
+            inFlight--;
+        }
+        it->second.state = ONBOARDING_BLOCKED;
+        it->second.deadline = now + ONBOARDING_BLOCK_TIME;
+    }
+
+    /// @brief Onboarding finished (asset created or device confirmed onboarded), stops tracking the device
+    /// @param deviceSerial
+    void complete(const std::string &deviceSerial)
+    {
+        ScopedLock lock(semaphore);
+        auto it = entries.find(deviceSerial);
+        if (it == entries.end())
+        {
+            return;
+        }
+        if (it->second.state == ONBOARDING_IN_FLIGHT)
+        {
+            inFlight--;
+        }
+        entries.erase(it);
+    }
+
+    /// @brief Expire timers: request intervals, response timeouts, backoffs and blocks
+    /// Bounded by ONBOARDING_MAX_ENTRIES, call about once a second.
+    /// @param now millis()
+    /// @param changed Called for every device whose state changed (e.g. for logging)
+    template <typename Callback>
+    void tick(unsigned long now, Callback changed)
+    {
+        ScopedLock lock(semaphore);
+        for (auto it = entries.begin(); it != entries.end();)
+        {
+            OnboardingEntry &entry = it->second;
+            if ((long)(now - entry.deadline) < 0 || entry.state == ONBOARDING_QUEUED)
+            {
+                ++it;
+                continue;
+            }
+
+            switch (entry.state)
+            {
+            case ONBOARDING_IN_FLIGHT:
+                inFlight--;
+                retryOrBlock(entry, now);
+                break;
+            case ONBOARDING_BACKOFF:
+                entry.state = ONBOARDING_QUEUED;
+                queue.push_back(entry.sn);
+                break;
+            default: // REQUESTED, BLOCKED: forget the device
+                entry.state = ONBOARDING_NONE;
+                break;
+            }
+            changed(entry);
+
+            if (entry.state == ONBOARDING_NONE)
+            {
+                it = entries.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    /// @brief Get the onboarding state of a device
+    /// @param deviceSerial
+    /// @return OnboardingState
+    OnboardingState getState(const std::string &deviceSerial)
+    {
+        ScopedLock lock(semaphore);
+        auto it = entries.find(deviceSerial);
+        return it != entries.end() ? it->second.state : ONBOARDING_NONE;
+    }
+
+    /// @brief Number of outstanding createAsset requests
+    int getInFlight()
+    {
+        return inFlight;
+    }
+
+    /// @brief Name of an onboarding state, used in events
+    static const char *stateName(OnboardingState state)
+    {
+        switch (state)
+        {
+        case ONBOARDING_REQUESTED:
+            return "requested";
+        case ONBOARDING_QUEUED:
+            return "queued";
+        case ONBOARDING_IN_FLIGHT:
+            return "pending";
+        case ONBOARDING_BACKOFF:
+            return "retrying";
+        case ONBOARDING_BLOCKED:
+            return "blocked";
+        default:
+            return "none";
+        }
+    }
+
+private:
+    std::unordered_map<std::string, OnboardingEntry> entries;
+    std::deque<std::string> queue;
+    int inFlight = 0;
+
+    OnboardingState retryOrBlock(OnboardingEntry &entry, unsigned long now)
+    {
+        if (entry.attempts >= ONBOARDING_MAX_ATTEMPTS)
+        {
+            entry.state = ONBOARDING_BLOCKED;
+            entry.deadline = now + ONBOARDING_BLOCK_TIME;
+        }
+        else
+        {
+            entry.state = ONBOARDING_BACKOFF;
+            entry.deadline = now + ((unsigned long)ONBOARDING_RETRY_BACKOFF << (entry.attempts > 0 ? entry.attempts - 1 : 0));
+        }
+        return entry.state;
+    }
+};
+
+#endif
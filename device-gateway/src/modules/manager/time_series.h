@@ -0,0 +1,243 @@
+#ifndef TIME_SERIES_H
+#define TIME_SERIES_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Plain C++ on purpose (no Arduino / ArduinoJson), so it can be benchmarked on the host, see bench/history_bench.cpp
+
+#define TIME_SERIES_BLOCK_BYTES 256    // compressed samples per block, a block is the unit of eviction
+#define TIME_SERIES_MAX_SAMPLE_BITS 80 // worst case: 4 + 32 bits timestamp, 2 + 5 + 5 + 32 bits value
+
+/// @brief Fixed size block of compressed samples, decodable on its own
+struct TimeSeriesBlock
+{
+    uint32_t start = 0; // timestamp of the first sample (s)
+    uint32_t end = 0;   // timestamp of the last sample (s)
+    uint16_t count = 0; // samples
+    uint16_t bits = 0;  // bits used in data
+    uint8_t data[TIME_SERIES_BLOCK_BYTES];
+
+    void clear()
+    {
+        start = end = 0;
+        count = bits = 0;
+    }
+
+    void write(uint32_t value, uint8_t length)
+    {
+        while (length > 0)
+        {
+            length--;
+            uint16_t byte = bits >> 3;
+            uint8_t mask = 0x80 >> (bits & 7);
+            if ((bits & 7) == 0)
+            {
+                data[byte] = 0;
+            }
+            if ((value >> length) & 1)
+            {
+                data[byte] |= mask;
+            }
+            bits++;
+        }
+    }
+
+    uint32_t read(uint16_t &position, uint8_t length) const
+    {
+        uint32_t value = 0;
+        while (length > 0)
+        {
+            length--;
+            value = (value << 1) | ((data[position >> 3] >> (7 - (position & 7))) & 1);
+            position++;
+        }
+        return value;
+    }
+};
+
+/// @brief Gorilla style compression of (timestamp, float) samples into a TimeSeriesBlock
+/// - timestamps: delta-of-delta, a steady reporting interval costs 1 bit per sample
+///     '0' same delta, '10' + 7 bits, '110' + 9 bits, '1110' + 12 bits, '1111' + 32 bits (the delta itself)
+/// - values: XOR with the previous value, an unchanged value costs 1 bit
+///     '0' same value, '10' + bits within the previous leading / trailing zero window,
+///     '11' + 5 bits leading zeros + 5 bits length - 1 + the meaningful bits
+/// The first sample of a block is stored as is (32 bit value, timestamp in the block header).
+/// Timestamps must not go backwards, the caller clamps them.
+class TimeSeriesEncoder
+{
+public:
+    /// @brief Start a block with its first sample
+    void begin(TimeSeriesBlock *block, uint32_t time, float value)
+    {
+        this->block = block;
+        block->clear();
+        block->start = block->end = time;
+        lastDelta = 0;
+        lastValue = floatBits(value);
+        leading = 0xff;
+        trailing = 0;
+        block->write(lastValue, 32);
+        block->count = 1;
+    }
+
+    /// @brief Append a sample to the current block
+    /// @return bool (false if the block is full, start a new one)
+    bool append(uint32_t time, float value)
+    {
+        if (block == nullptr || block->bits + TIME_SERIES_MAX_SAMPLE_BITS > TIME_SERIES_BLOCK_BYTES * 8 || block->count == 0xffff)
+        {
+            return false;
+        }
+
+        uint32_t delta = time - block->end;
+        int32_t dod = (int32_t)(delta - lastDelta);
+        if (dod == 0)
+        {
+            block->write(0, 1);
+        }
+        else if (dod >= -63 && dod <= 64)
+        {
+            block->write(0x2, 2);
+            block->write(dod + 63, 7);
+        }
+        else if (dod >= -255 && dod <= 256)
+        {
+            block->write(0x6, 3);
+            block->write(dod + 255, 9);
+        }
+        else if (dod >= -2047 && dod <= 2048)
+        {
+            block->write(0xe, 4);
+            block->write(dod + 2047, 12);
+        }
+        else
+        {
+            block->write(0xf, 4);
+            block->write(delta, 32);
+        }
+        lastDelta = delta;
+        block->end = time;
+
+        uint32_t bits = floatBits(value);
+        uint32_t xored = bits ^ lastValue;
+        if (xored == 0)
+        {
+            block->write(0, 1);
+        }
+        else
+        {
+            uint8_t lead = __builtin_clz(xored);
+            uint8_t trail = __builtin_ctz(xored);
+            if (leading != 0xff && lead >= leading && trail >= trailing)
+            {
+                block->write(0x2, 2);
+                block->write(xored >> trailing, 32 - leading - trailing);
+            }
+            else
+            {
+                uint8_t length = 32 - lead - trail;
+                block->write(0x3, 2);
+                block->write(lead, 5);
+                block->write(length - 1, 5);
+                block->write(xored >> trail, length);
+                leading = lead;
+                trailing = trail;
+            }
+        }
+        lastValue = bits;
+        block->count++;
+        return true;
+    }
+
+    static uint32_t floatBits(float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+private:
+    TimeSeriesBlock *block = nullptr;
+    uint32_t lastDelta = 0;
+    uint32_t lastValue = 0;
+    uint8_t leading = 0xff; // 0xff: no window yet
+    uint8_t trailing = 0;
+};
+
+/// @brief Sequential reader of a TimeSeriesBlock, mirrors TimeSeriesEncoder
+class TimeSeriesDecoder
+{
+public:
+    TimeSeriesDecoder(const TimeSeriesBlock &block) : block(block) {}
+
+    /// @brief Next sample
+    /// @return bool (false after the last sample)
+    bool next(uint32_t &time, float &value)
+    {
+        if (index >= block.count)
+        {
+            return false;
+        }
+
+        if (index == 0)
+        {
+            lastTime = block.start;
+            lastValue = block.read(position, 32);
+        }
+        else
+        {
+            uint32_t delta;
+            if (block.read(position, 1) == 0)
+            {
+                delta = lastDelta;
+            }
+            else if (block.read(position, 1) == 0)
+            {
+                delta = lastDelta + (int32_t)block.read(position, 7) - 63;
+            }
+            else if (block.read(position, 1) == 0)
+            {
+                delta = lastDelta + (int32_t)block.read(position, 9) - 255;
+            }
+            else if (block.read(position, 1) == 0)
+            {
+                delta = lastDelta + (int32_t)block.read(position, 12) - 2047;
+            }
+            else
+            {
+                delta = block.read(position, 32);
+            }
+            lastDelta = delta;
+            lastTime += delta;
+
+            if (block.read(position, 1) == 1)
+            {
+                if (block.read(position, 1) == 1)
+                {
+                    leading = block.read(position, 5);
+                    uint8_t length = block.read(position, 5) + 1;
+                    trailing = 32 - leading - length;
+                }
+                lastValue ^= block.read(position, 32 - leading - trailing) << trailing;
+            }
+        }
+
+        index++;
+        time = lastTime;
+        memcpy(&value, &lastValue, sizeof(value));
+        return true;
+    }
+
+private:
+    const TimeSeriesBlock &block;
+    uint16_t position = 0;
+    uint16_t index = 0;
+    uint32_t lastTime = 0;
+    uint32_t lastDelta = 0;
+    uint32_t lastValue = 0;
+    uint8_t leading = 0;
+    uint8_t trailing = 0;
+};
+
+#endif
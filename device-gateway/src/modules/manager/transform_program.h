@@ -0,0 +1,168 @@
+#ifndef TRANSFORM_PROGRAM_H
+#define TRANSFORM_PROGRAM_H
+
+#include <stdint.h>
+#include <math.h>
+#include <string>
+
+// Plain C++ on purpose (no Arduino / ArduinoJson), so it can be benchmarked on the host, see bench/transform_bench.cpp
+
+#define TRANSFORM_MAX_INPUTS 8   // distinct payload fields read by one device type
+#define TRANSFORM_MAX_OUTPUTS 8  // attributes written by one device type
+#define TRANSFORM_MAX_OPS 64     // instructions per device type
+
+enum TransformOpCode : uint8_t
+{
+    TRANSFORM_OP_LOAD,       // acc = in[arg]
+    TRANSFORM_OP_DEW_POINT,  // acc = dew point of acc (temperature, C) and in[arg] (relative humidity, %)
+    TRANSFORM_OP_SCALE,      // acc *= k
+    TRANSFORM_OP_OFFSET,     // acc += k
+    TRANSFORM_OP_CLAMP_LOW,  // acc = max(acc, k)
+    TRANSFORM_OP_CLAMP_HIGH, // acc = min(acc, k)
+    TRANSFORM_OP_ROUND,      // acc = round(acc * k) / k, k = 10^decimals
+    TRANSFORM_OP_STORE       // out[arg] = acc
+};
+
+/// @brief A single instruction, 8 bytes
+struct TransformOp
+{
+    TransformOpCode code;
+    uint8_t arg;
+    float k;
+};
+
+/// @brief Attribute transforms of one device type, compiled to a flat instruction list
+/// Compiling resolves every field and attribute name to a slot index once; evaluating a packet is a single
+/// pass over the instructions with an accumulator, no name lookups and no allocations.
+/// Missing inputs are NaN, NaN propagates and the affected outputs are skipped by the caller.
+class TransformProgram
+{
+public:
+    std::string inputs[TRANSFORM_MAX_INPUTS];   // payload field names, by input slot
+    std::string outputs[TRANSFORM_MAX_OUTPUTS]; // attribute names, by output slot
+    uint8_t inputCount = 0;
+    uint8_t outputCount = 0;
+
+    /// @brief Get the input slot of a payload field, adds it if needed
+    /// @param field
+    /// @return int (-1 if there are too many inputs)
+    int input(const std::string &field)
+    {
+        for (uint8_t i = 0; i < inputCount; i++)
+        {
+            if (inputs[i] == field)
+            {
+                return i;
+            }
+        }
+        if (inputCount >= TRANSFORM_MAX_INPUTS)
+        {
+            return -1;
+        }
+        inputs[inputCount] = field;
+        return inputCount++;
+    }
+
+    /// @brief Add an output attribute
+    /// @param attribute
+    /// @return int output slot (-1 if there are too many outputs)
+    int output(const std::string &attribute)
+    {
+        if (outputCount >= TRANSFORM_MAX_OUTPUTS)
+        {
+            return -1;
+        }
+        outputs[outputCount] = attribute;
+        return outputCount++;
+    }
+
+    /// @brief Append an instruction
+    /// @return bool (false if the program is full)
+    bool emit(TransformOpCode code, uint8_t arg = 0, float k = 0)
+    {
+        if (opCount >= TRANSFORM_MAX_OPS)
+        {
+            return false;
+        }
+        ops[opCount].code = code;
+        ops[opCount].arg = arg;
+        ops[opCount].k = k;
+        opCount++;
+        return true;
+    }
+
+    /// @brief Check if the program has any outputs
+    bool empty() const
+    {
+        return outputCount == 0;
+    }
+
+    /// @brief Remove all instructions, inputs and outputs
+    void clear()
+    {
+        inputCount = 0;
+        outputCount = 0;
+        opCount = 0;
+    }
+
+    /// @brief Run the program
+    /// @param in Input values, by input slot (NaN if the field is missing)
+    /// @param out Output values, by output slot (NaN if an input was missing)
+    void evaluate(const float *in, float *out) const
+    {
+        float acc = 0;
+        for (uint8_t i = 0; i < opCount; i++)
+        {
+            const TransformOp &op = ops[i];
+            switch (op.code)
+            {
+            case TRANSFORM_OP_LOAD:
+                acc = in[op.arg];
+                break;
+            case TRANSFORM_OP_DEW_POINT:
+                acc = dewPoint(acc, in[op.arg]);
+                break;
+            case TRANSFORM_OP_SCALE:
+                acc *= op.k;
+                break;
+            case TRANSFORM_OP_OFFSET:
+                acc += op.k;
+                break;
+            case TRANSFORM_OP_CLAMP_LOW:
+                acc = acc < op.k ? op.k : acc; // NaN stays NaN
+                break;
+            case TRANSFORM_OP_CLAMP_HIGH:
+                acc = acc > op.k ? op.k : acc;
+                break;
+            case TRANSFORM_OP_ROUND:
+                acc = roundf(acc * op.k) / op.k;
+                break;
+            case TRANSFORM_OP_STORE:
+                out[op.arg] = acc;
+                break;
+            }
+        }
+    }
+
+    /// @brief Dew point (Magnus formula)
+    /// @param temperature C
+    /// @param humidity relative humidity, %
+    /// @return float C (NaN if the humidity is not positive)
+    static float dewPoint(float temperature, float humidity)
+    {
+        if (!(humidity > 0))
+        {
+            return NAN;
+        }
+        const float a = 17.62f;
+        const float b = 243.12f;
+        float gamma = logf(humidity / 100.0f) + a * temperature / (b + temperature);
+        return b * gamma / (a - gamma);
+    }
+
+private:
+    TransformOp ops[TRANSFORM_MAX_OPS];
+    uint8_t opCount = 0;
+};
+
+#endif
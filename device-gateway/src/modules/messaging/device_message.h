@@ -1,5 +1,9 @@
+#ifndef DEVICE_MESSAGE_H
+#define DEVICE_MESSAGE_H
+
 
 #include <ArduinoJson.h>
+#include <string.h>
 
 // onboarding messages
 #define ONBOARD_OK "ONBOARD_OK"
@@ -10,15 +14,20 @@
 #define ACTION_ON "ACTION_ON"
 #define ACTION_OFF "ACTION_OFF"
 
+// largest datagram accepted from a device (batch messages)
+#define UDP_MAX_PACKET_SIZE 1024
+
 // message types
 // ONBOARD_MESSAGE: message sent to a device to onboard it
 // DATA_MESSAGE: received data from a device
 // ALIVE_MESSAGE: received alive message from a device, ping message
+// BATCH_MESSAGE: several buffered readings from a device, only device_sn is set, data: {"f":[fields],"r":[[age ms, values...]]}
 enum MessageType
 {
     ONBOARD_MESSAGE,
     DATA_MESSAGE,
-    ALIVE_MESSAGE
+    ALIVE_MESSAGE,
+    BATCH_MESSAGE
 };
 
 // Generic messaging structure for device based communication
@@ -26,6 +35,10 @@ enum MessageType
 // device_sn: serial number of the device
 // device_type: type of the device
 // data: data to be sent, can be any string data
+// seq: per device message counter, starts at 1 on every boot (0: firmware without sequence numbers)
+// boot: random id picked by the device at boot, tells a restarted counter apart from stale packets
+// rx: receive window after an uplink (ms), set by sleeping devices, they get commands through the DownlinkMailbox
+// ack: id of the last downlink the device processed
 struct DeviceMessage
 {
     std::string device_name;
@@ -33,6 +46,11 @@ struct DeviceMessage
     std::string device_type;
     std::string data;
     MessageType message_type;
+    uint32_t seq = 0;
+    uint32_t boot = 0;
+    uint16_t rx = 0;
+    uint32_t ack = 0;
+    uint8_t device_type_id = 0xFF; // interned device_type, set by the gateway after parsing (see DeviceTypes)
 
     DeviceMessage(std::string device_name, std::string device_sn, std::string device_type, std::string data, MessageType message_type)
     {
@@ -51,16 +69,77 @@ struct DeviceMessage
         doc["device_type"] = device_type;
         doc["data"] = data;
         doc["message_type"] = (int)message_type;
+        if (seq != 0)
+        {
+            doc["seq"] = seq;
+            doc["boot"] = boot;
+        }
+        if (rx != 0)
+        {
+            doc["rx"] = rx;
+            doc["ack"] = ack;
+        }
 
         std::string output;
         serializeJson(doc, output);
         return output;
     }
 
-    static DeviceMessage fromJson(std::string json)
+    /// @brief Parse a packet
+    /// @param json Null terminated packet
+    /// @param allocator Memory of the parsed document, e.g. the datapath pool (see PoolJsonAllocator)
+    static DeviceMessage fromJson(const char *json, ArduinoJson::Allocator *allocator)
     {
-        JsonDocument doc;
+        JsonDocument doc(allocator);
         deserializeJson(doc, json);
-        return DeviceMessage(doc["device_name"].as<std::string>(), doc["device_sn"].as<std::string>(), doc["device_type"].as<std::string>(), doc["data"].as<std::string>(), (MessageType)doc["message_type"].as<int>());
+        DeviceMessage message(doc["device_name"].as<std::string>(), doc["device_sn"].as<std::string>(), doc["device_type"].as<std::string>(), doc["data"].as<std::string>(), (MessageType)doc["message_type"].as<int>());
+        message.seq = doc["seq"] | 0u;
+        message.boot = doc["boot"] | 0u;
+        message.rx = doc["rx"] | 0u;
+        message.ack = doc["ack"] | 0u;
+        return message;
+    }
+
+    /// @brief Read the serial, type and message type of a packet without parsing it (ingress limiting)
+    /// Expects the compact JSON the devices send, values are not unescaped.
+    /// @param json Null terminated packet
+    /// @param device_sn Output, empty if missing
+    /// @param device_type Output, empty if missing (batch messages)
+    /// @param message_type Output, -1 if missing
+    static void peek(const char *json, std::string &device_sn, std::string &device_type, int &message_type)
+    {
+        device_sn = peekString(json, "\"device_sn\"");
+        device_type = peekString(json, "\"device_type\"");
+        const char *value = peekValue(json, "\"message_type\"");
+        message_type = value != nullptr && *value >= '0' && *value <= '9' ? atoi(value) : -1;
+    }
+
+private:
+    static const char *peekValue(const char *json, const char *key)
+    {
+        const char *value = strstr(json, key);
+        if (value == nullptr)
+        {
+            return nullptr;
+        }
+        value += strlen(key);
+        while (*value == ' ' || *value == ':')
+        {
+            value++;
+        }
+        return value;
+    }
+
+    static std::string peekString(const char *json, const char *key)
+    {
+        const char *value = peekValue(json, key);
+        if (value == nullptr || *value != '"')
+        {
+            return "";
+        }
+        const char *end = strchr(++value, '"');
+        return end != nullptr ? std::string(value, end - value) : "";
     }
 };
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef DOWNLINK_MAILBOX_H
+#define DOWNLINK_MAILBOX_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <string>
+#include <unordered_map>
+#include "../system/scoped_lock.h"
+
+#define DOWNLINK_MAX_CONFIG 128 // max. length of a device config (JSON)
+
+/// @brief Pending downlink of a single device, latest command and config win
+struct Mailbox
+{
+    bool listening = false; // device announced a receive window (DeviceMessage::rx), commands go through the mailbox
+    uint32_t id = 0;        // id of the pending downlink, a new one on every change (0: none yet)
+    uint32_t acked = 0;     // last id acknowledged by the device
+    std::string command;    // e.g. ACTION_ON, empty if none
+    std::string config;     // JSON object, empty if none
+    unsigned long used = 0; // millis(), last uplink or post, the least recently used mailbox is evicted
+};
+
+/// @brief Downlink mailbox for duty-cycled (sleeping) devices
+/// A sleeping device can't be reached at its last known address, it only listens for a short window (rx) after an uplink.
+/// Commands and config are held here and sent right after the device's next uplink, as one JSON datagram:
+///   {"dl":id,"cmd":"ACTION_ON","cfg":{"interval":60000}}
+/// The downlink is repeated after every uplink until the device acknowledges its id (DeviceMessage::ack).
+/// Devices keep the last acknowledged id across deep sleep, and a gateway reboot must not hand out an id they
+/// already acknowledged: ids come from one counter that starts at a random value on every boot.
+/// Devices that never announced a receive window keep getting commands pushed directly.
+/// Mailboxes are for onboarded devices only (the caller checks). The table holds the fleet (init()), if it is full
+/// anyway the least recently used mailbox is evicted.
+/// Used from the UDP task, the MQTT callback and the web server, all methods are guarded by a mutex.
+class DownlinkMailbox
+{
+public:
+    SemaphoreHandle_t semaphore = NULL;
+
+    /// @brief Initialize the mailbox, must be called before use
+    /// @param maxDevices Mailboxes at once, the fleet limit
+    void init(size_t maxDevices)
+    {
+        semaphore = xSemaphoreCreateMutex();
+        this->maxDevices = maxDevices;
+        mailboxes.reserve(maxDevices);
+        nextId = esp_random();
+    }
+
+    /// @brief Check if commands for a device should go through the mailbox
+    /// @param deviceSerial
+    /// @return bool (false if the device is always listening or unknown)
+    bool isListening(const std::string &deviceSerial)
+    {
+        ScopedLock lock(semaphore);
+        auto it = mailboxes.find(deviceSerial);
+        return it != mailboxes.end() && it->second.listening;
+    }
+
+    /// @brief Hold a command for a device, replaces a command that was not delivered yet
+    /// @param deviceSerial
+    /// @param command
+    /// @param now millis()
+    void postCommand(const std::string &deviceSerial, const std::string &command, unsigned long now)
+    {
+        ScopedLock lock(semaphore);
+        Mailbox *mailbox = findOrCreate(deviceSerial, now);
+        mailbox->command = command;
+        mailbox->id = newId();
+    }
+
+    /// @brief Hold a config for a device, replaces a config that was not delivered yet
+    /// @param deviceSerial
+    /// @param config JSON object
+    /// @param now millis()
+    /// @return bool (false if the config is too large)
+    bool postConfig(const std::string &deviceSerial, const std::string &config, unsigned long now)
+    {
+        if (config.length() > DOWNLINK_MAX_CONFIG)
+        {
+            return false;
+        }
+        ScopedLock lock(semaphore);
+        Mailbox *mailbox = findOrCreate(deviceSerial, now);
+        mailbox->config = config;
+        mailbox->id = newId();
+        return true;
+    }
+
+    /// @brief Handle an uplink of a device, returns the downlink to send back right away
+    /// @param deviceSerial
+    /// @param rx Receive window announced by the device (ms), 0 if it has no mailbox support
+    /// @param ack Last downlink id the device has processed
+    /// @param downlink Output, the pending downlink
+    /// @param now millis()
+    /// @return bool (true if a downlink is pending and should be sent now)
+    bool uplink(const std::string &deviceSerial, uint16_t rx, uint32_t ack, std::string &downlink, unsigned long now)
+    {
+        if (rx == 0)
+        {
+            return false;
+        }
+
+        ScopedLock lock(semaphore);
+        Mailbox *mailbox = findOrCreate(deviceSerial, now);
+        mailbox->listening = true;
+        if (ack == mailbox->id)
+        {
+            mailbox->acked = ack;
+            mailbox->command.clear();
+            mailbox->config.clear();
+        }
+        if (mailbox->acked == mailbox->id)
+        {
+            return false;
+        }
+
+        JsonDocument doc;
+        doc["dl"] = mailbox->id;
+        if (!mailbox->command.empty())
+        {
+            doc["cmd"] = mailbox->command;
+        }
+        if (!mailbox->config.empty())
+        {
+            doc["cfg"] = serialized(mailbox->config);
+        }
+        downlink.clear();
+        serializeJson(doc, downlink);
+        return true;
+    }
+
+    /// @brief Drop the mailbox of a device (e.g. deleted), a pending downlink is discarded
+    /// @param deviceSerial
+    void remove(const std::string &deviceSerial)
+    {
+        ScopedLock lock(semaphore);
+        mailboxes.erase(deviceSerial);
+    }
+
+    /// @brief Pending downlinks of all devices
+    /// @param pending Output array, one object per device with an unacknowledged downlink
+    void toJson(JsonArray pending)
+    {
+        ScopedLock lock(semaphore);
+        for (auto it = mailboxes.begin(); it != mailboxes.end(); ++it)
+        {
+            const Mailbox &mailbox = it->second;
+            if (mailbox.acked == mailbox.id)
+            {
+                continue;
+            }
+            JsonObject entry = pending.add<JsonObject>();
+            entry["sn"] = it->first;
+            entry["id"] = mailbox.id;
+            entry["listening"] = mailbox.listening;
+            if (!mailbox.command.empty())
+            {
+                entry["cmd"] = mailbox.command;
+            }
+            if (!mailbox.config.empty())
+            {
+                entry["cfg"] = serialized(mailbox.config);
+            }
+        }
+    }
+
+private:
+    std::unordered_map<std::string, Mailbox> mailboxes;
+    size_t maxDevices = 0;
+    uint32_t nextId = 0;
+
+    /// @brief Next downlink id, never 0 (a device that acknowledged nothing sends ack 0)
+    uint32_t newId()
+    {
+        if (nextId == 0)
+        {
+            nextId++;
+        }
+        return nextId++;
+    }
+
+    Mailbox *findOrCreate(const std::string &deviceSerial, unsigned long now)
+    {
+        auto it = mailboxes.find(deviceSerial);
+        if (it == mailboxes.end())
+        {
+            if (mailboxes.size() >= maxDevices)
+            {
+                evictLeastRecent(now);
+            }
+            it = mailboxes.insert(std::make_pair(deviceSerial, Mailbox())).first;
+        }
+        it->second.used = now;
+        return &it->second;
+    }
+
+    /// @brief Make room in a full table, O(n) but only when a device beyond the fleet limit shows up
+    void evictLeastRecent(unsigned long now)
+    {
+        auto oldest = mailboxes.begin();
+        for (auto it = mailboxes.begin(); it != mailboxes.end(); ++it)
+        {
+            if (now - it->second.used > now - oldest->second.used)
+            {
+                oldest = it;
+            }
+        }
+        if (oldest != mailboxes.end())
+        {
+            mailboxes.erase(oldest);
+        }
+    }
+};
+
+#endif
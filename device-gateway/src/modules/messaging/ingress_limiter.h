@@ -0,0 +1,284 @@
+#ifndef INGRESS_LIMITER_H
+#define INGRESS_LIMITER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+#include <string>
+#include <functional>
+#include <unordered_map>
+#include "device_message.h"
+#include "../manager/device_types.h"
+#include "../system/scoped_lock.h"
+
+#define INGRESS_BUDGETS_FILE "/ingress.json"
+#define INGRESS_DEFAULT_RATE 1.0f     // packets per second
+#define INGRESS_DEFAULT_BURST 10      // packets
+#define INGRESS_ONBOARDING_RATE 20.0f // packets per second, onboarding and alive messages of devices not onboarded (all together)
+#define INGRESS_ONBOARDING_BURST 100  // packets, a site power cycle
+
+enum IngressVerdict
+{
+    INGRESS_ADMITTED,
+    INGRESS_THROTTLED, // over the device's budget
+    INGRESS_SHED       // telemetry dropped while upstream is congested
+};
+
+/// @brief Packet budget of a device type: token bucket rate and size, and whether its telemetry may be shed
+struct IngressBudget
+{
+    float rate = INGRESS_DEFAULT_RATE;
+    float burst = INGRESS_DEFAULT_BURST;
+    bool shed = false;
+};
+
+/// @brief Token bucket and counters of a single device
+struct IngressBucket
+{
+    uint8_t typeId = DEVICE_TYPE_UNKNOWN;
+    float tokens = 0;
+    unsigned long refilled = 0; // millis(), also when the device was last seen (the least recent is evicted)
+    bool limited = false;       // throttled since the last admitted packet, for logging transitions only
+    uint32_t admitted = 0;
+    uint32_t throttled = 0;
+    uint32_t shed = 0;
+};
+
+/// @brief Per device ingress rate limiting, runs before a packet is parsed
+/// Every serial has a token bucket, sized by the budget of its device type (config/ingress.json):
+///   {"default": {"rate": 1, "burst": 10}, "onboarding": {"rate": 20, "burst": 100},
+///    "EnvironmentSensorAsset": {"rate": 0.5, "burst": 5, "shed": true}}
+/// Rate in packets per second, burst in packets. A chatty or misbehaving device only uses up its own budget.
+/// While upstream is congested (see OutboundScheduler::congested) data and batch messages of types with "shed"
+/// are dropped right away, before they cost a parse and a publish. Onboarding and alive messages are never shed.
+/// Only onboarded devices get a bucket of their own, made up serials can't grow the table or get a fresh budget
+/// each. Devices that are not onboarded share two buckets:
+/// - onboarding and alive messages: "onboarding" budget (INGRESS_ONBOARDING_*), a fleet coming up at once
+/// - everything else: default budget, the gateway drops that traffic anyway
+/// The table holds the fleet (init()), if it is full anyway the least recently seen device is evicted (an idle
+/// bucket is full again, only its counters are lost).
+/// Used from the UDP task, read by the web server, all methods are guarded by a mutex.
+class IngressLimiter
+{
+public:
+    /// @brief Check if a device is onboarded, and get the device type of its asset
+    typedef std::function<bool(const std::string &deviceSerial, uint8_t &typeId)> DeviceResolver;
+
+    SemaphoreHandle_t semaphore = NULL;
+
+    /// @brief Constructor
+    /// @param resolver Called for serials without a bucket
+    IngressLimiter(DeviceResolver resolver) : resolver(resolver)
+    {
+        onboardingBudget.rate = INGRESS_ONBOARDING_RATE;
+        onboardingBudget.burst = INGRESS_ONBOARDING_BURST;
+    }
+
+    /// @brief Initialize the limiter, must be called before use
+    /// @param maxDevices Devices with a bucket at once, the fleet limit
+    void init(size_t maxDevices)
+    {
+        semaphore = xSemaphoreCreateMutex();
+        this->maxDevices = maxDevices;
+        buckets.reserve(maxDevices);
+    }
+
+    /// @brief Load the budgets per device type, types without one use the default budget
+    /// @param fs
+    /// @return int number of device types with a budget
+    int load(fs::FS &fs)
+    {
+        File file = fs.open(INGRESS_BUDGETS_FILE, "r");
+        if (!file)
+        {
+            return 0;
+        }
+
+        JsonDocument doc;
+        DeserializationError error = deserializeJson(doc, file);
+        file.close();
+        if (error)
+        {
+            Serial.print("! Invalid ingress budgets: ");
+            Serial.println(error.c_str());
+            return 0;
+        }
+
+        ScopedLock lock(semaphore);
+        parseBudget(doc["default"], defaultBudget);
+        parseBudget(doc["onboarding"], onboardingBudget);
+        int loaded = 0;
+        for (uint8_t i = 0; i < DEVICE_TYPE_COUNT; i++)
+        {
+            budgets[i] = defaultBudget;
+        }
+        for (JsonPair type : doc.as<JsonObject>())
+        {
+            if (strcmp(type.key().c_str(), "default") == 0 || strcmp(type.key().c_str(), "onboarding") == 0)
+            {
+                continue;
+            }
+            uint8_t typeId = DeviceTypes::intern(type.key().c_str());
+            if (typeId == DEVICE_TYPE_UNKNOWN)
+            {
+                Serial.print("! Ingress budget for unknown device type: ");
+                Serial.println(type.key().c_str());
+                continue;
+            }
+            parseBudget(type.value(), budgets[typeId]);
+            loaded++;
+        }
+        return loaded;
+    }
+
+    /// @brief Decide on a packet, before it is parsed
+    /// @param deviceSerial Empty if the packet has none
+    /// @param typeId Device type of the packet, DEVICE_TYPE_UNKNOWN if it has none
+    /// @param messageType -1 if the packet has none
+    /// @param congested Upstream is saturated, sheddable telemetry is dropped
+    /// @param now millis()
+    /// @return IngressVerdict (only ADMITTED packets should be parsed)
+    IngressVerdict admit(const std::string &deviceSerial, uint8_t typeId, int messageType, bool congested, unsigned long now)
+    {
+        ScopedLock lock(semaphore);
+        bool onboarding = messageType == ONBOARD_MESSAGE || messageType == ALIVE_MESSAGE;
+        IngressBucket &bucket = find(deviceSerial, typeId, onboarding, now);
+        const IngressBudget &budget = &bucket == &onboardingBucket ? onboardingBudget : budgetOf(bucket.typeId);
+
+        bool telemetry = messageType == DATA_MESSAGE || messageType == BATCH_MESSAGE;
+        if (congested && telemetry && budget.shed)
+        {
+            bucket.shed++;
+            return INGRESS_SHED;
+        }
+
+        bucket.tokens = min(budget.burst, bucket.tokens + (now - bucket.refilled) * budget.rate / 1000.0f);
+        bucket.refilled = now;
+        if (bucket.tokens < 1)
+        {
+            bucket.throttled++;
+            if (!bucket.limited)
+            {
+                bucket.limited = true;
+                Serial.print("! Device over its packet budget, throttled - sn: ");
+                Serial.println(deviceSerial.c_str());
+            }
+            return INGRESS_THROTTLED;
+        }
+        bucket.tokens -= 1;
+        bucket.limited = false;
+        bucket.admitted++;
+        return INGRESS_ADMITTED;
+    }
+
+    /// @brief Drop the bucket of a device (e.g. deleted)
+    /// @param deviceSerial
+    void remove(const std::string &deviceSerial)
+    {
+        ScopedLock lock(semaphore);
+        buckets.erase(deviceSerial);
+    }
+
+    /// @brief Counters of all tracked devices
+    /// @param devices Output array, one object per device ("*onboarding", "*": shared by devices not onboarded)
+    void toJson(JsonArray devices)
+    {
+        ScopedLock lock(semaphore);
+        for (auto it = buckets.begin(); it != buckets.end(); ++it)
+        {
+            addBucket(devices, it->first.c_str(), it->second);
+        }
+        if (onboardingBucket.admitted + onboardingBucket.throttled > 0)
+        {
+            addBucket(devices, "*onboarding", onboardingBucket);
+        }
+        if (unknownBucket.admitted + unknownBucket.throttled + unknownBucket.shed > 0)
+        {
+            addBucket(devices, "*", unknownBucket);
+        }
+    }
+
+private:
+    DeviceResolver resolver;
+    IngressBudget defaultBudget;
+    IngressBudget onboardingBudget;
+    IngressBudget budgets[DEVICE_TYPE_COUNT];
+    std::unordered_map<std::string, IngressBucket> buckets;
+    size_t maxDevices = 0;
+    IngressBucket onboardingBucket; // onboarding and alive messages of devices not onboarded
+    IngressBucket unknownBucket;    // anything else of devices not onboarded
+
+    static void parseBudget(JsonVariant spec, IngressBudget &budget)
+    {
+        budget.rate = spec["rate"] | budget.rate;
+        budget.burst = max(spec["burst"] | budget.burst, 1.0f);
+        budget.shed = spec["shed"] | budget.shed;
+    }
+
+    static void addBucket(JsonArray devices, const char *deviceSerial, const IngressBucket &bucket)
+    {
+        const DeviceType *deviceType = DeviceTypes::get(bucket.typeId);
+        JsonObject device = devices.add<JsonObject>();
+        device["sn"] = deviceSerial;
+        device["type"] = deviceType != nullptr ? deviceType->name : "";
+        device["admitted"] = bucket.admitted;
+        device["throttled"] = bucket.throttled;
+        device["shed"] = bucket.shed;
+        device["tokens"] = bucket.tokens;
+    }
+
+    const IngressBudget &budgetOf(uint8_t typeId) const
+    {
+        return typeId < DEVICE_TYPE_COUNT ? budgets[typeId] : defaultBudget;
+    }
+
+    IngressBucket &find(const std::string &deviceSerial, uint8_t typeId, bool onboarding, unsigned long now)
+    {
+        auto it = buckets.find(deviceSerial);
+        if (it != buckets.end())
+        {
+            return it->second;
+        }
+
+        uint8_t assetTypeId = DEVICE_TYPE_UNKNOWN;
+        if (deviceSerial.empty() || !resolver(deviceSerial, assetTypeId))
+        {
+            IngressBucket &shared = onboarding ? onboardingBucket : unknownBucket;
+            if (shared.refilled == 0)
+            {
+                shared.tokens = (onboarding ? onboardingBudget : defaultBudget).burst;
+                shared.refilled = now;
+            }
+            return shared;
+        }
+
+        if (buckets.size() >= maxDevices)
+        {
+            evictLeastRecent(now);
+        }
+        IngressBucket &bucket = buckets[deviceSerial];
+        bucket.typeId = assetTypeId != DEVICE_TYPE_UNKNOWN ? assetTypeId : typeId;
+        bucket.tokens = budgetOf(bucket.typeId).burst; // a new device starts with a full bucket
+        bucket.refilled = now;
+        return bucket;
+    }
+
+    /// @brief Make room in a full table, O(n) but only when a device beyond the fleet limit shows up
+    void evictLeastRecent(unsigned long now)
+    {
+        auto oldest = buckets.begin();
+        for (auto it = buckets.begin(); it != buckets.end(); ++it)
+        {
+            if (now - it->second.refilled > now - oldest->second.refilled)
+            {
+                oldest = it;
+            }
+        }
+        if (oldest != buckets.end())
+        {
+            buckets.erase(oldest);
+        }
+    }
+};
+
+#endif
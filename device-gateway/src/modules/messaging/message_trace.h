@@ -0,0 +1,200 @@
+#ifndef MESSAGE_TRACE_H
+#define MESSAGE_TRACE_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "../manager/device_asset.h"
+#include "../system/scoped_lock.h"
+
+#define TRACE_RING_SIZE 32 // most recent messages kept
+
+/// @brief Direction of a traced message
+enum TraceKind : uint8_t
+{
+    TRACE_UPLINK,  // device datagram, forwarded to OpenRemote
+    TRACE_DOWNLINK // pending gateway event, forwarded to a device and acknowledged
+};
+
+/// @brief Pipeline stages, in order
+enum TraceStage : uint8_t
+{
+    TRACE_RECEIVE,   // datagram read from the socket / event handed over by the mqtt client
+    TRACE_DECODE,    // parsed
+    TRACE_DISPATCH,  // handler picked, admitted (ingress, sequence) and mapped
+    TRACE_LOCK,      // mqtt client acquired (OutboundScheduler)
+    TRACE_PUBLISHED, // written to the TLS socket
+    TRACE_ACKED,     // PUBACK received (QoS 1 attribute updates)
+    TRACE_STAGE_COUNT
+};
+
+/// @brief Stage timestamps of one message
+struct TraceRecord
+{
+    uint32_t id = 0; // 0: empty slot
+    TraceKind kind = TRACE_UPLINK;
+    InlineString<ASSET_SN_MAX_LENGTH> label; // device serial, or the attribute of an event
+    uint32_t stamps[TRACE_STAGE_COUNT];     // micros(), 0: stage not reached
+};
+
+/// @brief Per stage latency of the most recent messages, to see where a late reading waited
+/// Every admitted datagram and every pending event gets a trace id, every stage it passes is stamped with micros().
+/// A message that is published more than once (batch) keeps the stamps of its last publish.
+/// Fixed ring of TRACE_RING_SIZE records (slot = id % size), older traces are overwritten and stamping them is a no-op.
+/// Stamped from the UDP task, the loop task (events, PUBACKs) and read by the web server, guarded by a mutex.
+class MessageTracer
+{
+public:
+    /// @brief Initialize the tracer, must be called before use
+    void init()
+    {
+        semaphore = xSemaphoreCreateMutex();
+    }
+
+    /// @brief Start a trace
+    /// @param kind
+    /// @param received micros() at TRACE_RECEIVE, taken before the message was known to be worth a trace
+    /// @return uint32_t trace id (never 0)
+    uint32_t begin(TraceKind kind, uint32_t received)
+    {
+        ScopedLock lock(semaphore);
+        lastId = lastId == UINT32_MAX ? 1 : lastId + 1;
+        TraceRecord &record = records[lastId % TRACE_RING_SIZE];
+        record.id = lastId;
+        record.kind = kind;
+        record.label.assign("");
+        memset(record.stamps, 0, sizeof(record.stamps));
+        record.stamps[TRACE_RECEIVE] = received;
+        return lastId;
+    }
+
+    /// @brief Stamp a stage
+    /// @param id Trace id, 0 is ignored
+    /// @param stage
+    void mark(uint32_t id, TraceStage stage)
+    {
+        if (id == 0)
+        {
+            return;
+        }
+        uint32_t now = micros();
+        ScopedLock lock(semaphore);
+        TraceRecord &record = records[id % TRACE_RING_SIZE];
+        if (record.id == id)
+        {
+            record.stamps[stage] = now;
+        }
+    }
+
+    /// @brief Name the traced message (device serial, attribute)
+    /// @param id Trace id
+    /// @param label
+    void setLabel(uint32_t id, const char *label)
+    {
+        ScopedLock lock(semaphore);
+        TraceRecord &record = records[id % TRACE_RING_SIZE];
+        if (id != 0 && record.id == id)
+        {
+            record.label.assign(label);
+        }
+    }
+
+    /// @brief Records, oldest first, stage times in us since receive
+    /// @param out Output array: [{id, kind, label, receive, stages: {decode: us, ...}}]
+    void toJson(JsonArray out)
+    {
+        ScopedLock lock(semaphore);
+        forEach([&](const TraceRecord &record)
+                {
+            JsonObject item = out.add<JsonObject>();
+            item["id"] = record.id;
+            item["kind"] = kindName(record.kind);
+            item["label"] = record.label.c_str();
+            item["receive"] = record.stamps[TRACE_RECEIVE];
+            JsonObject stages = item["stages"].to<JsonObject>();
+            for (int stage = TRACE_DECODE; stage < TRACE_STAGE_COUNT; stage++)
+            {
+                if (record.stamps[stage] != 0)
+                {
+                    stages[stageName((TraceStage)stage)] = record.stamps[stage] - record.stamps[TRACE_RECEIVE];
+                }
+            } });
+    }
+
+    /// @brief Records in the Chrome trace event format (chrome://tracing, Perfetto)
+    /// Every reached stage is a complete event from the previous reached stage, one row per direction.
+    /// @param out Output object: {traceEvents: [...]}
+    void toChromeTrace(JsonObject out)
+    {
+        ScopedLock lock(semaphore);
+        JsonArray events = out["traceEvents"].to<JsonArray>();
+        forEach([&](const TraceRecord &record)
+                {
+            uint32_t previous = record.stamps[TRACE_RECEIVE];
+            for (int stage = TRACE_DECODE; stage < TRACE_STAGE_COUNT; stage++)
+            {
+                if (record.stamps[stage] == 0)
+                {
+                    continue;
+                }
+                JsonObject event = events.add<JsonObject>();
+                event["name"] = stageName((TraceStage)stage);
+                event["cat"] = kindName(record.kind);
+                event["ph"] = "X";
+                event["ts"] = previous;
+                event["dur"] = record.stamps[stage] - previous;
+                event["pid"] = 1;
+                event["tid"] = (int)record.kind;
+                JsonObject args = event["args"].to<JsonObject>();
+                args["trace"] = record.id;
+                args["label"] = record.label.c_str();
+                previous = record.stamps[stage];
+            } });
+    }
+
+    static const char *stageName(TraceStage stage)
+    {
+        switch (stage)
+        {
+        case TRACE_RECEIVE:
+            return "receive";
+        case TRACE_DECODE:
+            return "decode";
+        case TRACE_DISPATCH:
+            return "dispatch";
+        case TRACE_LOCK:
+            return "lock";
+        case TRACE_PUBLISHED:
+            return "published";
+        case TRACE_ACKED:
+            return "acked";
+        default:
+            return "unknown";
+        }
+    }
+
+    static const char *kindName(TraceKind kind)
+    {
+        return kind == TRACE_UPLINK ? "uplink" : "downlink";
+    }
+
+private:
+    SemaphoreHandle_t semaphore = NULL;
+    TraceRecord records[TRACE_RING_SIZE];
+    uint32_t lastId = 0;
+
+    /// @brief Visit the records oldest first, the lock must be held
+    template <typename Visit>
+    void forEach(Visit visit)
+    {
+        for (uint32_t i = 1; i <= TRACE_RING_SIZE; i++)
+        {
+            const TraceRecord &record = records[(lastId + i) % TRACE_RING_SIZE];
+            if (record.id != 0)
+            {
+                visit(record);
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef OUTBOUND_SCHEDULER_H
+#define OUTBOUND_SCHEDULER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define OUTBOUND_MAX_WAITERS 8        // tasks waiting at the same time (mqtt, udp, loop, web server)
+#define OUTBOUND_STARVATION_MS 1000   // a waiter this old is served next, whatever its class
+#define OUTBOUND_CONGESTION_MS 250    // a wait or a hold this long means upstream is saturated
+#define OUTBOUND_CONGESTION_HOLD 2000 // ms upstream counts as saturated after the last slow wait / hold
+
+/// @brief Priority classes of outbound MQTT traffic, highest first
+enum TrafficClass : uint8_t
+{
+    TRAFFIC_CONTROL,    // acks of control events (a user toggled an actuator), asset edits from the web interface
+    TRAFFIC_ACK,        // acks of other pending events
+    TRAFFIC_ONBOARDING, // asset create requests and their responses, asset deletes
+    TRAFFIC_TELEMETRY,  // attribute updates, connection status
+    TRAFFIC_RESYNC,     // (re)connect, subscriptions and republishing every asset after a reconnect
+    TRAFFIC_CLASS_COUNT
+};
+
+/// @brief Latency of one traffic class
+struct TrafficStats
+{
+    uint32_t grants = 0;
+    uint32_t promoted = 0;  // grants ahead of higher classes (starvation protection)
+    uint64_t waitTotal = 0; // us
+    uint32_t waitMax = 0;   // us
+    uint32_t holdMax = 0;   // us
+};
+
+/// @brief Access to the MQTT client, scheduled by traffic class instead of first come first served
+/// Strict priority: when the client is released it goes to the waiter with the highest class.
+/// Starvation protection: a waiter that has waited OUTBOUND_STARVATION_MS goes first (oldest first), so a
+/// steady stream of telemetry can't hold back a resync forever, and the other way around.
+/// Long jobs (resync) acquire per message, so control traffic gets in between.
+/// Wait and hold times are measured per class, slow waits or holds flag upstream as congested (ingress sheds telemetry).
+class OutboundScheduler
+{
+public:
+    /// @brief Initialize the scheduler, must be called before use
+    void init()
+    {
+        semaphore = xSemaphoreCreateMutex();
+        for (int i = 0; i < OUTBOUND_MAX_WAITERS; i++)
+        {
+            waiters[i].wake = xSemaphoreCreateBinary();
+        }
+    }
+
+    /// @brief Wait for the MQTT client, release() when done
+    /// @param trafficClass
+    /// @param timeout Ticks
+    /// @return bool (false on timeout)
+    bool acquire(TrafficClass trafficClass, TickType_t timeout = portMAX_DELAY)
+    {
+        unsigned long requested = micros();
+        Waiter *waiter = nullptr;
+        while (waiter == nullptr)
+        {
+            xSemaphoreTake(semaphore, portMAX_DELAY);
+            if (!busy && waiting == 0)
+            {
+                grant(trafficClass, requested, false);
+                xSemaphoreGive(semaphore);
+                return true;
+            }
+            waiter = enqueue(trafficClass, requested);
+            xSemaphoreGive(semaphore);
+            if (waiter == nullptr)
+            {
+                vTaskDelay(1); // every waiter slot taken, rare
+            }
+        }
+
+        bool woken = xSemaphoreTake(waiter->wake, timeout) == pdTRUE;
+
+        // the slot is only reused once its task is done with it, a wake up can't reach the wrong waiter
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        bool granted = waiter->state == WAITER_GRANTED;
+        if (!granted)
+        {
+            waiting--; // timed out
+        }
+        else if (!woken)
+        {
+            xSemaphoreTake(waiter->wake, 0); // granted while timing out, take the wake up that came with it
+        }
+        waiter->state = WAITER_FREE;
+        xSemaphoreGive(semaphore);
+        return granted;
+    }
+
+    /// @brief Release the MQTT client, hands it to the next waiter
+    void release()
+    {
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        uint32_t held = micros() - grantedAt;
+        stats[owner].holdMax = max(stats[owner].holdMax, held);
+        if (held >= OUTBOUND_CONGESTION_MS * 1000UL)
+        {
+            congestedAt = millis();
+            congestion = true;
+        }
+
+        Waiter *next = nullptr;
+        Waiter *oldest = nullptr;
+        unsigned long now = micros();
+        for (int i = 0; i < OUTBOUND_MAX_WAITERS; i++)
+        {
+            Waiter &waiter = waiters[i];
+            if (waiter.state != WAITER_WAITING)
+            {
+                continue;
+            }
+            if (next == nullptr || waiter.trafficClass < next->trafficClass ||
+                (waiter.trafficClass == next->trafficClass && (long)(waiter.requested - next->requested) < 0))
+            {
+                next = &waiter;
+            }
+            if (oldest == nullptr || (long)(waiter.requested - oldest->requested) < 0)
+            {
+                oldest = &waiter;
+            }
+        }
+
+        if (next == nullptr)
+        {
+            busy = false;
+        }
+        else
+        {
+            bool starving = now - oldest->requested >= OUTBOUND_STARVATION_MS * 1000UL;
+            Waiter *granted = starving ? oldest : next;
+            grant(granted->trafficClass, granted->requested, granted != next);
+            granted->state = WAITER_GRANTED;
+            waiting--;
+            xSemaphoreGive(granted->wake);
+        }
+        xSemaphoreGive(semaphore);
+    }
+
+    /// @brief Check if upstream is saturated, a wait or hold took OUTBOUND_CONGESTION_MS within OUTBOUND_CONGESTION_HOLD
+    /// @return bool
+    bool congested()
+    {
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        if (congestion && millis() - congestedAt >= OUTBOUND_CONGESTION_HOLD)
+        {
+            congestion = false;
+        }
+        bool result = congestion;
+        xSemaphoreGive(semaphore);
+        return result;
+    }
+
+    /// @brief Latency per traffic class
+    /// @param out Output object, one object per class
+    void toJson(JsonObject out)
+    {
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        for (int i = 0; i < TRAFFIC_CLASS_COUNT; i++)
+        {
+            const TrafficStats &entry = stats[i];
+            JsonObject item = out[className((TrafficClass)i)].to<JsonObject>();
+            item["grants"] = entry.grants;
+            item["promoted"] = entry.promoted;
+            item["waitAvgMs"] = entry.grants > 0 ? entry.waitTotal / entry.grants / 1000.0 : 0;
+            item["waitMaxMs"] = entry.waitMax / 1000.0;
+            item["holdMaxMs"] = entry.holdMax / 1000.0;
+        }
+        out["waiting"] = waiting;
+        out["congested"] = congestion && millis() - congestedAt < OUTBOUND_CONGESTION_HOLD;
+        xSemaphoreGive(semaphore);
+    }
+
+    static const char *className(TrafficClass trafficClass)
+    {
+        switch (trafficClass)
+        {
+        case TRAFFIC_CONTROL:
+            return "control";
+        case TRAFFIC_ACK:
+            return "ack";
+        case TRAFFIC_ONBOARDING:
+            return "onboarding";
+        case TRAFFIC_TELEMETRY:
+            return "telemetry";
+        case TRAFFIC_RESYNC:
+            return "resync";
+        default:
+            return "unknown";
+        }
+    }
+
+private:
+    enum WaiterState : uint8_t
+    {
+        WAITER_FREE,
+        WAITER_WAITING,
+        WAITER_GRANTED
+    };
+
+    struct Waiter
+    {
+        SemaphoreHandle_t wake = NULL;
+        WaiterState state = WAITER_FREE;
+        TrafficClass trafficClass = TRAFFIC_TELEMETRY;
+        unsigned long requested = 0; // micros()
+    };
+
+    SemaphoreHandle_t semaphore = NULL; // guards the scheduler state, held only briefly
+    Waiter waiters[OUTBOUND_MAX_WAITERS];
+    int waiting = 0;
+    bool busy = false;
+    TrafficClass owner = TRAFFIC_TELEMETRY;
+    unsigned long grantedAt = 0;
+    bool congestion = false;
+    unsigned long congestedAt = 0; // millis()
+    TrafficStats stats[TRAFFIC_CLASS_COUNT];
+
+    Waiter *enqueue(TrafficClass trafficClass, unsigned long requested)
+    {
+        for (int i = 0; i < OUTBOUND_MAX_WAITERS; i++)
+        {
+            if (waiters[i].state == WAITER_FREE)
+            {
+                waiters[i].state = WAITER_WAITING;
+                waiters[i].trafficClass = trafficClass;
+                waiters[i].requested = requested;
+                waiting++;
+                return &waiters[i];
+            }
+        }
+        return nullptr;
+    }
+
+    void grant(TrafficClass trafficClass, unsigned long requested, bool promoted)
+    {
+        busy = true;
+        owner = trafficClass;
+        grantedAt = micros();
+        uint32_t waited = grantedAt - requested;
+        TrafficStats &entry = stats[trafficClass];
+        entry.grants++;
+        entry.promoted += promoted ? 1 : 0;
+        entry.waitTotal += waited;
+        entry.waitMax = max(entry.waitMax, waited);
+        if (waited >= OUTBOUND_CONGESTION_MS * 1000UL)
+        {
+            congestedAt = millis();
+            congestion = true;
+        }
+    }
+};
+
+#endif
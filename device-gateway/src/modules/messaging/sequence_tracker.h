@@ -0,0 +1,204 @@
+#ifndef SEQUENCE_TRACKER_H
+#define SEQUENCE_TRACKER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <string>
+#include <unordered_map>
+#include "../system/scoped_lock.h"
+
+#define SEQUENCE_WINDOW 64 // sliding window (bits), older sequence numbers are stale
+
+enum SequenceResult
+{
+    SEQUENCE_ACCEPTED,  // new, in order (or first packet / untracked)
+    SEQUENCE_REORDERED, // new, but older than the highest seen
+    SEQUENCE_DUPLICATE, // already seen within the window
+    SEQUENCE_STALE      // older than the window
+};
+
+/// @brief Sequence state and link statistics of a single device
+struct SequenceState
+{
+    uint32_t boot = 0;         // boot id of the device, a new one means the counter restarted
+    uint32_t highest = 0;      // highest sequence number seen
+    uint32_t first = 0;        // lowest sequence number seen since the device booted
+    uint64_t window = 0;       // bit i set: highest - i was seen
+    uint32_t received = 0;     // unique packets
+    uint32_t receivedBoot = 0; // unique packets since the device booted
+    uint32_t lostBefore = 0;   // lost packets of earlier boots
+    uint32_t duplicates = 0;
+    uint32_t stale = 0;
+    uint32_t reordered = 0;
+    uint32_t restarts = 0;
+    unsigned long lastSeen = 0; // millis(), the least recently seen device is evicted from a full table
+
+    /// @brief Packets never received, reordered packets that are still on their way count as lost
+    uint32_t lost() const
+    {
+        return lostBefore + (highest - first + 1) - receivedBoot;
+    }
+};
+
+/// @brief Per device duplicate suppression and loss / reorder accounting, based on DeviceMessage::seq
+/// Anti-replay style sliding window: a bitmap of the last SEQUENCE_WINDOW sequence numbers below the highest seen.
+/// - seen within the window: duplicate, dropped
+/// - below the window: stale, dropped
+/// The counter restarts when a device reboots, a different boot id starts a new window (loss totals are kept).
+/// Sequence number 0 means the firmware has no sequence numbers, those packets are always accepted.
+/// Only onboarded devices are tracked (the caller decides), made up serials can't fill the table. The table holds
+/// the fleet (init()), if it is full anyway the least recently seen device is evicted: it restarts with a fresh
+/// window and fresh statistics on its next packet.
+/// Written by the UDP task, read by the web server, all methods are guarded by a mutex.
+class SequenceTracker
+{
+public:
+    SemaphoreHandle_t semaphore = NULL;
+
+    /// @brief Initialize the tracker, must be called before use
+    /// @param maxDevices Devices tracked at once, the fleet limit
+    void init(size_t maxDevices)
+    {
+        semaphore = xSemaphoreCreateMutex();
+        this->maxDevices = maxDevices;
+        devices.reserve(maxDevices);
+    }
+
+    /// @brief Check a packet against the device's window and record it
+    /// @param deviceSerial
+    /// @param boot Boot id of the device
+    /// @param seq
+    /// @param now millis()
+    /// @return SequenceResult (DUPLICATE and STALE packets should be dropped)
+    SequenceResult accept(const std::string &deviceSerial, uint32_t boot, uint32_t seq, unsigned long now)
+    {
+        if (seq == 0)
+        {
+            return SEQUENCE_ACCEPTED;
+        }
+
+        ScopedLock lock(semaphore);
+        auto it = devices.find(deviceSerial);
+        if (it == devices.end())
+        {
+            if (devices.size() >= maxDevices)
+            {
+                evictLeastRecent(now);
+            }
+            it = devices.insert(std::make_pair(deviceSerial, SequenceState())).first;
+            it->second.lastSeen = now;
+            restart(it->second, boot, seq);
+            return SEQUENCE_ACCEPTED;
+        }
+
+        SequenceState &state = it->second;
+        state.lastSeen = now;
+        if (boot != state.boot)
+        {
+            state.lostBefore = state.lost();
+            state.restarts++;
+            restart(state, boot, seq);
+            return SEQUENCE_ACCEPTED;
+        }
+
+        if (seq > state.highest)
+        {
+            uint32_t shift = seq - state.highest;
+            state.window = shift >= SEQUENCE_WINDOW ? 0 : state.window << shift;
+            state.window |= 1;
+            state.highest = seq;
+            state.received++;
+            state.receivedBoot++;
+            return SEQUENCE_ACCEPTED;
+        }
+
+        uint32_t offset = state.highest - seq;
+        if (offset >= SEQUENCE_WINDOW)
+        {
+            state.stale++;
+            return SEQUENCE_STALE;
+        }
+
+        uint64_t bit = (uint64_t)1 << offset;
+        if (state.window & bit)
+        {
+            state.duplicates++;
+            return SEQUENCE_DUPLICATE;
+        }
+        state.window |= bit;
+        if (seq < state.first)
+        {
+            state.first = seq; // overtaken by a later packet before the device was first seen
+        }
+        state.received++;
+        state.receivedBoot++;
+        state.reordered++;
+        return SEQUENCE_REORDERED;
+    }
+
+    /// @brief Stop tracking a device (e.g. deleted)
+    /// @param deviceSerial
+    void remove(const std::string &deviceSerial)
+    {
+        ScopedLock lock(semaphore);
+        devices.erase(deviceSerial);
+    }
+
+    /// @brief Link statistics of all tracked devices
+    /// @param links Output array, one object per device
+    void toJson(JsonArray links)
+    {
+        ScopedLock lock(semaphore);
+        for (auto it = devices.begin(); it != devices.end(); ++it)
+        {
+            const SequenceState &state = it->second;
+            uint32_t lost = state.lost();
+            uint32_t expected = state.received + lost;
+
+            JsonObject link = links.add<JsonObject>();
+            link["sn"] = it->first;
+            link["seq"] = state.highest;
+            link["received"] = state.received;
+            link["lost"] = lost;
+            link["duplicates"] = state.duplicates;
+            link["stale"] = state.stale;
+            link["reordered"] = state.reordered;
+            link["restarts"] = state.restarts;
+            link["lossRate"] = expected > 0 ? (float)lost / expected : 0;
+            link["reorderRate"] = state.received > 0 ? (float)state.reordered / state.received : 0;
+        }
+    }
+
+private:
+    std::unordered_map<std::string, SequenceState> devices;
+    size_t maxDevices = 0;
+
+    /// @brief Make room in a full table, O(n) but only when a device beyond the fleet limit shows up
+    void evictLeastRecent(unsigned long now)
+    {
+        auto oldest = devices.begin();
+        for (auto it = devices.begin(); it != devices.end(); ++it)
+        {
+            if (now - it->second.lastSeen > now - oldest->second.lastSeen)
+            {
+                oldest = it;
+            }
+        }
+        if (oldest != devices.end())
+        {
+            devices.erase(oldest);
+        }
+    }
+
+    static void restart(SequenceState &state, uint32_t boot, uint32_t seq)
+    {
+        state.boot = boot;
+        state.highest = seq;
+        state.first = seq;
+        state.window = 1;
+        state.received++;
+        state.receivedBoot = 1;
+    }
+};
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef BLOCK_POOL_H
+#define BLOCK_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Fixed size block pools, without Arduino dependencies (see StaticMemory, bench/static_pool_bench.cpp)
+
+#define BLOCK_POOL_CLASSES 6
+
+/// @brief A size class: block size (bytes, multiple of 8) and number of blocks
+struct BlockClass
+{
+    uint16_t size;
+    uint16_t blocks;
+};
+
+// smallest first, sized for the datapath: map nodes and strings (32-128, QoS 1 window slots keep theirs), JSON (256-2048)
+static const BlockClass BLOCK_POOL_LAYOUT[BLOCK_POOL_CLASSES] = {{32, 128}, {64, 96}, {128, 96}, {256, 32}, {512, 12}, {2048, 10}};
+#define BLOCK_POOL_BYTES (32 * 128 + 64 * 96 + 128 * 96 + 256 * 32 + 512 * 12 + 2048 * 10) // 57344
+
+/// @brief Counters of a size class
+struct BlockClassStats
+{
+    uint16_t used;
+    uint16_t peak;
+    uint32_t spilled;   // requests of this class served by a larger class
+    uint32_t exhausted; // requests of this class no block was left for
+};
+
+/// @brief Blocks of fixed sizes carved from one static buffer, O(1) allocate and release
+/// A request takes a block of the smallest class that fits it, or of a larger class if that one is used up.
+/// Released blocks go on the free list of their class (found by address), so memory never fragments and the
+/// pool never grows: once the peaks are reached, allocating and releasing only moves blocks between lists.
+/// Constant initialized (all zero), usable before the global constructors ran. Not thread safe.
+class BlockPool
+{
+public:
+    /// @brief Take a block
+    /// @param size
+    /// @return void* (nullptr if no block fits, larger than the largest class or every fitting class used up)
+    void *allocate(size_t size)
+    {
+        int first = classOf(size);
+        if (first < 0)
+        {
+            oversize++;
+            return nullptr;
+        }
+        for (int c = first; c < BLOCK_POOL_CLASSES; c++)
+        {
+            void *block = take(c);
+            if (block != nullptr)
+            {
+                if (c != first)
+                {
+                    stats[first].spilled++;
+                }
+                return block;
+            }
+        }
+        stats[first].exhausted++;
+        return nullptr;
+    }
+
+    /// @brief Give a block back
+    /// @param block
+    /// @return bool (false if the block is not from this pool)
+    bool release(void *block)
+    {
+        int c = classOfBlock(block);
+        if (c < 0)
+        {
+            return false;
+        }
+        *(void **)block = freeList[c];
+        freeList[c] = block;
+        stats[c].used--;
+        return true;
+    }
+
+    /// @brief Size of a block
+    /// @param block
+    /// @return size_t (0 if the block is not from this pool)
+    size_t blockSize(const void *block) const
+    {
+        int c = classOfBlock(block);
+        return c < 0 ? 0 : BLOCK_POOL_LAYOUT[c].size;
+    }
+
+    /// @brief Bytes in blocks that are handed out
+    size_t usedBytes() const
+    {
+        size_t bytes = 0;
+        for (int c = 0; c < BLOCK_POOL_CLASSES; c++)
+        {
+            bytes += (size_t)stats[c].used * BLOCK_POOL_LAYOUT[c].size;
+        }
+        return bytes;
+    }
+
+    BlockClassStats stats[BLOCK_POOL_CLASSES] = {};
+    uint32_t oversize = 0; // requests larger than the largest class
+
+private:
+    alignas(8) uint8_t memory[BLOCK_POOL_BYTES] = {};
+    void *freeList[BLOCK_POOL_CLASSES] = {};
+    uint16_t carved[BLOCK_POOL_CLASSES] = {}; // blocks never handed out are carved on demand, no init pass
+
+    static size_t offsetOf(int c)
+    {
+        size_t offset = 0;
+        for (int i = 0; i < c; i++)
+        {
+            offset += (size_t)BLOCK_POOL_LAYOUT[i].size * BLOCK_POOL_LAYOUT[i].blocks;
+        }
+        return offset;
+    }
+
+    static int classOf(size_t size)
+    {
+        for (int c = 0; c < BLOCK_POOL_CLASSES; c++)
+        {
+            if (size <= BLOCK_POOL_LAYOUT[c].size)
+            {
+                return c;
+            }
+        }
+        return -1;
+    }
+
+    int classOfBlock(const void *block) const
+    {
+        const uint8_t *address = (const uint8_t *)block;
+        if (address < memory || address >= memory + BLOCK_POOL_BYTES)
+        {
+            return -1;
+        }
+        size_t offset = address - memory;
+        for (int c = BLOCK_POOL_CLASSES - 1; c >= 0; c--)
+        {
+            if (offset >= offsetOf(c))
+            {
+                return c;
+            }
+        }
+        return -1;
+    }
+
+    void *take(int c)
+    {
+        void *block = freeList[c];
+        if (block != nullptr)
+        {
+            freeList[c] = *(void **)block;
+        }
+        else if (carved[c] < BLOCK_POOL_LAYOUT[c].blocks)
+        {
+            block = memory + offsetOf(c) + (size_t)carved[c]++ * BLOCK_POOL_LAYOUT[c].size;
+        }
+        else
+        {
+            return nullptr;
+        }
+        stats[c].used++;
+        stats[c].peak = stats[c].used > stats[c].peak ? stats[c].used : stats[c].peak;
+        return block;
+    }
+};
+
+#endif // BLOCK_POOL_H
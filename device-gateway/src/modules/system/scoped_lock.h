@@ -0,0 +1,23 @@
+#ifndef SCOPED_LOCK_H
+#define SCOPED_LOCK_H
+
+#include <Arduino.h>
+
+/// @brief Scoped mutex, takes the semaphore for the lifetime of the object
+/// Shared by the modules that are used from more than one task (UDP, MQTT, loop, web server).
+struct ScopedLock
+{
+    SemaphoreHandle_t semaphore;
+    ScopedLock(SemaphoreHandle_t semaphore) : semaphore(semaphore)
+    {
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+    }
+    ~ScopedLock()
+    {
+        xSemaphoreGive(semaphore);
+    }
+    ScopedLock(const ScopedLock &) = delete;
+    ScopedLock &operator=(const ScopedLock &) = delete;
+};
+
+#endif
@@ -0,0 +1,267 @@
+#ifndef STATIC_MEMORY_H
+#define STATIC_MEMORY_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <string.h>
+#include "block_pool.h"
+
+#define STATIC_MEMORY_WATCHED 4 // datapath tasks whose heap allocations are counted separately
+
+/// @brief Allocation counters of a watched task
+struct WatchedTask
+{
+    const char *name;
+    TaskHandle_t task;
+    uint32_t heapAllocations; // after arm()
+    uint32_t lastSize;        // bytes, of the last one
+};
+
+/// @brief Memory of the static allocation mode (GATEWAY_STATIC_ALLOCATION): a fixed block pool behind operator new
+/// Every C++ allocation (std::string, containers, std::function) takes a pool block, only requests the pool can't
+/// serve fall back to the heap. Those are counted: after arm() (boot and warm-up done) the datapath tasks are
+/// expected to allocate nothing from the heap, every fallback is attributed to the task that made it.
+/// JSON documents of the datapath get their memory through PoolJsonAllocator, pool only: a payload that doesn't
+/// fit is refused (NoMemory) instead of growing the heap.
+/// Constant initialized, operator new may run before the global constructors. Guarded by a spinlock, the pool
+/// is shared by every task.
+class StaticMemory
+{
+public:
+    /// @brief Take a pool block, or heap memory if no block fits (counted)
+    /// @param size
+    /// @return void* (nullptr if the heap is exhausted too)
+    void *allocate(size_t size)
+    {
+        portENTER_CRITICAL(&mux);
+        void *block = pool.allocate(size);
+        if (block == nullptr)
+        {
+            countHeapAllocation(size);
+        }
+        portEXIT_CRITICAL(&mux);
+        return block != nullptr ? block : malloc(size);
+    }
+
+    /// @brief Give memory back, to the pool or the heap
+    /// @param block
+    void release(void *block)
+    {
+        if (block == nullptr)
+        {
+            return;
+        }
+        portENTER_CRITICAL(&mux);
+        bool pooled = pool.release(block);
+        portEXIT_CRITICAL(&mux);
+        if (!pooled)
+        {
+            free(block);
+        }
+    }
+
+    /// @brief Take a pool block for a JSON document, no heap fallback
+    /// @param size
+    /// @return void* (nullptr if no block fits, the document reports NoMemory)
+    void *allocateJson(size_t size)
+    {
+        portENTER_CRITICAL(&mux);
+        void *block = pool.allocate(size);
+        jsonRefused += block == nullptr ? 1 : 0;
+        portEXIT_CRITICAL(&mux);
+        return block;
+    }
+
+    /// @brief Resize a JSON block, in place if it still fits its block
+    /// @param block
+    /// @param size
+    /// @return void* (nullptr if no block fits, the old block stays valid)
+    void *reallocateJson(void *block, size_t size)
+    {
+        if (block == nullptr)
+        {
+            return allocateJson(size);
+        }
+        portENTER_CRITICAL(&mux);
+        size_t current = pool.blockSize(block);
+        portEXIT_CRITICAL(&mux);
+        if (current == 0)
+        {
+            return realloc(block, size); // not from the pool
+        }
+        if (size <= current)
+        {
+            return block;
+        }
+        void *moved = allocateJson(size);
+        if (moved != nullptr)
+        {
+            memcpy(moved, block, current);
+            release(block);
+        }
+        return moved;
+    }
+
+    /// @brief Count the heap allocations of a task separately
+    /// @param name
+    /// @param task
+    void watch(const char *name, TaskHandle_t task)
+    {
+        portENTER_CRITICAL(&mux);
+        if (watchedCount < STATIC_MEMORY_WATCHED)
+        {
+            watched[watchedCount++] = {name, task, 0, 0};
+        }
+        portEXIT_CRITICAL(&mux);
+    }
+
+    /// @brief Steady state from here on: heap allocations are counted against their task
+    void arm()
+    {
+        portENTER_CRITICAL(&mux);
+        armed = true;
+        portEXIT_CRITICAL(&mux);
+    }
+
+    bool isArmed()
+    {
+        return armed;
+    }
+
+    /// @brief Heap allocations of the watched tasks since arm()
+    uint32_t getSteadyHeapAllocations()
+    {
+        uint32_t total = 0;
+        portENTER_CRITICAL(&mux);
+        for (int i = 0; i < watchedCount; i++)
+        {
+            total += watched[i].heapAllocations;
+        }
+        portEXIT_CRITICAL(&mux);
+        return total;
+    }
+
+    /// @brief Copy of a watched task's counters
+    /// @param index
+    /// @param out
+    /// @return bool (false past the last watched task)
+    bool getWatched(int index, WatchedTask &out)
+    {
+        portENTER_CRITICAL(&mux);
+        bool found = index < watchedCount;
+        if (found)
+        {
+            out = watched[index];
+        }
+        portEXIT_CRITICAL(&mux);
+        return found;
+    }
+
+    /// @brief Pool layout and counters, allocation counters
+    /// @param out Output object: {poolBytes, usedBytes, classes: [...], armed, heapAllocations: {...}, jsonRefused}
+    void toJson(JsonObject out)
+    {
+        // copied under the lock, the output allocates
+        portENTER_CRITICAL(&mux);
+        BlockClassStats stats[BLOCK_POOL_CLASSES];
+        memcpy(stats, pool.stats, sizeof(stats));
+        size_t used = pool.usedBytes();
+        uint32_t oversize = pool.oversize;
+        uint32_t refused = jsonRefused;
+        uint32_t boot = bootHeapAllocations;
+        uint32_t other = otherHeapAllocations;
+        portEXIT_CRITICAL(&mux);
+
+        out["poolBytes"] = BLOCK_POOL_BYTES;
+        out["usedBytes"] = used;
+        JsonArray classes = out["classes"].to<JsonArray>();
+        for (int c = 0; c < BLOCK_POOL_CLASSES; c++)
+        {
+            JsonObject item = classes.add<JsonObject>();
+            item["size"] = BLOCK_POOL_LAYOUT[c].size;
+            item["blocks"] = BLOCK_POOL_LAYOUT[c].blocks;
+            item["used"] = stats[c].used;
+            item["peak"] = stats[c].peak;
+            item["spilled"] = stats[c].spilled;
+            item["exhausted"] = stats[c].exhausted;
+        }
+        out["oversize"] = oversize;
+        out["armed"] = armed;
+        JsonObject heap = out["heapAllocations"].to<JsonObject>();
+        heap["boot"] = boot;
+        WatchedTask task;
+        for (int i = 0; getWatched(i, task); i++)
+        {
+            heap[task.name] = task.heapAllocations;
+        }
+        heap["other"] = other; // e.g. web server requests, not part of the datapath
+        out["jsonRefused"] = refused;
+    }
+
+private:
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+    BlockPool pool;
+    WatchedTask watched[STATIC_MEMORY_WATCHED] = {};
+    int watchedCount = 0;
+    bool armed = false;
+    uint32_t bootHeapAllocations = 0;
+    uint32_t otherHeapAllocations = 0;
+    uint32_t jsonRefused = 0;
+
+    /// @brief The lock must be held
+    void countHeapAllocation(size_t size)
+    {
+        if (!armed)
+        {
+            bootHeapAllocations++;
+            return;
+        }
+        TaskHandle_t current = xTaskGetCurrentTaskHandle();
+        for (int i = 0; i < watchedCount; i++)
+        {
+            if (watched[i].task == current)
+            {
+                watched[i].heapAllocations++;
+                watched[i].lastSize = size;
+                return;
+            }
+        }
+        otherHeapAllocations++;
+    }
+};
+
+/// @brief Memory of the datapath JSON documents: pool blocks in the static allocation mode, the heap otherwise
+class PoolJsonAllocator : public ArduinoJson::Allocator
+{
+public:
+    /// @brief Constructor
+    /// @param memory Static memory, nullptr for the heap
+    PoolJsonAllocator(StaticMemory *memory) : memory(memory) {}
+
+    void *allocate(size_t size) override
+    {
+        return memory != nullptr ? memory->allocateJson(size) : malloc(size);
+    }
+
+    void deallocate(void *pointer) override
+    {
+        if (memory != nullptr)
+        {
+            memory->release(pointer);
+        }
+        else
+        {
+            free(pointer);
+        }
+    }
+
+    void *reallocate(void *pointer, size_t size) override
+    {
+        return memory != nullptr ? memory->reallocateJson(pointer, size) : realloc(pointer, size);
+    }
+
+private:
+    StaticMemory *memory;
+};
+
+#endif // STATIC_MEMORY_H
@@ -0,0 +1,153 @@
+#ifndef BOOT_PROFILE_H
+#define BOOT_PROFILE_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <string.h>
+#include "../system/scoped_lock.h"
+
+#define BOOT_PROFILE_MAX_SPANS 16
+#define BOOT_PROFILE_MAX_MILESTONES 8
+
+/// @brief Timed span of the boot, start and end in millis() since power on
+struct BootSpan
+{
+    const char *name = nullptr;
+    unsigned long start = 0;
+    unsigned long end = 0; // 0 while running
+};
+
+/// @brief Boot profile: how long every init phase took, and when the gateway became useful
+/// - step(): the sequential phases of setup(), every step ends the previous one
+/// - begin() / end(): spans that run next to setup(), e.g. WiFi associating while the assets load
+/// - milestone(): first time something happened (WiFi up, MQTT connected, first reading forwarded)
+/// Every finished span is logged. Spans and milestones are recorded from several tasks, guarded by a mutex.
+class BootProfile
+{
+public:
+    /// @brief Initialize the profile, first thing in setup()
+    void init()
+    {
+        semaphore = xSemaphoreCreateMutex();
+    }
+
+    /// @brief End the current setup phase and start the next one
+    /// @param name Static string, nullptr to only end the current phase
+    void step(const char *name)
+    {
+        if (current >= 0)
+        {
+            end(current);
+        }
+        current = name != nullptr ? begin(name) : -1;
+    }
+
+    /// @brief Start a span
+    /// @param name Static string
+    /// @return int span handle for end() (-1 if the profile is full)
+    int begin(const char *name)
+    {
+        ScopedLock lock(semaphore);
+        if (spanCount >= BOOT_PROFILE_MAX_SPANS)
+        {
+            return -1;
+        }
+        BootSpan &span = spans[spanCount];
+        span.name = name;
+        span.start = millis();
+        return spanCount++;
+    }
+
+    /// @brief End a span
+    /// @param handle From begin()
+    void end(int handle)
+    {
+        unsigned long duration;
+        {
+            ScopedLock lock(semaphore);
+            if (handle < 0 || handle >= spanCount || spans[handle].end != 0)
+            {
+                return;
+            }
+            spans[handle].end = max(millis(), 1UL);
+            duration = spans[handle].end - spans[handle].start;
+        }
+        Serial.print("+ Boot phase ");
+        Serial.print(spans[handle].name);
+        Serial.print(": ");
+        Serial.print(duration);
+        Serial.println(" ms");
+    }
+
+    /// @brief Record the first time something happened, later calls are ignored
+    /// @param name Static string
+    void milestone(const char *name)
+    {
+        if (reached(name))
+        {
+            return;
+        }
+        {
+            ScopedLock lock(semaphore);
+            if (milestoneCount >= BOOT_PROFILE_MAX_MILESTONES || reached(name))
+            {
+                return;
+            }
+            milestones[milestoneCount].name = name;
+            milestones[milestoneCount].start = millis();
+            milestoneCount++;
+        }
+        Serial.print("+ Boot milestone ");
+        Serial.print(name);
+        Serial.print(" after ");
+        Serial.print(millis());
+        Serial.println(" ms");
+    }
+
+    /// @brief Check if a milestone was reached, cheap enough for hot paths (a handful of entries, no lock)
+    /// @param name
+    bool reached(const char *name)
+    {
+        for (int i = 0; i < milestoneCount; i++)
+        {
+            if (strcmp(milestones[i].name, name) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// @brief Spans and milestones, times in ms since power on
+    /// @param out Output object: spans [{name, start, ms}], milestones {name: ms}
+    void toJson(JsonObject out)
+    {
+        ScopedLock lock(semaphore);
+        JsonArray spanArray = out["spans"].to<JsonArray>();
+        for (int i = 0; i < spanCount; i++)
+        {
+            JsonObject span = spanArray.add<JsonObject>();
+            span["name"] = spans[i].name;
+            span["start"] = spans[i].start;
+            if (spans[i].end != 0)
+            {
+                span["ms"] = spans[i].end - spans[i].start;
+            }
+        }
+        JsonObject milestoneObject = out["milestones"].to<JsonObject>();
+        for (int i = 0; i < milestoneCount; i++)
+        {
+            milestoneObject[milestones[i].name] = milestones[i].start;
+        }
+    }
+
+private:
+    SemaphoreHandle_t semaphore = NULL;
+    BootSpan spans[BOOT_PROFILE_MAX_SPANS];
+    BootSpan milestones[BOOT_PROFILE_MAX_MILESTONES];
+    volatile int spanCount = 0;
+    volatile int milestoneCount = 0;
+    int current = -1; // open setup() phase
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef EVENT_STREAM_H
+#define EVENT_STREAM_H
+
+#include <string>
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+
+// event names, used by the web interface (EventSource.addEventListener)
+#define STREAM_EVENT_STATUS "status"
+#define STREAM_EVENT_ATTRIBUTE "attribute"
+#define STREAM_EVENT_ONBOARDING "onboarding"
+
+/// @brief Server-Sent Events stream for the web interface
+/// Pushes attribute updates, onboarding state changes and system metrics to every connected browser.
+/// Each event is serialized once and fanned out to all subscribers, nothing is serialized without subscribers.
+/// Events are published from multiple tasks (UDP, MQTT callback, loop), sending is guarded by a mutex.
+class EventStream
+{
+public:
+    AsyncEventSource source;
+    SemaphoreHandle_t semaphore = NULL;
+    uint32_t lastEventId = 0;
+
+    /// @brief Constructor
+    /// @param url Url of the stream
+    EventStream(const char *url) : source(url)
+    {
+    }
+
+    /// @brief Initialize the event stream, must be called before publishing
+    void init()
+    {
+        semaphore = xSemaphoreCreateMutex();
+    }
+
+    /// @brief Check if any browser is subscribed
+    /// @return bool
+    bool hasSubscribers()
+    {
+        return source.count() > 0;
+    }
+
+    /// @brief Publish an event to all subscribers
+    /// @param event Event name
+    /// @param doc Event data
+    void publish(const char *event, JsonDocument &doc)
+    {
+        if (!hasSubscribers())
+        {
+            return;
+        }
+        std::string payload;
+        serializeJson(doc, payload);
+        publish(event, payload);
+    }
+
+    /// @brief Publish an already serialized event to all subscribers
+    /// @param event Event name
+    /// @param payload Event data (JSON)
+    void publish(const char *event, const std::string &payload)
+    {
+        if (semaphore == NULL || !hasSubscribers())
+        {
+            return;
+        }
+        if (xSemaphoreTake(semaphore, portMAX_DELAY) == pdTRUE)
+        {
+            source.send(payload.c_str(), event, ++lastEventId);
+            xSemaphoreGive(semaphore);
+        }
+    }
+};
+
+#endif
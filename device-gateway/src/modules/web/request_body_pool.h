@@ -0,0 +1,222 @@
+#ifndef REQUEST_BODY_POOL_H
+#define REQUEST_BODY_POOL_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+#define REQUEST_BODY_SLOTS 2          // concurrent uploads
+#define REQUEST_BODY_MAX_SIZE 8192    // per request, asset json is a few KB
+#define REQUEST_BODY_TIMEOUT 10000    // ms without a chunk before a slot is reclaimed
+#define REQUEST_BODY_MAX_JSON_DEPTH 16
+
+/// @brief Incremental JSON structure check, fed chunk by chunk as the body arrives
+/// Tracks nesting and strings only, so malformed or truncated bodies are rejected before they are fully buffered.
+/// The values themselves are parsed once the body is complete.
+struct JsonBodyScanner
+{
+    int depth = 0;
+    bool inString = false;
+    bool escaped = false;
+    bool started = false;
+    bool complete = false;
+    bool error = false;
+
+    void reset()
+    {
+        *this = JsonBodyScanner();
+    }
+
+    /// @brief Scan the next chunk
+    /// @return bool (false if the body can't be valid JSON)
+    bool feed(const uint8_t *data, size_t len)
+    {
+        for (size_t i = 0; i < len && !error; i++)
+        {
+            char c = (char)data[i];
+            if (inString)
+            {
+                if (escaped)
+                {
+                    escaped = false;
+                }
+                else if (c == '\\')
+                {
+                    escaped = true;
+                }
+                else if (c == '"')
+                {
+                    inString = false;
+                }
+                continue;
+            }
+
+            bool whitespace = c == ' ' || c == '\n' || c == '\r' || c == '\t';
+            if (complete)
+            {
+                error = !whitespace; // trailing data after the root object
+                continue;
+            }
+            if (!started)
+            {
+                if (whitespace)
+                {
+                    continue;
+                }
+                started = true;
+                error = c != '{'; // asset json is always an object
+            }
+
+            if (c == '{' || c == '[')
+            {
+                depth++;
+                error = depth > REQUEST_BODY_MAX_JSON_DEPTH;
+            }
+            else if (c == '}' || c == ']')
+            {
+                depth--;
+                error = depth < 0;
+                complete = depth == 0;
+            }
+            else if (c == '"')
+            {
+                inString = true;
+            }
+        }
+        return !error;
+    }
+};
+
+/// @brief A preallocated request body buffer
+struct RequestBodySlot
+{
+    AsyncWebServerRequest *request = nullptr; // owner, nullptr if free
+    uint8_t *data = nullptr;                  // REQUEST_BODY_MAX_SIZE + 1 (null terminator)
+    size_t length = 0;
+    unsigned long lastChunk = 0;
+    JsonBodyScanner scanner;
+};
+
+/// @brief Fixed pool of request body buffers for large (chunked) requests
+/// - buffers are allocated once at init, memory use doesn't depend on the number or size of requests
+/// - bodies larger than REQUEST_BODY_MAX_SIZE are refused before any data is buffered
+/// - slots are released on completion, on client disconnect, or reclaimed after REQUEST_BODY_TIMEOUT (answered with 408)
+/// Only used from the web server task (async_tcp), no locking required.
+class RequestBodyPool
+{
+public:
+    RequestBodySlot slots[REQUEST_BODY_SLOTS];
+
+    /// @brief Allocate the slot buffers
+    void init()
+    {
+        for (int i = 0; i < REQUEST_BODY_SLOTS; i++)
+        {
+            slots[i].data = new uint8_t[REQUEST_BODY_MAX_SIZE + 1];
+        }
+    }
+
+    /// @brief Claim a slot for a new request, abandoned slots are reclaimed first
+    /// @param request
+    /// @return RequestBodySlot* (nullptr if no slot is available)
+    RequestBodySlot *acquire(AsyncWebServerRequest *request)
+    {
+        reclaimExpired();
+        RequestBodySlot *slot = find(request);
+        if (slot == nullptr)
+        {
+            slot = findFree();
+        }
+        if (slot == nullptr)
+        {
+            return nullptr;
+        }
+
+        slot->request = request;
+        slot->length = 0;
+        slot->lastChunk = millis();
+        slot->scanner.reset();
+        return slot;
+    }
+
+    /// @brief Get the slot of a request
+    /// @param request
+    /// @return RequestBodySlot* (nullptr if the request has no slot)
+    RequestBodySlot *find(AsyncWebServerRequest *request)
+    {
+        for (int i = 0; i < REQUEST_BODY_SLOTS; i++)
+        {
+            if (slots[i].request == request)
+            {
+                return &slots[i];
+            }
+        }
+        return nullptr;
+    }
+
+    /// @brief Append a chunk to the slot, the chunk is scanned as it is copied
+    /// @return bool (false if the body is too large or malformed)
+    bool append(RequestBodySlot *slot, const uint8_t *data, size_t len)
+    {
+        if (slot->length + len > REQUEST_BODY_MAX_SIZE || !slot->scanner.feed(data, len))
+        {
+            return false;
+        }
+        memcpy(slot->data + slot->length, data, len);
+        slot->length += len;
+        slot->data[slot->length] = 0;
+        slot->lastChunk = millis();
+        return true;
+    }
+
+    /// @brief Release the slot of a request, no-op if it has none (e.g. already reclaimed)
+    /// @param request
+    void release(AsyncWebServerRequest *request)
+    {
+        RequestBodySlot *slot = find(request);
+        if (slot != nullptr)
+        {
+            slot->request = nullptr;
+            slot->length = 0;
+        }
+    }
+
+    /// @brief Number of slots in use
+    int used()
+    {
+        int count = 0;
+        for (int i = 0; i < REQUEST_BODY_SLOTS; i++)
+        {
+            if (slots[i].request != nullptr)
+            {
+                count++;
+            }
+        }
+        return count;
+    }
+
+    /// @brief Reclaim slots without a chunk for REQUEST_BODY_TIMEOUT, their requests are answered with 408
+    /// Called on every acquire and every chunk, so a stalled upload is reclaimed as soon as the server sees any traffic.
+    /// A request holding a slot is still connected (disconnects release it), so it can be answered here.
+    void reclaimExpired()
+    {
+        unsigned long now = millis();
+        for (int i = 0; i < REQUEST_BODY_SLOTS; i++)
+        {
+            if (slots[i].request != nullptr && (now - slots[i].lastChunk) > REQUEST_BODY_TIMEOUT)
+            {
+                AsyncWebServerRequest *request = slots[i].request;
+                slots[i].request = nullptr;
+                slots[i].length = 0;
+                request->send(408, "application/json", "{\"status\": \"error\"}");
+            }
+        }
+    }
+
+private:
+    RequestBodySlot *findFree()
+    {
+        return find(nullptr);
+    }
+};
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef STATIC_ASSETS_H
+#define STATIC_ASSETS_H
+
+#include <string>
+#include <vector>
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+#include <FS.h>
+
+#define STATIC_ASSETS_MANIFEST "/assets.json"
+
+/// @brief A gzipped web asset described by the manifest generated by scripts/build_web_assets.py
+struct StaticAsset
+{
+    std::string url;         // url the asset is served at
+    std::string file;        // gzipped file on the file system
+    std::string contentType; // content type of the uncompressed asset
+    std::string etag;        // quoted content hash
+    bool immutable = false;  // fingerprinted name, content never changes
+};
+
+/// @brief Serves the precompressed web interface
+/// Assets are sent as stored (Content-Encoding: gzip) with an ETag, fingerprinted assets are cached as immutable.
+/// Revalidation requests are answered with a 304 from memory, without touching the file system.
+class StaticAssets
+{
+public:
+    std::vector<StaticAsset> assets;
+    fs::FS &fs;
+
+    /// @brief Constructor
+    /// @param fs File system holding the manifest and the gzipped assets
+    StaticAssets(fs::FS &fs) : fs(fs)
+    {
+    }
+
+    /// @brief Load the asset manifest
+    /// @return bool (false if the manifest is missing or invalid)
+    bool load()
+    {
+        File file = fs.open(STATIC_ASSETS_MANIFEST, "r");
+        if (!file)
+        {
+            return false;
+        }
+
+        JsonDocument doc;
+        DeserializationError error = deserializeJson(doc, file);
+        file.close();
+        if (error)
+        {
+            return false;
+        }
+
+        assets.clear();
+        for (JsonObject entry : doc["assets"].as<JsonArray>())
+        {
+            StaticAsset asset;
+            asset.url = entry["url"].as<std::string>();
+            asset.file = entry["file"].as<std::string>();
+            asset.contentType = entry["type"].as<std::string>();
+            asset.etag = entry["etag"].as<std::string>();
+            asset.immutable = entry["immutable"].as<bool>();
+            assets.push_back(asset);
+        }
+        return !assets.empty();
+    }
+
+    /// @brief Get an asset by url
+    /// @param url
+    /// @return const StaticAsset* (nullptr if not found)
+    const StaticAsset *find(std::string url)
+    {
+        for (int i = 0; i < assets.size(); i++)
+        {
+            if (assets[i].url == url)
+            {
+                return &assets[i];
+            }
+        }
+        return nullptr;
+    }
+
+    /// @brief Register a GET handler for every asset in the manifest
+    /// @param server
+    void serve(AsyncWebServer &server)
+    {
+        for (int i = 0; i < assets.size(); i++)
+        {
+            server.on(assets[i].url.c_str(), HTTP_GET, [this, i](AsyncWebServerRequest *request)
+                      { send(request, assets[i]); });
+        }
+    }
+
+    /// @brief Send an asset, or a 304 if the client already has the current version
+    /// @param request
+    /// @param asset
+    void send(AsyncWebServerRequest *request, const StaticAsset &asset)
+    {
+        const char *cacheControl = asset.immutable ? "public, max-age=31536000, immutable" : "no-cache";
+
+        if (request->hasHeader("If-None-Match") && request->getHeader("If-None-Match")->value() == asset.etag.c_str())
+        {
+            AsyncWebServerResponse *response = request->beginResponse(304, "", "");
+            response->addHeader("ETag", asset.etag.c_str());
+            response->addHeader("Cache-Control", cacheControl);
+            request->send(response);
+            return;
+        }
+
+        AsyncWebServerResponse *response = request->beginResponse(fs, asset.file.c_str(), asset.contentType.c_str());
+        response->addHeader("Content-Encoding", "gzip");
+        response->addHeader("ETag", asset.etag.c_str());
+        response->addHeader("Cache-Control", cacheControl);
+        request->send(response);
+    }
+
+    /// @brief Send an asset by url
+    /// @param request
+    /// @param url
+    /// @return bool (false if the asset is not in the manifest)
+    bool send(AsyncWebServerRequest *request, std::string url)
+    {
+        const StaticAsset *asset = find(url);
+        if (asset == nullptr)
+        {
+            return false;
+        }
+        send(request, *asset);
+        return true;
+    }
+};
+
+#endif
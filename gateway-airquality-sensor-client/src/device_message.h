@@ -1,4 +1,5 @@
 
+#include <Arduino.h>
 #include <ArduinoJson.h>
 
 // onboarding messages
@@ -14,7 +15,8 @@ enum MessageType
 {
     ONBOARD_MESSAGE,
     DATA_MESSAGE,
-    ALIVE_MESSAGE
+    ALIVE_MESSAGE,
+    BATCH_MESSAGE // several readings, data: {"f":[fields],"r":[[age ms, values...]]}
 };
 
 struct DeviceMessage
@@ -24,6 +26,10 @@ struct DeviceMessage
     std::string device_type;
     std::string data;
     MessageType message_type;
+    uint32_t seq;  // per device message counter, lets the gateway drop duplicates and count lost packets
+    uint32_t boot; // random per boot, the counter starts over after a restart
+    uint16_t rx;   // receive window after an uplink (ms), the gateway holds downlinks for the device until then
+    uint32_t ack;  // id of the last downlink processed
 
     DeviceMessage(std::string device_name, std::string device_sn, std::string device_type, std::string data, MessageType message_type)
     {
@@ -32,16 +38,64 @@ struct DeviceMessage
         this->device_type = device_type;
         this->data = data;
         this->message_type = message_type;
+        this->seq = ++sequence();
+        this->boot = bootId();
+        this->rx = receiveWindow();
+        this->ack = acknowledged();
+    }
+
+    // every message that is created is sent, so one counter for the device
+    // kept in RTC memory across deep sleep, see SleepState
+    static uint32_t &sequence()
+    {
+        static uint32_t value = 0;
+        return value;
+    }
+
+    static uint32_t &bootId()
+    {
+        static uint32_t id = 0;
+        while (id == 0)
+        {
+            id = ESP.random() & 0xFFFFFF;
+        }
+        return id;
+    }
+
+    static uint16_t &receiveWindow()
+    {
+        static uint16_t value = 0;
+        return value;
+    }
+
+    static uint32_t &acknowledged()
+    {
+        static uint32_t value = 0;
+        return value;
     }
 
     std::string toJson()
     {
         JsonDocument doc;
-        doc["device_name"] = device_name;
+        // name and type can be left empty once onboarded (batches), the gateway knows them by the serial
+        if (!device_name.empty())
+        {
+            doc["device_name"] = device_name;
+        }
         doc["device_sn"] = device_sn;
-        doc["device_type"] = device_type;
+        if (!device_type.empty())
+        {
+            doc["device_type"] = device_type;
+        }
         doc["data"] = data;
         doc["message_type"] = (int)message_type;
+        doc["seq"] = seq;
+        doc["boot"] = boot;
+        if (rx != 0)
+        {
+            doc["rx"] = rx;
+            doc["ack"] = ack;
+        }
 
         std::string output;
         serializeJson(doc, output);
@@ -20,9 +20,272 @@ const char *deviceType = "AirQualitySensorAsset"; // Type of the device
 
 Adafruit_BME680 bme; // I2C
 
+// Deep sleep between readings (battery powered), the radio is only powered for the wake that sends a batch
+// Requires D0 (GPIO16) wired to RST. 0: stay awake in loop()
+#define SLEEP_MODE 0
+#define DOWNLINK_WINDOW 300 // ms listening for a downlink (commands, config) after an uplink
+#define WIFI_TIMEOUT 10000  // ms, a sleeping device gives up and keeps its readings for the next wake
+
+// Readings are buffered and sent together in one batch datagram
+#define BATCH_READINGS 4 // readings per datagram, at most BATCH_READINGS * measurementInterval old
+#define READING_FIELDS 5
+const char *readingFields[READING_FIELDS] = {"temperature", "humidity", "pressure", "gas", "altitude"};
+
+struct Reading
+{
+  unsigned long millis; // device clock, see deviceClock()
+  float values[READING_FIELDS];
+};
+
+Reading readings[BATCH_READINGS];
+int readingCount = 0;
+int batchReadings = BATCH_READINGS; // config "batch"
+
+unsigned long onboardingMillis = 0;
+unsigned long measurementMillis = 0;
+unsigned long measurementInterval = 30000; // 30 seconds, config "interval"
+unsigned long sleptMillis = 0;             // time spent in deep sleep since power on
+
+// Kept in RTC memory across deep sleep, everything else starts over on every wake
+#define SLEEP_STATE_MAGIC 0x5EE9A901
+struct SleepState
+{
+  uint32_t magic;
+  uint32_t sequence;
+  uint32_t boot;
+  uint32_t acknowledged;
+  uint32_t sleptMillis;
+  uint32_t measurementInterval;
+  uint8_t batchReadings;
+  uint8_t readingCount;
+  uint16_t reserved;
+  Reading readings[BATCH_READINGS];
+};
+
+// Milliseconds since power on, including deep sleep (millis() restarts on every wake)
+unsigned long deviceClock()
+{
+  return sleptMillis + millis();
+}
+
+void setupSensor()
+{
+  bme.begin();
+  bme.setTemperatureOversampling(BME680_OS_8X);
+  bme.setHumidityOversampling(BME680_OS_2X);
+  bme.setPressureOversampling(BME680_OS_4X);
+  bme.setIIRFilterSize(BME680_FILTER_SIZE_3);
+  bme.setGasHeater(320, 150);
+}
+
+// Read the sensor into the batch buffer, the oldest reading is dropped if the buffer is full (batch could not be sent)
+void takeReading()
+{
+  // perform the reading, don't constatly performReading
+  // causes excessive heat
+  bme.performReading();
+
+  if (readingCount == BATCH_READINGS)
+  {
+    memmove(&readings[0], &readings[1], sizeof(Reading) * (BATCH_READINGS - 1));
+    readingCount--;
+  }
+
+  Reading &reading = readings[readingCount++];
+  reading.millis = deviceClock();
+  reading.values[0] = bme.temperature;
+  reading.values[1] = bme.humidity;
+  reading.values[2] = bme.pressure / 100.0;
+  reading.values[3] = bme.gas_resistance / 1000.0;
+  reading.values[4] = bme.readAltitude(1013.25);
+}
+
+// Send the buffered readings as one batch message, oldest first
+// Only the serial is sent, the gateway knows the name and type from onboarding
+void sendBatch()
+{
+  JsonDocument data;
+  JsonArray fields = data["f"].to<JsonArray>();
+  for (int i = 0; i < READING_FIELDS; i++)
+  {
+    fields.add(readingFields[i]);
+  }
+
+  unsigned long now = deviceClock();
+  JsonArray rows = data["r"].to<JsonArray>();
+  for (int i = 0; i < readingCount; i++)
+  {
+    JsonArray row = rows.add<JsonArray>();
+    row.add(now - readings[i].millis); // age, the gateway has no common clock with the device
+    for (int j = 0; j < READING_FIELDS; j++)
+    {
+      row.add(readings[i].values[j]);
+    }
+  }
+  readingCount = 0;
+
+  DeviceMessage deviceMessage = DeviceMessage("", serialNumber, "", data.as<std::string>(), MessageType::BATCH_MESSAGE);
+
+  // Send the message
+  udp.beginPacket(udpServer, udpPort);
+  std::string message = deviceMessage.toJson();
+  udp.write(message.c_str(), message.length());
+  udp.endPacket();
+
+  Serial.println("Sent batch message: " + String(message.c_str()) + " to " + udpServer + ":" + udpPort);
+}
+
+// Downlink from the gateway mailbox: {"dl":id,"cmd":"...","cfg":{"interval":60000,"batch":4}}
+// Repeated until acknowledged, the id is sent back as ack with the next uplink
+void handleDownlink(const char *packet)
+{
+  JsonDocument doc;
+  if (deserializeJson(doc, packet))
+  {
+    return;
+  }
+
+  uint32_t id = doc["dl"];
+  if (id != DeviceMessage::acknowledged()) // not a repeat
+  {
+    JsonObject config = doc["cfg"];
+    if (config["interval"].is<unsigned long>())
+    {
+      measurementInterval = max(config["interval"].as<unsigned long>(), 1000UL);
+    }
+    if (config["batch"].is<int>())
+    {
+      batchReadings = constrain(config["batch"].as<int>(), 1, BATCH_READINGS);
+    }
+    Serial.println("Downlink applied, interval: " + String(measurementInterval) + " batch: " + String(batchReadings));
+  }
+  DeviceMessage::acknowledged() = id;
+}
+
+void handlePacket(const char *packetBuffer)
+{
+  Serial.println("Received packet: " + String(packetBuffer));
+
+  if (String(packetBuffer) == "ONBOARD_OK")
+  {
+    onBoarding = false; // Onboarding is complete
+    Serial.println("Onboarding complete");
+  }
+
+  if (String(packetBuffer) == "ONBOARD_REQ")
+  {
+    onBoarding = true; // Gateway is requesting onboarding
+    Serial.println("Onboarding started");
+  }
+
+  if (packetBuffer[0] == '{')
+  {
+    handleDownlink(packetBuffer);
+  }
+}
+
+// Check for incoming messages
+void receivePackets()
+{
+  int packetSize = udp.parsePacket();
+  if (packetSize > 0 && packetSize < 255)
+  {
+    char packetBuffer[255];
+    udp.read(packetBuffer, packetSize);
+    packetBuffer[packetSize] = '\0';
+    handlePacket(packetBuffer);
+  }
+}
+
+bool restoreSleepState()
+{
+  SleepState state;
+  if (!ESP.rtcUserMemoryRead(0, (uint32_t *)&state, sizeof(state)) || state.magic != SLEEP_STATE_MAGIC)
+  {
+    return false; // power on, not a wake from deep sleep
+  }
+  DeviceMessage::sequence() = state.sequence;
+  DeviceMessage::bootId() = state.boot;
+  DeviceMessage::acknowledged() = state.acknowledged;
+  sleptMillis = state.sleptMillis;
+  measurementInterval = state.measurementInterval;
+  batchReadings = state.batchReadings;
+  readingCount = min((int)state.readingCount, BATCH_READINGS);
+  memcpy(readings, state.readings, sizeof(readings));
+  return true;
+}
+
+// Save the state and sleep until the next reading, only the wake that sends a batch gets the radio
+void deepSleep()
+{
+  SleepState state;
+  state.magic = SLEEP_STATE_MAGIC;
+  state.sequence = DeviceMessage::sequence();
+  state.boot = DeviceMessage::bootId();
+  state.acknowledged = DeviceMessage::acknowledged();
+  state.sleptMillis = deviceClock() + measurementInterval;
+  state.measurementInterval = measurementInterval;
+  state.batchReadings = batchReadings;
+  state.readingCount = readingCount;
+  state.reserved = 0;
+  memcpy(state.readings, readings, sizeof(readings));
+  ESP.rtcUserMemoryWrite(0, (uint32_t *)&state, sizeof(state));
+
+  bool sendsNext = readingCount + 1 >= batchReadings;
+  Serial.println("Sleeping for " + String(measurementInterval) + "ms");
+  ESP.deepSleep((uint64_t)measurementInterval * 1000, sendsNext ? WAKE_RF_DEFAULT : WAKE_RF_DISABLED);
+}
+
+// One wake of a sleeping device: read, send the batch when it is full, listen for the downlink, sleep again
+void sleepCycle()
+{
+  setupSensor();
+  takeReading();
+  if (readingCount < batchReadings)
+  {
+    deepSleep();
+  }
+
+  WiFi.begin(ssid, password);
+  unsigned long wifiStart = millis();
+  while (WiFi.status() != WL_CONNECTED)
+  {
+    if (millis() - wifiStart > WIFI_TIMEOUT)
+    {
+      Serial.println("WiFi connection failed, batch kept for the next wake");
+      deepSleep();
+    }
+    delay(50);
+  }
+
+  udp.begin(udpPort);
+  sendBatch();
+
+  unsigned long listenStart = millis();
+  while (millis() - listenStart < DOWNLINK_WINDOW)
+  {
+    receivePackets();
+    delay(5);
+  }
+
+  if (!onBoarding)
+  {
+    deepSleep();
+  }
+  // the gateway asked to onboard again, stay awake in loop() until it is done
+}
+
 void setup()
 {
   Serial.begin(115200);
+  DeviceMessage::receiveWindow() = DOWNLINK_WINDOW;
+
+  if (SLEEP_MODE && restoreSleepState())
+  {
+    onBoarding = false; // only onboarded devices sleep
+    sleepCycle();       // ends in deep sleep, returns (connected) only if the gateway requests onboarding
+    return;
+  }
 
   WiFi.begin(ssid, password);
   while (WiFi.status() != WL_CONNECTED)
@@ -33,52 +296,22 @@ void setup()
   Serial.println("Connected to WiFi");
 
   udp.begin(udpPort);
-  bme.begin();
-
-  bme.begin();
-  bme.setTemperatureOversampling(BME680_OS_8X);
-  bme.setHumidityOversampling(BME680_OS_2X);
-  bme.setPressureOversampling(BME680_OS_4X);
-  bme.setIIRFilterSize(BME680_FILTER_SIZE_3);
-  bme.setGasHeater(320, 150);
+  setupSensor();
   Serial.println("UDP connection started");
 }
 
-unsigned long onboardingMillis = 0;
-unsigned long measurementMillis = 0;
-unsigned long measurementInterval = 30000; // 30 seconds
-
 void loop()
 {
 
   if (!onBoarding && millis() - measurementMillis > measurementInterval)
   {
-    // perform the reading, don't constatly performReading
-    // causes excessive heat
-    bme.performReading();
-    float temperature = bme.temperature;
-    float humidity = bme.humidity;
-    float pressure = bme.pressure / 100.0;
-    float gas = bme.gas_resistance / 1000.0;
-    float altitude = bme.readAltitude(1013.25);
-
     measurementMillis = millis();
-    JsonDocument data;
-    data["temperature"] = temperature;
-    data["humidity"] = humidity;
-    data["pressure"] = pressure;
-    data["gas"] = gas;
-    data["altitude"] = altitude;
+    takeReading();
 
-    DeviceMessage deviceMessage = DeviceMessage(deviceName, serialNumber, deviceType, data.as<std::string>(), MessageType::DATA_MESSAGE);
-
-    // Send the message
-    udp.beginPacket(udpServer, udpPort);
-    std::string message = deviceMessage.toJson();
-    udp.write(message.c_str(), message.length());
-    udp.endPacket();
-
-    Serial.println("Sent data message: " + String(message.c_str()) + " to " + udpServer + ":" + udpPort);
+    if (readingCount >= batchReadings)
+    {
+      sendBatch();
+    }
   }
 
   if (onBoarding && millis() - onboardingMillis > 5000) // Send onboarding message every 5 seconds
@@ -95,28 +328,14 @@ void loop()
     Serial.println("Sent onboarding message: " + String(message.c_str()) + " to " + udpServer + ":" + udpPort);
   }
 
-  // Check for incoming messages
-  int packetSize = udp.parsePacket();
-  if (packetSize)
-  {
-    char packetBuffer[255];
-    udp.read(packetBuffer, packetSize);
-    packetBuffer[packetSize] = '\0';
-    Serial.println("Received packet: " + String(packetBuffer));
-
-    if (String(packetBuffer) == "ONBOARD_OK")
-    {
-      onBoarding = false; // Onboarding is complete
-      Serial.println("Onboarding complete");
-    }
+  receivePackets();
 
-    if (String(packetBuffer) == "ONBOARD_REQ")
-    {
-      onBoarding = true; // Gateway is requesting onboarding
-      Serial.println("Onboarding started");
-    }
+  // Onboarded, from here on the device only wakes up for readings
+  if (SLEEP_MODE && !onBoarding)
+  {
+    deepSleep();
   }
 
   // Add a small delay, don't need to check the sensor every millisecond
   delay(2000);
-}
\ No newline at end of file
+}
@@ -19,9 +19,256 @@ const char *deviceName = "Humidity & Temperature Sensor"; // Name of the device
 const char *serialNumber = "PB10A-ORLZ1";                 // Serial number of the device
 const char *deviceType = "EnvironmentSensorAsset";        // Type of the device
 
+// Deep sleep between readings (battery powered), the radio is only powered for the wake that sends a batch
+// Requires D0 (GPIO16) wired to RST. 0: stay awake in loop()
+#define SLEEP_MODE 0
+#define DOWNLINK_WINDOW 300 // ms listening for a downlink (commands, config) after an uplink
+#define WIFI_TIMEOUT 10000  // ms, a sleeping device gives up and keeps its readings for the next wake
+#define DHT_WARMUP 2000     // ms the DHT22 needs after power up before the first reading
+
+// onboarding millis
+unsigned long onboardingMillis = 0;
+unsigned long measurementMillis = 0;
+unsigned long measurementInterval = 60000; // 60s, config "interval"
+unsigned long sleptMillis = 0;             // time spent in deep sleep since power on
+float lastTemperatureMeasurement = 0;
+float lastHumidityMeasurement = 0;
+
+// Readings are buffered and sent together in one batch datagram
+#define BATCH_READINGS 2 // readings per datagram, at most BATCH_READINGS * measurementInterval old
+
+struct Reading
+{
+  unsigned long millis; // device clock, see deviceClock()
+  float temperature;
+  float humidity;
+};
+
+Reading readings[BATCH_READINGS];
+int readingCount = 0;
+int batchReadings = BATCH_READINGS; // config "batch"
+
+// Kept in RTC memory across deep sleep, everything else starts over on every wake
+#define SLEEP_STATE_MAGIC 0x5EE9C201
+struct SleepState
+{
+  uint32_t magic;
+  uint32_t sequence;
+  uint32_t boot;
+  uint32_t acknowledged;
+  uint32_t sleptMillis;
+  uint32_t measurementInterval;
+  uint8_t batchReadings;
+  uint8_t readingCount;
+  uint16_t reserved;
+  Reading readings[BATCH_READINGS];
+};
+
+// Milliseconds since power on, including deep sleep (millis() restarts on every wake)
+unsigned long deviceClock()
+{
+  return sleptMillis + millis();
+}
+
+// Store a reading in the batch buffer, the oldest reading is dropped if the buffer is full (batch could not be sent)
+void storeReading(float temperature, float humidity)
+{
+  if (readingCount == BATCH_READINGS)
+  {
+    memmove(&readings[0], &readings[1], sizeof(Reading) * (BATCH_READINGS - 1));
+    readingCount--;
+  }
+
+  Reading &reading = readings[readingCount++];
+  reading.millis = deviceClock();
+  reading.temperature = temperature;
+  reading.humidity = humidity;
+}
+
+// Send the buffered readings as one batch message, oldest first
+// Only the serial is sent, the gateway knows the name and type from onboarding
+void sendBatch()
+{
+  JsonDocument data;
+  JsonArray fields = data["f"].to<JsonArray>();
+  fields.add("temperature");
+  fields.add("relativeHumidity");
+
+  unsigned long now = deviceClock();
+  JsonArray rows = data["r"].to<JsonArray>();
+  for (int i = 0; i < readingCount; i++)
+  {
+    JsonArray row = rows.add<JsonArray>();
+    row.add(now - readings[i].millis); // age, the gateway has no common clock with the device
+    row.add(readings[i].temperature);
+    row.add(readings[i].humidity);
+  }
+  readingCount = 0;
+
+  DeviceMessage deviceMessage = DeviceMessage("", serialNumber, "", data.as<std::string>(), MessageType::BATCH_MESSAGE);
+
+  // Send the message
+  udp.beginPacket(udpServer, udpPort);
+  std::string message = deviceMessage.toJson();
+  udp.write(message.c_str(), message.length());
+  udp.endPacket();
+
+  Serial.println("Sent batch message: " + String(message.c_str()) + " to " + udpServer + ":" + udpPort);
+}
+
+// Downlink from the gateway mailbox: {"dl":id,"cmd":"...","cfg":{"interval":60000,"batch":2}}
+// Repeated until acknowledged, the id is sent back as ack with the next uplink
+void handleDownlink(const char *packet)
+{
+  JsonDocument doc;
+  if (deserializeJson(doc, packet))
+  {
+    return;
+  }
+
+  uint32_t id = doc["dl"];
+  if (id != DeviceMessage::acknowledged()) // not a repeat
+  {
+    JsonObject config = doc["cfg"];
+    if (config["interval"].is<unsigned long>())
+    {
+      measurementInterval = max(config["interval"].as<unsigned long>(), (unsigned long)DHT_WARMUP + 1000);
+    }
+    if (config["batch"].is<int>())
+    {
+      batchReadings = constrain(config["batch"].as<int>(), 1, BATCH_READINGS);
+    }
+    Serial.println("Downlink applied, interval: " + String(measurementInterval) + " batch: " + String(batchReadings));
+  }
+  DeviceMessage::acknowledged() = id;
+}
+
+void handlePacket(const char *packetBuffer)
+{
+  Serial.println("Received packet: " + String(packetBuffer));
+
+  if (String(packetBuffer) == "ONBOARD_OK")
+  {
+    onBoarding = false; // Onboarding is complete
+    Serial.println("Onboarding complete");
+  }
+
+  if (String(packetBuffer) == "ONBOARD_REQ")
+  {
+    onBoarding = true; // Gateway is requesting onboarding
+    Serial.println("Onboarding started");
+  }
+
+  if (packetBuffer[0] == '{')
+  {
+    handleDownlink(packetBuffer);
+  }
+}
+
+// Check for incoming messages
+void receivePackets()
+{
+  int packetSize = udp.parsePacket();
+  if (packetSize > 0 && packetSize < 255)
+  {
+    char packetBuffer[255];
+    udp.read(packetBuffer, packetSize);
+    packetBuffer[packetSize] = '\0';
+    handlePacket(packetBuffer);
+  }
+}
+
+bool restoreSleepState()
+{
+  SleepState state;
+  if (!ESP.rtcUserMemoryRead(0, (uint32_t *)&state, sizeof(state)) || state.magic != SLEEP_STATE_MAGIC)
+  {
+    return false; // power on, not a wake from deep sleep
+  }
+  DeviceMessage::sequence() = state.sequence;
+  DeviceMessage::bootId() = state.boot;
+  DeviceMessage::acknowledged() = state.acknowledged;
+  sleptMillis = state.sleptMillis;
+  measurementInterval = state.measurementInterval;
+  batchReadings = state.batchReadings;
+  readingCount = min((int)state.readingCount, BATCH_READINGS);
+  memcpy(readings, state.readings, sizeof(readings));
+  return true;
+}
+
+// Save the state and sleep until the next reading, only the wake that sends a batch gets the radio
+void deepSleep()
+{
+  SleepState state;
+  state.magic = SLEEP_STATE_MAGIC;
+  state.sequence = DeviceMessage::sequence();
+  state.boot = DeviceMessage::bootId();
+  state.acknowledged = DeviceMessage::acknowledged();
+  state.sleptMillis = deviceClock() + measurementInterval - DHT_WARMUP;
+  state.measurementInterval = measurementInterval;
+  state.batchReadings = batchReadings;
+  state.readingCount = readingCount;
+  state.reserved = 0;
+  memcpy(state.readings, readings, sizeof(readings));
+  ESP.rtcUserMemoryWrite(0, (uint32_t *)&state, sizeof(state));
+
+  // the warm up delay is part of the interval
+  bool sendsNext = readingCount + 1 >= batchReadings;
+  Serial.println("Sleeping for " + String(measurementInterval - DHT_WARMUP) + "ms");
+  ESP.deepSleep((uint64_t)(measurementInterval - DHT_WARMUP) * 1000, sendsNext ? WAKE_RF_DEFAULT : WAKE_RF_DISABLED);
+}
+
+// One wake of a sleeping device: read, send the batch when it is full, listen for the downlink, sleep again
+void sleepCycle()
+{
+  dht.begin();
+  delay(DHT_WARMUP);
+  storeReading(dht.readTemperature(), dht.readHumidity());
+  if (readingCount < batchReadings)
+  {
+    deepSleep();
+  }
+
+  WiFi.begin(ssid, password);
+  unsigned long wifiStart = millis();
+  while (WiFi.status() != WL_CONNECTED)
+  {
+    if (millis() - wifiStart > WIFI_TIMEOUT)
+    {
+      Serial.println("WiFi connection failed, batch kept for the next wake");
+      deepSleep();
+    }
+    delay(50);
+  }
+
+  udp.begin(udpPort);
+  sendBatch();
+
+  unsigned long listenStart = millis();
+  while (millis() - listenStart < DOWNLINK_WINDOW)
+  {
+    receivePackets();
+    delay(5);
+  }
+
+  if (!onBoarding)
+  {
+    deepSleep();
+  }
+  // the gateway asked to onboard again, stay awake in loop() until it is done
+}
+
 void setup()
 {
   Serial.begin(115200);
+  DeviceMessage::receiveWindow() = DOWNLINK_WINDOW;
+
+  if (SLEEP_MODE && restoreSleepState())
+  {
+    onBoarding = false; // only onboarded devices sleep
+    sleepCycle();       // ends in deep sleep, returns (connected) only if the gateway requests onboarding
+    return;
+  }
 
   WiFi.begin(ssid, password);
   while (WiFi.status() != WL_CONNECTED)
@@ -36,13 +283,6 @@ void setup()
   Serial.println("UDP connection started");
 }
 
-// onboarding millis
-unsigned long onboardingMillis = 0;
-unsigned long measurementMillis = 0;
-unsigned long measurementInterval = 60000; // 60s
-float lastTemperatureMeasurement = 0;
-float lastHumidityMeasurement = 0;
-
 void loop()
 {
   float humidity = dht.readHumidity();
@@ -54,17 +294,11 @@ void loop()
     lastTemperatureMeasurement = temperature;
     measurementMillis = millis();
 
-    // Create a message
-    std::string data = "{\"temperature\":" + std::to_string(lastTemperatureMeasurement) + ",\"relativeHumidity\":" + std::to_string(lastHumidityMeasurement) + "}";
-    DeviceMessage deviceMessage = DeviceMessage(deviceName, serialNumber, deviceType, data, MessageType::DATA_MESSAGE);
-
-    // Send the message
-    udp.beginPacket(udpServer, udpPort);
-    std::string message = deviceMessage.toJson();
-    udp.write(message.c_str(), message.length());
-    udp.endPacket();
-
-    Serial.println("Sent message: " + String(message.c_str()) + " to " + udpServer + ":" + udpPort);
+    storeReading(lastTemperatureMeasurement, lastHumidityMeasurement);
+    if (readingCount >= batchReadings)
+    {
+      sendBatch();
+    }
   }
 
   if (onBoarding && millis() - onboardingMillis > 5000) // Send onboarding message every 5 seconds
@@ -81,28 +315,14 @@ void loop()
     Serial.println("Sent onboarding message: " + String(message.c_str()) + " to " + udpServer + ":" + udpPort);
   }
 
-  // Check for incoming messages
-  int packetSize = udp.parsePacket();
-  if (packetSize)
-  {
-    char packetBuffer[255];
-    udp.read(packetBuffer, packetSize);
-    packetBuffer[packetSize] = '\0';
-    Serial.println("Received packet: " + String(packetBuffer));
+  receivePackets();
 
-    if (String(packetBuffer) == "ONBOARD_OK")
-    {
-      onBoarding = false; // Onboarding is complete
-      Serial.println("Onboarding complete");
-    }
-
-    if (String(packetBuffer) == "ONBOARD_REQ")
-    {
-      onBoarding = true; // Gateway is requesting onboarding
-      Serial.println("Onboarding started");
-    }
+  // Onboarded, from here on the device only wakes up for readings
+  if (SLEEP_MODE && !onBoarding)
+  {
+    deepSleep();
   }
 
   // Add a small delay, don't need to check the PIR sensor every millisecond
   delay(100);
-}
\ No newline at end of file
+}
@@ -0,0 +1,323 @@
+#!/usr/bin/env python3
+"""Synthetic device fleet for the gateway's UDP ingestion path.
+
+Emulates N devices speaking the same DeviceMessage protocol as the gateway-*-client sketches:
+- ONBOARD_MESSAGE every 5s until ONBOARD_OK, back to onboarding on ONBOARD_REQ
+- BATCH_MESSAGE (climate and air quality sensors, several buffered readings per datagram), DATA_MESSAGE (presence)
+  or ALIVE_MESSAGE (plugs) at the client intervals, with jitter; --per-reading sends every reading as DATA_MESSAGE
+  like the firmware before batching
+- optional bursts (every device sends several readings back-to-back) and simultaneous start (site power cycle)
+
+Every device uses its own socket (the gateway replies to the sender address), so replies are attributed per device.
+DATA has no acknowledgement in the protocol; loss and round-trip time are measured with onboard probes, which an
+onboarded device answers with ONBOARD_OK every time.
+
+Example:
+    python load_generator.py --host 192.168.1.50 --devices 500 --duration 300 --interval-scale 0.1 --json report.json
+"""
+
+import argparse
+import asyncio
+import json
+import random
+import socket
+import time
+
+ONBOARD_MESSAGE, DATA_MESSAGE, ALIVE_MESSAGE, BATCH_MESSAGE = 0, 1, 2, 3
+ONBOARD_OK, ONBOARD_REQ = b"ONBOARD_OK", b"ONBOARD_REQ"
+ONBOARDING_INTERVAL = 5.0
+
+# device type -> (message type, reading interval in seconds, readings per batch datagram, reading generator),
+# matches the client sketches (BATCH_READINGS and measurementInterval: a batch every 120s from both sensor clients)
+DEVICE_TYPES = {
+    "PresenceSensorAsset": (DATA_MESSAGE, 10.0, 1, lambda r: "1" if r.random() < 0.2 else "0"),
+    "EnvironmentSensorAsset": (DATA_MESSAGE, 60.0, 2, lambda r: {
+        "temperature": round(r.uniform(18, 26), 2),
+        "relativeHumidity": round(r.uniform(30, 60), 2),
+    }),
+    "AirQualitySensorAsset": (DATA_MESSAGE, 30.0, 4, lambda r: {
+        "temperature": round(r.uniform(18, 26), 2),
+        "humidity": round(r.uniform(30, 60), 2),
+        "pressure": round(r.uniform(990, 1030), 2),
+        "gas": round(r.uniform(50, 300), 2),
+        "altitude": round(r.uniform(0, 50), 2),
+    }),
+    "PlugAsset": (ALIVE_MESSAGE, 10.0, 1, lambda r: ""),
+}
+
+
+def percentile(values, p):
+    if not values:
+        return None
+    values = sorted(values)
+    return values[min(len(values) - 1, int(round(p / 100.0 * (len(values) - 1))))]
+
+
+class Stats:
+    def __init__(self):
+        self.attempted = 0      # sends scheduled
+        self.sent = 0           # sends completed
+        self.send_errors = 0
+        self.late = 0           # sends that left more than 100ms after their scheduled time (generator overloaded)
+        self.bytes_sent = 0
+        self.readings = 0       # sensor readings sent, several per batch datagram
+        self.probes_sent = 0
+        self.probes_answered = 0
+        self.probe_rtts = []
+        self.onboard_times = []  # seconds from device start to ONBOARD_OK
+        self.reonboard_requests = 0  # ONBOARD_REQ received while onboarded (gateway lost the device)
+
+
+class Device(asyncio.DatagramProtocol):
+    def __init__(self, index, device_type, args, stats, rng, loop):
+        self.name = "Load Test %s %d" % (device_type, index)
+        self.sn = "%s-%05d" % (args.serial_prefix, index)
+        self.type = device_type
+        self.args = args
+        self.stats = stats
+        self.rng = rng
+        self.loop = loop
+        message_type, interval, batch, payload = DEVICE_TYPES[device_type]
+        self.message_type = message_type
+        self.interval = interval * args.interval_scale
+        self.batch = 1 if args.per_reading else batch
+        self.payload = payload
+        self.buffered = []  # (time, reading) not sent yet, oldest first
+        self.transport = None
+        self.onboarded = False
+        self.started = None
+        self.pending_probe = None
+        self.timers = {}  # pending timer per tick type
+        self.seq = 0  # per device message counter, like the client firmware
+        self.boot = rng.randrange(1, 1 << 24)
+
+    # asyncio.DatagramProtocol
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def datagram_received(self, data, addr):
+        if data == ONBOARD_OK:
+            if self.pending_probe is not None:
+                self.stats.probes_answered += 1
+                self.stats.probe_rtts.append(time.monotonic() - self.pending_probe)
+                self.pending_probe = None
+            if not self.onboarded:
+                self.onboarded = True
+                self.stats.onboard_times.append(time.monotonic() - self.started)
+        elif data == ONBOARD_REQ:
+            if self.onboarded:
+                self.stats.reonboard_requests += 1
+            self.onboarded = False
+
+    def error_received(self, exc):
+        self.stats.send_errors += 1
+
+    def message(self, message_type, data=""):
+        return json.dumps({
+            "device_name": self.name,
+            "device_sn": self.sn,
+            "device_type": self.type,
+            "data": data,
+            "message_type": message_type,
+            "seq": self.next_seq(),
+            "boot": self.boot,
+        }, separators=(",", ":")).encode("utf-8")
+
+    def batch_message(self):
+        """Buffered readings as one BATCH_MESSAGE, like sendBatch() in the sensor clients (serial only, ages in ms)"""
+        now = time.monotonic()
+        fields = list(self.buffered[0][1].keys())
+        rows = [[int((now - taken) * 1000)] + [reading[field] for field in fields] for taken, reading in self.buffered]
+        return json.dumps({
+            "device_sn": self.sn,
+            "data": json.dumps({"f": fields, "r": rows}, separators=(",", ":")),
+            "message_type": BATCH_MESSAGE,
+            "seq": self.next_seq(),
+            "boot": self.boot,
+        }, separators=(",", ":")).encode("utf-8")
+
+    def reading(self):
+        reading = self.payload(self.rng)
+        return reading if isinstance(reading, str) else json.dumps(reading)
+
+    def next_seq(self):
+        self.seq += 1
+        return self.seq
+
+    def send(self, payload, scheduled):
+        self.stats.attempted += 1
+        if time.monotonic() - scheduled > 0.1:
+            self.stats.late += 1
+        try:
+            self.transport.sendto(payload)
+            self.stats.sent += 1
+            self.stats.bytes_sent += len(payload)
+        except OSError:
+            self.stats.send_errors += 1
+
+    def nominal_rate(self):
+        """Configured steady-state messages per second once onboarded"""
+        rate = 1.0 / (self.interval * self.batch)
+        if self.args.probe_interval > 0:
+            rate += 1.0 / self.args.probe_interval
+        if self.args.burst_period > 0 and self.message_type == DATA_MESSAGE:
+            rate += self.args.burst_size / self.args.burst_period
+        return rate
+
+    def jittered(self, interval):
+        return max(0.001, interval * (1.0 + self.rng.uniform(-self.args.jitter, self.args.jitter)))
+
+    def schedule(self, delay, callback):
+        scheduled = time.monotonic() + delay
+        self.timers[callback.__name__] = self.loop.call_later(delay, callback, scheduled)
+
+    def start(self):
+        self.started = time.monotonic()
+        self.schedule(0, self.onboarding_tick)
+        self.schedule(self.jittered(self.interval), self.report_tick)
+        if self.args.probe_interval > 0:
+            self.schedule(self.jittered(self.args.probe_interval), self.probe_tick)
+        if self.args.burst_period > 0:
+            self.schedule(self.jittered(self.args.burst_period), self.burst_tick)
+
+    def stop(self):
+        for timer in self.timers.values():
+            timer.cancel()
+        if self.transport is not None:
+            self.transport.close()
+
+    def onboarding_tick(self, scheduled):
+        if not self.onboarded:
+            self.send(self.message(ONBOARD_MESSAGE), scheduled)
+        self.schedule(ONBOARDING_INTERVAL, self.onboarding_tick)
+
+    def report_tick(self, scheduled):
+        if self.onboarded and self.batch > 1:
+            self.buffered.append((time.monotonic(), self.payload(self.rng)))
+            if len(self.buffered) >= self.batch:
+                self.send(self.batch_message(), scheduled)
+                self.stats.readings += len(self.buffered)
+                self.buffered = []
+        elif self.onboarded:
+            self.send(self.message(self.message_type, self.reading()), scheduled)
+            self.stats.readings += 1 if self.message_type == DATA_MESSAGE else 0
+        self.schedule(self.jittered(self.interval), self.report_tick)
+
+    def probe_tick(self, scheduled):
+        if self.onboarded:
+            # an unanswered probe counts as lost, the next one starts a new measurement
+            self.stats.probes_sent += 1
+            self.pending_probe = time.monotonic()
+            self.send(self.message(ONBOARD_MESSAGE), scheduled)
+        self.schedule(self.jittered(self.args.probe_interval), self.probe_tick)
+
+    def burst_tick(self, scheduled):
+        if self.onboarded and self.message_type == DATA_MESSAGE:
+            # a misbehaving device: readings back-to-back, one datagram each, batching or not
+            for _ in range(self.args.burst_size):
+                self.send(self.message(DATA_MESSAGE, self.reading()), scheduled)
+                self.stats.readings += 1
+        self.schedule(self.jittered(self.args.burst_period), self.burst_tick)
+
+
+def parse_mix(mix):
+    weights = {}
+    for part in mix.split(","):
+        name, _, weight = part.partition(":")
+        if name not in DEVICE_TYPES:
+            raise argparse.ArgumentTypeError("unknown device type: %s" % name)
+        weights[name] = float(weight or 1)
+    return weights
+
+
+def report(stats, devices, elapsed, final=False):
+    onboarded = sum(1 for d in devices if d.onboarded)
+    result = {
+        "elapsed_s": round(elapsed, 1),
+        "devices": len(devices),
+        "onboarded": onboarded,
+        "offered_rate": round(sum(d.nominal_rate() for d in devices), 2),
+        "attempted_rate": round(stats.attempted / elapsed, 2) if elapsed > 0 else 0,
+        "achieved_rate": round(stats.sent / elapsed, 2) if elapsed > 0 else 0,
+        "sent": stats.sent,
+        "readings_sent": stats.readings,
+        "late_sends": stats.late,
+        "send_errors": stats.send_errors,
+        "bytes_sent": stats.bytes_sent,
+        "probe_loss": round(1.0 - stats.probes_answered / stats.probes_sent, 4) if stats.probes_sent else None,
+        "probe_rtt_p50_ms": round(percentile(stats.probe_rtts, 50) * 1000, 1) if stats.probe_rtts else None,
+        "probe_rtt_p95_ms": round(percentile(stats.probe_rtts, 95) * 1000, 1) if stats.probe_rtts else None,
+        "onboarding_p50_s": round(percentile(stats.onboard_times, 50), 2) if stats.onboard_times else None,
+        "onboarding_p95_s": round(percentile(stats.onboard_times, 95), 2) if stats.onboard_times else None,
+        "onboarding_complete_s": round(max(stats.onboard_times), 2) if len(stats.onboard_times) == len(devices) else None,
+        "reonboard_requests": stats.reonboard_requests,
+    }
+    if final:
+        print(json.dumps(result, indent=2))
+    else:
+        print("%6.1fs onboarded %d/%d, offered %.1f msg/s, achieved %.1f msg/s, late %d, probe loss %s" % (
+            elapsed, onboarded, len(devices), result["offered_rate"], result["achieved_rate"], result["late_sends"],
+            "-" if result["probe_loss"] is None else "%.2f%%" % (result["probe_loss"] * 100)))
+    return result
+
+
+async def run(args):
+    loop = asyncio.get_running_loop()
+    rng = random.Random(args.seed)
+    weights = parse_mix(args.mix)
+    types = rng.choices(list(weights.keys()), weights=list(weights.values()), k=args.devices)
+    stats = Stats()
+    devices = []
+
+    for index, device_type in enumerate(types):
+        device = Device(index, device_type, args, stats, random.Random(rng.random()), loop)
+        await loop.create_datagram_endpoint(lambda d=device: d, remote_addr=(args.host, args.port), family=socket.AF_INET)
+        devices.append(device)
+
+    start = time.monotonic()
+    for index, device in enumerate(devices):
+        # simultaneous start emulates a site power cycle, otherwise devices come up over the ramp period
+        delay = 0 if args.ramp <= 0 else args.ramp * index / len(devices)
+        loop.call_later(delay, device.start)
+
+    next_report = start + args.report_interval
+    while time.monotonic() - start < args.duration:
+        await asyncio.sleep(min(0.5, max(0.0, next_report - time.monotonic())))
+        if time.monotonic() >= next_report:
+            report(stats, devices, time.monotonic() - start)
+            next_report += args.report_interval
+
+    for device in devices:
+        device.stop()
+    result = report(stats, devices, time.monotonic() - start, final=True)
+    result["config"] = {k: v for k, v in vars(args).items() if k != "json"}
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(result, f, indent=2)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Synthetic device fleet for the gateway UDP ingestion path")
+    parser.add_argument("--host", default="127.0.0.1", help="gateway address")
+    parser.add_argument("--port", type=int, default=1234, help="gateway udp port (udp_port in secrets.h)")
+    parser.add_argument("--devices", type=int, default=100, help="fleet size")
+    parser.add_argument("--mix", default="PresenceSensorAsset,EnvironmentSensorAsset,AirQualitySensorAsset,PlugAsset",
+                        help="device types with optional weights, e.g. PresenceSensorAsset:3,PlugAsset:1")
+    parser.add_argument("--duration", type=float, default=120, help="test duration in seconds")
+    parser.add_argument("--interval-scale", type=float, default=1.0, help="multiplier for the client report intervals (0.1 = 10x rate)")
+    parser.add_argument("--jitter", type=float, default=0.1, help="relative interval jitter (0.1 = +-10%%)")
+    parser.add_argument("--ramp", type=float, default=0, help="spread device start over this many seconds (0 = power cycle, all at once)")
+    parser.add_argument("--per-reading", action="store_true",
+                        help="send every sensor reading as its own DATA_MESSAGE (firmware before batching)")
+    parser.add_argument("--burst-period", type=float, default=0, help="seconds between bursts per device (0 = no bursts)")
+    parser.add_argument("--burst-size", type=int, default=5, help="readings per burst")
+    parser.add_argument("--probe-interval", type=float, default=15, help="seconds between onboard probes per device (0 = off)")
+    parser.add_argument("--report-interval", type=float, default=5, help="seconds between progress lines")
+    parser.add_argument("--serial-prefix", default="LOAD", help="serial number prefix, keep distinct from real devices")
+    parser.add_argument("--seed", type=int, default=1, help="random seed, runs with the same seed offer the same traffic")
+    parser.add_argument("--json", help="write the final report to this file")
+    asyncio.run(run(parser.parse_args()))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,490 @@
+#!/usr/bin/env python3
+"""Local stand-in for the OpenRemote Gateway MQTT API, for end-to-end latency tests of the device gateway.
+
+A minimal MQTT 3.1.1 broker (CONNECT, PUBLISH QoS 0/1, SUBSCRIBE/UNSUBSCRIBE with +/# filters, PING) that behaves
+like the OpenRemote manager for a single gateway client:
+- answers <realm>/<client>/operations/assets/<responseId>/create on .../create/response with an asset CREATE event
+- records attribute updates, asset updates/deletes and event acknowledgements
+- emits gateway/events/pending attribute events (onOff) for the plug probe device
+- injects broker latency (+ jitter) on everything sent to the gateway, and periodic disconnects
+
+Two probe devices talk UDP to the gateway, like the gateway-*-client sketches, to close the loop:
+- an EnvironmentSensorAsset sends readings with a unique temperature: UDP send -> attribute update at the broker
+  (the gateway rounds temperature to 0.1 and only publishes changed values, see config/transforms.json: readings
+  step by 0.3 so every one survives both)
+- a PlugAsset receives the ACTION_ON/ACTION_OFF for every pending event: pending event -> UDP action, and -> ack
+
+The gateway connects with TLS (WiFiClientSecure), so pass a certificate for the address the gateway uses:
+    openssl req -x509 -newkey rsa:2048 -nodes -days 365 -keyout key.pem -out cert.pem \\
+        -subj "/CN=192.168.1.20" -addext "subjectAltName=IP:192.168.1.20"
+then set mqtt_host = "192.168.1.20", mqtt_port = 8883 and root_ca = <cert.pem> in secrets.h.
+
+Example:
+    python openremote_mock.py --certfile cert.pem --keyfile key.pem --gateway-host 192.168.1.50 --latency 50 --json report.json
+"""
+
+import argparse
+import asyncio
+import json
+import random
+import ssl
+import string
+import struct
+import time
+
+CONNECT, CONNACK, PUBLISH, PUBACK = 1, 2, 3, 4
+SUBSCRIBE, SUBACK, UNSUBSCRIBE, UNSUBACK = 8, 9, 10, 11
+PINGREQ, PINGRESP, DISCONNECT = 12, 13, 14
+
+ONBOARD_MESSAGE, DATA_MESSAGE, ALIVE_MESSAGE = 0, 1, 2
+
+
+def percentile(values, p):
+    if not values:
+        return None
+    values = sorted(values)
+    return values[min(len(values) - 1, int(round(p / 100.0 * (len(values) - 1))))]
+
+
+def summarize(values):
+    """Latency summary in ms"""
+    if not values:
+        return {"count": 0}
+    return {
+        "count": len(values),
+        "p50_ms": round(percentile(values, 50) * 1000, 1),
+        "p95_ms": round(percentile(values, 95) * 1000, 1),
+        "max_ms": round(max(values) * 1000, 1),
+    }
+
+
+def topic_matches(topic_filter, topic):
+    filter_levels = topic_filter.split("/")
+    topic_levels = topic.split("/")
+    for i, level in enumerate(filter_levels):
+        if level == "#":
+            return True
+        if i >= len(topic_levels) or (level != "+" and level != topic_levels[i]):
+            return False
+    return len(filter_levels) == len(topic_levels)
+
+
+def asset_id():
+    return "".join(random.choice(string.ascii_letters + string.digits) for _ in range(22))
+
+
+def encode_length(length):
+    encoded = bytearray()
+    while True:
+        byte = length % 128
+        length //= 128
+        encoded.append(byte | (0x80 if length else 0))
+        if not length:
+            return bytes(encoded)
+
+
+def encode_string(value):
+    data = value.encode("utf-8")
+    return struct.pack("!H", len(data)) + data
+
+
+def packet(packet_type, flags, body):
+    return bytes([(packet_type << 4) | flags]) + encode_length(len(body)) + body
+
+
+class Metrics:
+    def __init__(self):
+        self.connections = 0
+        self.disconnects_injected = 0
+        self.creates = 0
+        self.attribute_updates = 0
+        self.asset_updates = 0
+        self.asset_deletes = 0
+        self.pending_events = 0
+        self.acks = []               # ack ids received
+        self.qos1_publishes = 0
+        self.udp_to_attribute = []   # seconds, probe reading sent -> attribute update received
+        self.pending_to_action = []  # seconds, pending event published -> ACTION datagram at the plug probe
+        self.pending_to_ack = []     # seconds, pending event published -> acknowledgement received
+
+    def report(self):
+        return {
+            "connections": self.connections,
+            "disconnects_injected": self.disconnects_injected,
+            "creates": self.creates,
+            "attribute_updates": self.attribute_updates,
+            "asset_updates": self.asset_updates,
+            "asset_deletes": self.asset_deletes,
+            "qos1_publishes": self.qos1_publishes,
+            "pending_events": self.pending_events,
+            "acks": len(self.acks),
+            "udp_to_attribute_update": summarize(self.udp_to_attribute),
+            "pending_event_to_action": summarize(self.pending_to_action),
+            "pending_event_to_ack": summarize(self.pending_to_ack),
+        }
+
+
+class Manager:
+    """OpenRemote manager state shared by the broker connection and the probe devices"""
+
+    def __init__(self, args):
+        self.args = args
+        self.metrics = Metrics()
+        self.session = None
+        self.assets = {}           # sn -> asset id
+        self.pending = {}          # ack id -> publish time
+        self.last_action = None    # (publish time, expected action) of the last pending event
+        self.readings = {}         # probe temperature ("%.1f") -> send time
+        self.next_ack_id = 1
+
+    def handle_publish(self, topic, payload):
+        levels = topic.split("/")
+        # <realm>/<client>/operations/assets/<id>/...
+        if len(levels) >= 6 and levels[2] == "operations" and levels[3] == "assets":
+            realm, client, target, operation = levels[0], levels[1], levels[4], levels[5:]
+            if operation == ["create"]:
+                self.handle_create(realm, client, target, payload, topic)
+            elif operation[0] == "attributes" and operation[-1] == "update":
+                self.handle_attribute_update(target, operation, payload, topic)
+            elif operation == ["update"]:
+                self.metrics.asset_updates += 1
+                self.respond(topic, {"eventType": "asset", "cause": "UPDATE", "asset": json.loads(payload or "{}")})
+            elif operation == ["delete"]:
+                self.metrics.asset_deletes += 1
+                self.respond(topic, {"eventType": "asset", "cause": "DELETE", "asset": {"id": target}})
+        elif topic.endswith("/gateway/events/acknowledge"):
+            self.handle_ack(payload.decode("utf-8", "replace"))
+
+    def handle_create(self, realm, client, response_id, payload, topic):
+        self.metrics.creates += 1
+        asset = json.loads(payload)
+        sn = asset.get("attributes", {}).get("sn", {}).get("value", response_id)
+        # resyncs send the stored representation, which already has an id
+        asset.setdefault("id", self.assets.get(sn) or asset_id())
+        asset.setdefault("realm", realm)
+        self.assets[sn] = asset["id"]
+        self.respond(topic, {"eventType": "asset", "cause": "CREATE", "asset": asset})
+
+    def handle_attribute_update(self, target, operation, payload, topic):
+        self.metrics.attribute_updates += 1
+        temperature = None
+        if len(operation) == 3:  # attributes/<name>/update
+            if operation[1] == "temperature":
+                temperature = payload.decode("utf-8", "replace").strip('"')
+        else:                    # attributes/update, json object of attributes
+            try:
+                temperature = json.loads(payload).get("temperature")
+            except (ValueError, AttributeError):
+                pass
+        try:
+            sent = self.readings.pop("%.1f" % float(temperature), None) if temperature is not None else None
+        except (TypeError, ValueError):
+            sent = None
+        if sent is not None:
+            self.metrics.udp_to_attribute.append(time.monotonic() - sent)
+        self.respond(topic, {"eventType": "attribute", "ref": {"id": target}})
+
+    def handle_ack(self, ack_id):
+        self.metrics.acks.append(ack_id)
+        published = self.pending.pop(ack_id, None)
+        if published is not None:
+            self.metrics.pending_to_ack.append(time.monotonic() - published)
+
+    def respond(self, topic, event):
+        if self.session is not None:
+            self.session.deliver(topic + "/response", json.dumps(event, separators=(",", ":")))
+
+    def emit_pending_event(self, plug_sn, value):
+        asset = self.assets.get(plug_sn)
+        if asset is None or self.session is None:
+            return False
+        ack_id = str(self.next_ack_id)
+        self.next_ack_id += 1
+        event = {
+            "ackId": ack_id,
+            "event": {
+                "eventType": "attribute",
+                "ref": {"id": asset, "name": "onOff"},
+                "value": value,
+                "timestamp": int(time.time() * 1000),
+                "deleted": False,
+                "realm": self.args.realm,
+            },
+        }
+        topic = "%s/%s/gateway/events/pending" % (self.args.realm, self.session.client_id)
+        if not self.session.deliver(topic, json.dumps(event, separators=(",", ":"))):
+            return False
+        now = time.monotonic()
+        self.pending[ack_id] = now
+        self.last_action = (now, b"ACTION_ON" if value else b"ACTION_OFF")
+        self.metrics.pending_events += 1
+        return True
+
+
+class Session(asyncio.Protocol):
+    """A single MQTT client connection"""
+
+    def __init__(self, manager):
+        self.manager = manager
+        self.args = manager.args
+        self.transport = None
+        self.buffer = bytearray()
+        self.client_id = None
+        self.subscriptions = set()
+        self.outbox = asyncio.Queue()
+        self.last_due = 0
+        self.writer = None
+
+    def connection_made(self, transport):
+        self.transport = transport
+        self.writer = asyncio.ensure_future(self.write_loop())
+
+    def connection_lost(self, exc):
+        if self.manager.session is self:
+            self.manager.session = None
+        if self.writer is not None:
+            self.writer.cancel()
+        print("- MQTT client disconnected: %s" % self.client_id)
+
+    def data_received(self, data):
+        self.buffer.extend(data)
+        while True:
+            parsed = self.parse_packet()
+            if parsed is None:
+                return
+            self.handle_packet(*parsed)
+
+    def parse_packet(self):
+        multiplier, length, index = 1, 0, 1
+        while True:
+            if index >= len(self.buffer):
+                return None
+            byte = self.buffer[index]
+            length += (byte & 0x7F) * multiplier
+            multiplier *= 128
+            index += 1
+            if not byte & 0x80:
+                break
+        if len(self.buffer) < index + length:
+            return None
+        header = self.buffer[0]
+        body = bytes(self.buffer[index:index + length])
+        del self.buffer[:index + length]
+        return header >> 4, header & 0x0F, body
+
+    def send(self, data):
+        # broker latency: every packet to the gateway is delayed, order is preserved
+        delay = max(0.0, (self.args.latency + random.uniform(-self.args.jitter, self.args.jitter)) / 1000.0)
+        due = max(self.last_due, time.monotonic() + delay)
+        self.last_due = due
+        self.outbox.put_nowait((due, data))
+
+    async def write_loop(self):
+        while True:
+            due, data = await self.outbox.get()
+            wait = due - time.monotonic()
+            if wait > 0:
+                await asyncio.sleep(wait)
+            if self.transport.is_closing():
+                return
+            self.transport.write(data)
+
+    def deliver(self, topic, payload):
+        """Publish to the gateway if it is subscribed to the topic (QoS 0)"""
+        if not any(topic_matches(f, topic) for f in self.subscriptions):
+            return False
+        self.send(packet(PUBLISH, 0, encode_string(topic) + payload.encode("utf-8")))
+        return True
+
+    def handle_packet(self, packet_type, flags, body):
+        if packet_type == CONNECT:
+            self.handle_connect(body)
+        elif packet_type == PUBLISH:
+            qos = (flags >> 1) & 0x03
+            topic_length = struct.unpack("!H", body[:2])[0]
+            topic = body[2:2 + topic_length].decode("utf-8")
+            offset = 2 + topic_length
+            if qos > 0:
+                packet_id = body[offset:offset + 2]
+                offset += 2
+                self.manager.metrics.qos1_publishes += 1
+                self.send(packet(PUBACK, 0, packet_id))
+            self.manager.handle_publish(topic, body[offset:])
+        elif packet_type == SUBSCRIBE:
+            packet_id, offset, granted = body[:2], 2, bytearray()
+            while offset < len(body):
+                length = struct.unpack("!H", body[offset:offset + 2])[0]
+                self.subscriptions.add(body[offset + 2:offset + 2 + length].decode("utf-8"))
+                granted.append(min(body[offset + 2 + length], 1))
+                offset += 3 + length
+            self.send(packet(SUBACK, 0, packet_id + bytes(granted)))
+        elif packet_type == UNSUBSCRIBE:
+            packet_id, offset = body[:2], 2
+            while offset < len(body):
+                length = struct.unpack("!H", body[offset:offset + 2])[0]
+                self.subscriptions.discard(body[offset + 2:offset + 2 + length].decode("utf-8"))
+                offset += 2 + length
+            self.send(packet(UNSUBACK, 0, packet_id))
+        elif packet_type == PINGREQ:
+            self.send(packet(PINGRESP, 0, b""))
+        elif packet_type == DISCONNECT:
+            self.transport.close()
+
+    def handle_connect(self, body):
+        offset = 2 + struct.unpack("!H", body[:2])[0]  # protocol name
+        offset += 4                                     # level, flags, keep alive
+        length = struct.unpack("!H", body[offset:offset + 2])[0]
+        self.client_id = body[offset + 2:offset + 2 + length].decode("utf-8")
+        # CONNACK is not delayed, the gateway holds its mqtt lock while connecting
+        self.transport.write(packet(CONNACK, 0, b"\x00\x00"))
+        if self.manager.session is not None:
+            self.manager.session.transport.close()
+        self.manager.session = self
+        self.manager.metrics.connections += 1
+        print("+ MQTT client connected: %s" % self.client_id)
+
+
+class ProbeDevice(asyncio.DatagramProtocol):
+    """A UDP device talking to the gateway, like the gateway-*-client sketches"""
+
+    def __init__(self, manager, name, sn, device_type):
+        self.manager = manager
+        self.name, self.sn, self.type = name, sn, device_type
+        self.transport = None
+        self.onboarded = False
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def datagram_received(self, data, addr):
+        if data == b"ONBOARD_OK":
+            self.onboarded = True
+        elif data == b"ONBOARD_REQ":
+            self.onboarded = False
+        elif data in (b"ACTION_ON", b"ACTION_OFF") and self.manager.last_action is not None:
+            published, expected = self.manager.last_action
+            if data == expected:
+                self.manager.metrics.pending_to_action.append(time.monotonic() - published)
+                self.manager.last_action = None
+
+    def send(self, message_type, data=""):
+        self.transport.sendto(json.dumps({
+            "device_name": self.name,
+            "device_sn": self.sn,
+            "device_type": self.type,
+            "data": data,
+            "message_type": message_type,
+        }, separators=(",", ":")).encode("utf-8"))
+
+
+async def run_sensor_probe(manager, probe, interval):
+    sequence = 0
+    while True:
+        if not probe.onboarded:
+            probe.send(ONBOARD_MESSAGE)
+            await asyncio.sleep(5)
+            continue
+        # unique value per reading, matched against the attribute update at the broker: the gateway rounds it to
+        # one decimal and drops repeats, so consecutive readings differ by more than the rounding
+        sequence += 1
+        temperature = "%.1f" % (20 + (sequence % 100) * 0.3)
+        manager.readings[temperature] = time.monotonic()
+        probe.send(DATA_MESSAGE, json.dumps({"temperature": float(temperature), "relativeHumidity": 50.0}))
+        await asyncio.sleep(interval)
+
+
+async def run_plug_probe(manager, probe, interval):
+    value = True
+    last_alive = 0
+    while True:
+        if not probe.onboarded:
+            probe.send(ONBOARD_MESSAGE)
+            await asyncio.sleep(5)
+            continue
+        if time.monotonic() - last_alive > 10:
+            probe.send(ALIVE_MESSAGE)  # keeps the gateway's address/port for the plug up to date
+            last_alive = time.monotonic()
+        if manager.emit_pending_event(probe.sn, value):
+            value = not value
+        await asyncio.sleep(interval)
+
+
+async def run_disconnects(manager, period):
+    while True:
+        await asyncio.sleep(period)
+        if manager.session is not None:
+            manager.metrics.disconnects_injected += 1
+            print("! Injected disconnect")
+            manager.session.transport.abort()
+
+
+async def run(args):
+    loop = asyncio.get_running_loop()
+    manager = Manager(args)
+
+    context = None
+    if args.certfile:
+        context = ssl.create_default_context(ssl.Purpose.CLIENT_AUTH)
+        context.load_cert_chain(args.certfile, args.keyfile)
+    server = await loop.create_server(lambda: Session(manager), args.bind, args.port, ssl=context)
+    print("+ Mock OpenRemote listening on %s:%d (%s)" % (args.bind, args.port, "TLS" if context else "plain"))
+
+    tasks = []
+    if args.gateway_host:
+        for name, sn, device_type, runner, interval in (
+            ("Mock Climate Probe", args.serial_prefix + "-ENV", "EnvironmentSensorAsset", run_sensor_probe, args.probe_interval),
+            ("Mock Plug Probe", args.serial_prefix + "-PLUG", "PlugAsset", run_plug_probe, args.pending_interval),
+        ):
+            _, probe = await loop.create_datagram_endpoint(
+                lambda n=name, s=sn, t=device_type: ProbeDevice(manager, n, s, t),
+                remote_addr=(args.gateway_host, args.gateway_port))
+            tasks.append(asyncio.ensure_future(runner(manager, probe, interval)))
+    if args.disconnect_every > 0:
+        tasks.append(asyncio.ensure_future(run_disconnects(manager, args.disconnect_every)))
+
+    start = time.monotonic()
+    try:
+        while args.duration <= 0 or time.monotonic() - start < args.duration:
+            await asyncio.sleep(args.report_interval)
+            m = manager.metrics.report()
+            print("%6.1fs creates %d, updates %d, pending %d, acks %d, udp->attr p50 %s ms, pending->action p50 %s ms" % (
+                time.monotonic() - start, m["creates"], m["attribute_updates"], m["pending_events"], m["acks"],
+                m["udp_to_attribute_update"].get("p50_ms", "-"), m["pending_event_to_action"].get("p50_ms", "-")))
+    finally:
+        for task in tasks:
+            task.cancel()
+        server.close()
+        result = manager.metrics.report()
+        result["config"] = {k: v for k, v in vars(args).items() if k not in ("json", "keyfile")}
+        print(json.dumps(result, indent=2))
+        if args.json:
+            with open(args.json, "w") as f:
+                json.dump(result, f, indent=2)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Local stand-in for the OpenRemote Gateway MQTT API")
+    parser.add_argument("--bind", default="0.0.0.0", help="broker listen address")
+    parser.add_argument("--port", type=int, default=8883, help="broker port (mqtt_port in secrets.h)")
+    parser.add_argument("--certfile", help="TLS certificate (PEM), plain TCP if omitted")
+    parser.add_argument("--keyfile", help="TLS private key (PEM)")
+    parser.add_argument("--realm", default="master", help="realm used in emitted events")
+    parser.add_argument("--latency", type=float, default=0, help="broker latency in ms, applied to everything sent to the gateway")
+    parser.add_argument("--jitter", type=float, default=0, help="latency jitter in ms (+-)")
+    parser.add_argument("--disconnect-every", type=float, default=0, help="drop the gateway connection every N seconds (0 = never)")
+    parser.add_argument("--gateway-host", help="gateway address, enables the UDP probe devices")
+    parser.add_argument("--gateway-port", type=int, default=1234, help="gateway udp port (udp_port in secrets.h)")
+    parser.add_argument("--probe-interval", type=float, default=2, help="seconds between sensor probe readings")
+    parser.add_argument("--pending-interval", type=float, default=5, help="seconds between pending onOff events for the plug probe")
+    parser.add_argument("--serial-prefix", default="MOCK", help="serial number prefix of the probe devices")
+    parser.add_argument("--duration", type=float, default=0, help="stop after N seconds (0 = run until interrupted)")
+    parser.add_argument("--report-interval", type=float, default=10, help="seconds between progress lines")
+    parser.add_argument("--json", help="write the final report to this file")
+    try:
+        asyncio.run(run(parser.parse_args()))
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -1,4 +1,5 @@
 
+#include <Arduino.h>
 #include <ArduinoJson.h>
 
 // onboarding messages
@@ -24,6 +25,8 @@ struct DeviceMessage
     std::string device_type;
     std::string data;
     MessageType message_type;
+    uint32_t seq;  // per device message counter, lets the gateway drop duplicates and count lost packets
+    uint32_t boot; // random per boot, the counter starts over after a restart
 
     DeviceMessage(std::string device_name, std::string device_sn, std::string device_type, std::string data, MessageType message_type)
     {
@@ -32,6 +35,25 @@ struct DeviceMessage
         this->device_type = device_type;
         this->data = data;
         this->message_type = message_type;
+        this->seq = nextSequence();
+        this->boot = bootId();
+    }
+
+    // every message that is created is sent, so one counter for the device
+    static uint32_t nextSequence()
+    {
+        static uint32_t sequence = 0;
+        return ++sequence;
+    }
+
+    static uint32_t bootId()
+    {
+        static uint32_t id = 0;
+        while (id == 0)
+        {
+            id = ESP.random() & 0xFFFFFF;
+        }
+        return id;
     }
 
     std::string toJson()
@@ -42,6 +64,8 @@ struct DeviceMessage
         doc["device_type"] = device_type;
         doc["data"] = data;
         doc["message_type"] = (int)message_type;
+        doc["seq"] = seq;
+        doc["boot"] = boot;
 
         std::string output;
         serializeJson(doc, output);